@@ -31,15 +31,19 @@
 #ifndef AREAFIT_INCLUDED
 #define AREAFIT_INCLUDED
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <thread>
 
 namespace afit {
 
-//#define VOX_AREAFITTER_TEST 1 // Define to enable statistical testing of the
-	// area fitting algorithm.
-
 /**
  * "libvox" default memory buffer allocator. Used to supply various storage
  * classes with the required memory allocation, re-allocation and freeing
@@ -65,6 +69,44 @@ protected:
 	}
 };
 
+/**
+ * Memory allocator class used by the storage classes by default. This macro
+ * can be defined before including this file to supply a different allocator,
+ * for example an arena allocator. The allocator class should provide the
+ * allocmem(), reallocmem() and freemem() static functions like the
+ * CVoxMemAllocator class.
+ */
+
+#if !defined( AREAFIT_ALLOCATOR )
+	#define AREAFIT_ALLOCATOR CVoxMemAllocator
+#endif // !defined( AREAFIT_ALLOCATOR )
+
+/**
+ * Signed integer type used to hold image and area sizes in pixels, and their
+ * sums. The default 64-bit type allows large canvases and many output images
+ * without an overflow. Coordinates and dimensions always use the "int" type.
+ */
+
+#if !defined( AREAFIT_SIZE_TYPE )
+	#define AREAFIT_SIZE_TYPE int64_t
+#endif // !defined( AREAFIT_SIZE_TYPE )
+
+/**
+ * Equals 1 if SSE2 instructions are used to scan output areas during the
+ * search. Since only a few output areas are usually skipped per scan, the
+ * scalar code is not slower in most cases, and is used by default. This
+ * macro can be defined to 1 before including this file if the compiler
+ * targets SSE2.
+ */
+
+#if !defined( AREAFIT_SSE2 )
+	#define AREAFIT_SSE2 0
+#endif // !defined( AREAFIT_SSE2 )
+
+#if AREAFIT_SSE2
+	#include <emmintrin.h>
+#endif // AREAFIT_SSE2
+
 /**
  * Memory buffer object. Allows easier handling of memory blocks allocation
  * and automatic deallocation for arrays (buffers) consisting of elements of
@@ -81,7 +123,7 @@ protected:
  * CAlloc - data allocator and base class.
  */
 
-template< class T, int LocSizeBytes = 48, class CAlloc = CVoxMemAllocator >
+template< class T, int LocSizeBytes = 48, class CAlloc = AREAFIT_ALLOCATOR >
 class CBuffer : public CAlloc
 {
 public:
@@ -307,8 +349,9 @@ private:
 	T* Data; ///< Element buffer pointer. Points either to the LocalStorage or
 		/// a buffer allocated via the CAlloc :: allocmem function.
 	int Capacity; ///< Element buffer capacity.
-	uint8_t LocalStorage[ LocalStorageSize * (int) sizeof( T )]; ///< Local
-		/// element storage.
+	alignas( T ) uint8_t LocalStorage[ LocalStorageSize *
+		(int) sizeof( T )]; ///< Local element storage, aligned for the
+		/// elements.
 
 	/**
 	 * Internal element buffer allocation function used during object
@@ -358,7 +401,7 @@ private:
  */
 
 template< class T, int LocSizeBytes, class CItemAlloc,
-	class CBufferAlloc = CVoxMemAllocator >
+	class CBufferAlloc = AREAFIT_ALLOCATOR >
 class CArrayBase : public CItemAlloc
 {
 public:
@@ -618,7 +661,7 @@ public:
 		CItemAlloc :: deallocateItem( Items + Index );
 		ItemCount--;
 
-		memcpy( &Items[ Index ], &Items[ Index + 1 ],
+		memmove( &Items[ Index ], &Items[ Index + 1 ],
 			( ItemCount - Index ) * sizeof( StorageType ));
 	}
 
@@ -810,6 +853,20 @@ public:
 		: CArrayBase< T, LocSizeBytes, CArrayAllocator< T > >( Source )
 	{
 	}
+
+	/**
+	 * Operator creates copy of the specified array.
+	 *
+	 * @param Source Array whose copy to create.
+	 */
+
+	CArray& operator = ( const CArray& Source )
+	{
+		CArrayBase< T, LocSizeBytes, CArrayAllocator< T > > ::
+			operator = ( Source );
+
+		return( *this );
+	}
 };
 
 /**
@@ -926,6 +983,20 @@ public:
 		: CArrayBase< T, LocSizeBytes, CInitArrayAllocator< T > >( Source )
 	{
 	}
+
+	/**
+	 * Operator creates copy of the specified array.
+	 *
+	 * @param Source Array whose copy to create.
+	 */
+
+	CInitArray& operator = ( const CInitArray& Source )
+	{
+		CArrayBase< T, LocSizeBytes, CInitArrayAllocator< T > > ::
+			operator = ( Source );
+
+		return( *this );
+	}
 };
 
 /**
@@ -998,19 +1069,81 @@ private:
 	T Object;
 };
 
-class CAreaFitter
+/**
+ * Spin lock synchronizer object. Suitable for guarding short code sections
+ * that are rarely contended.
+ */
+
+class CSyncSpinLock
+{
+public:
+	CSyncSpinLock()
+	{
+		Flag.clear();
+	}
+
+	/**
+	 * Function acquires the lock, spinning until it becomes available.
+	 */
+
+	void acquire()
+	{
+		while( Flag.test_and_set( std :: memory_order_acquire ))
+		{
+			std :: this_thread :: yield();
+		}
+	}
+
+	/**
+	 * Function releases a previously acquired lock.
+	 */
+
+	void release()
+	{
+		Flag.clear( std :: memory_order_release );
+	}
+
+private:
+	std :: atomic_flag Flag; ///< Lock flag, "set" if the lock was acquired.
+
+	CSyncSpinLock( const CSyncSpinLock& );
+	CSyncSpinLock& operator = ( const CSyncSpinLock& );
+};
+
+/**
+ * Scoped CSyncSpinLock locker: acquires the lock on construction and releases
+ * it on destruction.
+ */
+
+class CSyncSpinLocker
 {
 public:
-	#if defined( VOX_AREAFITTER_TEST )
+	CSyncSpinLocker( CSyncSpinLock& aSync )
+		: Sync( aSync )
+	{
+		Sync.acquire();
+	}
+
+	~CSyncSpinLocker()
+	{
+		Sync.release();
+	}
+
+private:
+	CSyncSpinLock& Sync; ///< Synchronizer being held.
+};
+
+/**
+ * Macro that acquires the specified CSyncSpinLock object until the end of the
+ * current scope.
+ */
 
-		static int BestFitCallCount; ///< Number of fitArea() calls/recursions
-			/// made to achieve all best fits in a single fitAreas() call.
-		static int BestFitImgCount; ///< Sum of the number of output images of
-			/// each best fit, in a single fitAreas() call.
-		static int BestFitCount; ///< Number of best fits found in a single
-			/// fitAreas() call.
+#define VOXSYNCSPIN( a ) CSyncSpinLocker VoxSyncSpinLocker( a )
 
-	#endif // VOX_AREAFITTER_TEST
+class CAreaFitter
+{
+public:
+	typedef AREAFIT_SIZE_TYPE TSize; ///< Image size type.
 
 	/**
 	 * Structure that holds information about an area that should be optimally
@@ -1021,13 +1154,19 @@ public:
 	{
 		void* Object; ///< An abstract pointer to an object that should be put
 			/// into this area.
-		int Width; ///< X size of the area, including additional spacing.
-		int Height; ///< Y size of the area, including additional spacing.
+		int Width; ///< X size of the area. Spacing between areas should
+			/// not be included, see CFitParams :: Padding.
+		int Height; ///< Y size of the area.
 		int OutImage; ///< Output image index. If not all areas can be fitted
 			/// into the same output image, additional images will be created.
 		int OutX; ///< X offset of this area within the output image.
 		int OutY; ///< Y offset of this area within the output image.
 		CFitArea* Next; ///< Next area in a chain.
+		bool MayRotate; ///< "True" if the area may be rotated by 90 degrees.
+			/// Used only if CFitParams :: AllowRotation is "true".
+		bool OutRotated; ///< "True" if the area was rotated by 90 degrees:
+			/// in this case it occupies Height x Width pixels in the output
+			/// image. Width and Height themselves are not changed.
 	};
 
 	/**
@@ -1038,7 +1177,365 @@ public:
 	{
 		int Width; ///< Width of the image.
 		int Height; ///< Height of the image.
-		int Size; ///< Size (=Width * Height) of the image.
+		TSize Size; ///< Size (=Width * Height) of the image.
+	};
+
+	/**
+	 * Observer interface that receives intermediate results of the area fit
+	 * search. Observer's functions are called from the search threads, but
+	 * never concurrently.
+	 */
+
+	class CFitObserver
+	{
+	public:
+		virtual ~CFitObserver()
+		{
+		}
+
+		/**
+		 * Function is called whenever a new best fit is found. Function
+		 * should return "false" to stop the search and to return this fit
+		 * (e.g. if the fit quality is sufficient).
+		 *
+		 * @param FittedAreas Fitted areas, in an unspecified order.
+		 * @param OutImages Fit's output images.
+		 * @param FitQuality Fit's quality in percent.
+		 */
+
+		virtual bool onBestFit( const CArray< CFitArea >& FittedAreas,
+			const CArray< COutImage >& OutImages, double FitQuality ) = 0;
+	};
+
+	/**
+	 * Structure that receives statistics of a single area fit search. The
+	 * default constructor initializes all values to zero.
+	 */
+
+	struct CFitStats
+	{
+		int FitCallCount; ///< The number of fitArea() calls/recursions
+			/// performed, summed among all threads.
+		int64_t BestOutSizePruneCount; ///< The number of placements rejected
+			/// because the summary output image size would have reached the
+			/// best size found so far.
+		int64_t MaxOutImageSizePruneCount; ///< The number of placements
+			/// rejected because the output image size would have exceeded
+			/// MaxOutImageSize.
+		int64_t LowerBoundPruneCount; ///< The number of placements not
+			/// explored further because the lower bound of the summary
+			/// output image size reached the best size found so far.
+		int NewOutImageCount; ///< The number of times a new output image was
+			/// opened during the search.
+		int BestFitCount; ///< The number of best fit improvements.
+		int BestFitCallCount; ///< The number of fitArea() calls/recursions
+			/// performed until the last best fit improvement. This value is
+			/// approximate if several threads were used.
+		double FirstBestFitTime; ///< Time from the start of the search until
+			/// the first fit was found, in seconds. 0 if no fit was found.
+		double LastBestFitTime; ///< Time from the start of the search until
+			/// the last best fit improvement, in seconds. 0 if no fit was
+			/// found.
+		int MaxDepth; ///< The maximal stack depth reached, equal to the
+			/// maximal number of areas placed at once minus 1.
+
+		CFitStats()
+			: FitCallCount( 0 )
+			, BestOutSizePruneCount( 0 )
+			, MaxOutImageSizePruneCount( 0 )
+			, LowerBoundPruneCount( 0 )
+			, NewOutImageCount( 0 )
+			, BestFitCount( 0 )
+			, BestFitCallCount( 0 )
+			, FirstBestFitTime( 0.0 )
+			, LastBestFitTime( 0.0 )
+			, MaxDepth( 0 )
+		{
+		}
+	};
+
+	class CFitContext;
+	class CFitCache;
+
+	/**
+	 * Area sort orders. Areas are fitted in the sorted order, which has a
+	 * large effect on how soon good fits are found. Rotatable areas are
+	 * sorted by their landscape orientation if rotation is allowed. Each
+	 * order is descending.
+	 */
+
+	enum ESortOrder
+	{
+		SortByWidth = 1, ///< Sort by width.
+		SortByHeight = 2, ///< Sort by height.
+		SortByArea = 4, ///< Sort by area size.
+		SortByMaxSide = 8, ///< Sort by the larger dimension.
+		SortByPerimeter = 16, ///< Sort by the sum of width and height.
+		SortByAll = 31 ///< All sort orders.
+	};
+
+	/**
+	 * Structure that holds additional parameters of the area fit search.
+	 * The default constructor initializes the parameters to their default
+	 * values.
+	 */
+
+	struct CFitParams
+	{
+		int ThreadCount; ///< The number of threads to perform the search
+			/// with, including the calling thread. Each thread takes "root
+			/// areas" (areas placed first) from a shared pool and searches
+			/// their possibilities independently, sharing the best fit found
+			/// so far. Idle threads steal untried areas and configuration 2
+			/// branches from shallow search levels of busy threads. If this
+			/// value is equal to 0, the number of hardware threads will be
+			/// used. The number of threads is limited to the number of
+			/// areas. Default is 1.
+		bool HasDeadline; ///< "True" if the Deadline variable should be
+			/// used. Default is "false".
+		std :: chrono :: steady_clock :: time_point Deadline; ///< Point in
+			/// time after which the search is stopped, and the best fit found
+			/// so far is returned.
+		const std :: atomic< bool >* CancelFlag; ///< Pointer to a flag that
+			/// can be set to "true" by another thread to stop the search, and
+			/// to return the best fit found so far. NULL if not used
+			/// (default).
+		CFitObserver* Observer; ///< Observer that receives each new best fit
+			/// found during the search. NULL if not used (default).
+		CFitStats* Stats; ///< Pointer to the structure that receives
+			/// statistics of the search, regardless of its outcome. NULL if
+			/// not used (default).
+		bool AllowRotation; ///< "True" if areas with the MayRotate flag set
+			/// should be tried in both orientations. Square areas are never
+			/// rotated. Default is "false", in which case the MayRotate flag
+			/// is ignored.
+		bool DoGreedySeed; ///< "True" if a fast greedy "skyline" fit should
+			/// be found before the search. This fit is used as the initial
+			/// best fit, so that the search prunes placements from the start,
+			/// and a fit is available even with a small FitCallsLimit.
+			/// Default is "true".
+		int MinOutImageCountLimit; ///< If this value is greater than
+			/// MinOutImageCount, the search is repeated with the starting
+			/// number of output images increased by 1, up to this value, and
+			/// the best fit among all searches is returned. Each search
+			/// performs up to FitCallsLimit calls, and is pruned by the best
+			/// fit found by the previous searches. The searches end early if
+			/// an optimal fit was found, or if the search was stopped. Not
+			/// used by the refitAreas() function. Default is 0.
+		int SortOrders; ///< Bit mask of ESortOrder values: sort orders of
+			/// the areas to search with. If several orders are specified, a
+			/// separate search is performed for each order, and the best fit
+			/// is returned. The searches are performed in parallel if
+			/// ThreadCount allows, with the threads divided among them. In
+			/// this case the Observer parameter is not used, and the Stats
+			/// receive statistics of the search that found the returned
+			/// fit. The refitAreas() function uses the first order only.
+			/// Default is SortByWidth.
+		CFitContext* Context; ///< Context that keeps the memory buffers of
+			/// the search between calls, to avoid their reallocation. A
+			/// context should not be used by several calls at once. NULL if
+			/// not used (default).
+		CFitCache* Cache; ///< Cache of the fitAreas() function's results,
+			/// see the CFitCache class. NULL if not used (default).
+		int ClusterSize; ///< If greater than 0, and the fitAreas() function
+			/// is called with more areas than this value, a hierarchical
+			/// search is performed: areas are sorted by height and split
+			/// into clusters of this size, and the clusters are fitted in
+			/// parallel into strips of the maximal output image width and
+			/// the height of their tallest area. The strips are then fitted
+			/// as "super-areas" into the final output images. This bounds
+			/// the depth of each search, and suits areas of a few distinct
+			/// heights, like glyphs of several font sizes, whose clusters
+			/// fill their strips. A single search with the greedy seed is
+			/// also performed, and its fit is returned if its cost is not
+			/// higher: for areas of varied heights the clustered fit is
+			/// usually worse. FitCallsLimit is divided evenly among the
+			/// clusters, the top-level search and the single search; if the
+			/// share of a cluster would be less than ClusterSize, only a
+			/// single search is performed. The top-level search is not
+			/// hierarchical. The Observer parameter is not used in this
+			/// case, and the Stats receive statistics of the returned
+			/// search, with the calls of all searches. Default is 0.
+		int WorkUnits; ///< If greater than 0, the search is deterministic:
+			/// it is divided into this number of work units (limited to the
+			/// number of areas) regardless of ThreadCount. The unit i
+			/// searches the root areas i, i + WorkUnits, i + WorkUnits * 2,
+			/// and so on, using a single thread and an equal share of
+			/// FitCallsLimit, and the threads take the units from a shared
+			/// pool. The best fit among the units is returned: of fits of
+			/// equal size, the fit with fewer output images, and then the
+			/// fit of the lower unit, is chosen. So the result does not
+			/// depend on the number of threads, unless the search is
+			/// stopped by the deadline or the cancel flag. The Observer
+			/// parameter is not used in this case, and the Stats receive
+			/// the summary statistics of the units. Default is 0.
+		int RestartCount; ///< The number of restarts of the search. If
+			/// greater than 0, FitCallsLimit is divided evenly among
+			/// RestartCount + 1 shorter searches: the first one searches
+			/// the areas in the sorted order, and each restart in an order
+			/// perturbed at random, derived from RestartSeed. Each search
+			/// is performed by a single thread, the threads take the
+			/// searches from a shared pool, and the best fit is chosen like
+			/// with WorkUnits (which is not used in this case), so the
+			/// result does not depend on the number of threads. The
+			/// Observer parameter is not used in this case, and the Stats
+			/// receive the summary statistics of the searches. Default is
+			/// 0.
+		unsigned int RestartSeed; ///< Seed of the restarts' perturbations.
+			/// Default is 1.
+		int Padding; ///< Spacing between neighbouring areas in pixels. A
+			/// gutter is shared by the two areas it separates, and is not
+			/// added at output image edges. The fit quality is calculated
+			/// without the spacing. The spacing is the same for all areas:
+			/// internally, areas are extended by Padding and the output
+			/// image limits by Padding minus twice Border, so the search's
+			/// lower bound and the cost it minimizes include the gutters,
+			/// and a fit may be missed that would only exist with
+			/// per-area spacing. Used by the fitAreas() function only.
+			/// Default is 0.
+		int Border; ///< Spacing between areas and output image edges in
+			/// pixels, which should be a multiple of AreaAlign. If Padding
+			/// is not equal to twice Border, output image dimensions are
+			/// rounded via OutImageAlign and DoPow2Size after the search,
+			/// and not during it, and the aMaxOutImageSize limit applies to
+			/// the search's dimensions, which differ from output image
+			/// dimensions by twice Border minus Padding. Used by the
+			/// fitAreas() function only.
+			/// Default is 0.
+		int AreaAlign; ///< Alignment of area offsets in pixels. Area
+			/// dimensions are rounded up to a multiple of this value during
+			/// the search, so that each area occupies whole AreaAlign x
+			/// AreaAlign blocks, and may be, for example, block-compressed
+			/// independently. Default is 1.
+		int OutImageAlign; ///< Granularity of output image dimensions in
+			/// pixels. The search minimizes the summary size of output images
+			/// with dimensions rounded up to a multiple of this value. The
+			/// width and height limits are rounded down to it. Default is 1.
+		bool DoPow2Size; ///< "True" if output image dimensions should be
+			/// rounded up to powers of two, like OutImageAlign (which then
+			/// should be a power of two as well). Default is "false".
+		TSize ImageCost; ///< Cost of each non-empty output image, in
+			/// pixels, for example to account for a draw call per image.
+			/// The search minimizes the summary cost of output images,
+			/// with the cost of an image being its Size plus ImageCost plus
+			/// ImageDimCost multiplied by the larger of its dimensions.
+			/// FitQuality is still calculated from the images' Size. Not
+			/// used by the COnlinePacker and CSmallAreaFitter classes.
+			/// Should not be negative. Default is 0.
+		TSize ImageDimCost; ///< Cost of the larger dimension of each
+			/// non-empty output image, per pixel, see ImageCost. Default is
+			/// 0.
+
+		CFitParams()
+			: ThreadCount( 1 )
+			, HasDeadline( false )
+			, CancelFlag( NULL )
+			, Observer( NULL )
+			, Stats( NULL )
+			, AllowRotation( false )
+			, DoGreedySeed( true )
+			, MinOutImageCountLimit( 0 )
+			, SortOrders( SortByWidth )
+			, Context( NULL )
+			, Cache( NULL )
+			, ClusterSize( 0 )
+			, WorkUnits( 0 )
+			, RestartCount( 0 )
+			, RestartSeed( 1 )
+			, Padding( 0 )
+			, Border( 0 )
+			, AreaAlign( 1 )
+			, OutImageAlign( 1 )
+			, DoPow2Size( false )
+			, ImageCost( 0 )
+			, ImageDimCost( 0 )
+		{
+		}
+
+		/**
+		 * Function sets search deadline relative to the current time.
+		 *
+		 * @param Seconds Search time limit, in seconds.
+		 */
+
+		void setTimeLimit( const double Seconds )
+		{
+			HasDeadline = true;
+			Deadline = std :: chrono :: steady_clock :: now() +
+				std :: chrono :: duration_cast<
+				std :: chrono :: steady_clock :: duration >(
+				std :: chrono :: duration< double >( Seconds ));
+		}
+	};
+
+	/**
+	 * Structure holds an independent area fit job of a batch, see the
+	 * fitAreaSets() function. The members correspond to the parameters of
+	 * the fitAreas() function.
+	 */
+
+	struct CFitJob
+	{
+		CArray< CFitArea > AreasToFit; ///< List of areas to be fitted. If
+			/// the Success variable is "true", this array receives best
+			/// fit's areas.
+		CArray< COutImage > OutImages; ///< Initial array of output images,
+			/// receives best fit's output images.
+		int MaxOutImageWidth; ///< Maximal output image's width in pixels.
+		int MaxOutImageHeight; ///< Maximal output image's height in pixels.
+		TSize MaxOutImageSize; ///< Absolute maximum limit imposed on
+			/// output image size in pixels. Default is the maximal TSize
+			/// value.
+		int MinOutImageCount; ///< Starting number of output images. Default
+			/// is 1.
+		int FitCallsLimit; ///< Do not perform more than this number of
+			/// fitArea() function calls/recursions.
+		double FitQuality; ///< Receives fit's quality in percent.
+		bool Success; ///< Receives "true" if a fit was found.
+		CFitStats Stats; ///< Receives statistics of the search.
+		int SortOrders; ///< Sort orders of the areas, see CFitParams ::
+			/// SortOrders. If 0, the orders of the batch's parameters are
+			/// used (default).
+
+		CFitJob()
+			: MaxOutImageWidth( 0 )
+			, MaxOutImageHeight( 0 )
+			, MaxOutImageSize( std :: numeric_limits< TSize > :: max() )
+			, MinOutImageCount( 1 )
+			, FitCallsLimit( 0 )
+			, FitQuality( 0.0 )
+			, Success( false )
+			, SortOrders( 0 )
+		{
+		}
+	};
+
+	/**
+	 * Array of jobs allocated via the "new" operator, which are deleted
+	 * with the array. The pointers are kept in a CArray, since the CInitArray
+	 * class relocates its items via memcpy().
+	 */
+
+	class CFitJobs : public CArray< CFitJob* >
+	{
+	public:
+		CFitJobs()
+		{
+		}
+
+		~CFitJobs()
+		{
+			int i;
+
+			for( i = 0; i < getItemCount(); i++ )
+			{
+				delete ( *this )[ i ];
+			}
+		}
+
+	private:
+		CFitJobs( const CFitJobs& );
+		CFitJobs& operator = ( const CFitJobs& );
 	};
 
 	/**
@@ -1068,10 +1565,11 @@ public:
 	 * in average due to an increased amount of output area fit tests.
 	 * @param MinOutImageCount Starting number of output images. This value
 	 * can be increased if a previous call to this function yielded no fit
-	 * (function returned "false"). Suggested starting value is 1. If this
-	 * value is larger than 1, or if some of the fit areas have zero width or
-	 * height, some output images may be unused with the width and height
-	 * equal to 0.
+	 * (function returned "false"), or several values can be tried in a
+	 * single call via the CFitParams :: MinOutImageCountLimit parameter.
+	 * Suggested starting value is 1. If this value is larger than 1, or if
+	 * some of the fit areas have zero width or height, some output images
+	 * may be unused with the width and height equal to 0.
 	 * @param FitCallsLimit Do not perform more than this number of fitArea()
 	 * function calls/recursions. Setting a high value increases probability
 	 * of finding a best area fit, but also increases overall function
@@ -1080,14 +1578,25 @@ public:
 	 * fitArea() function calls/recursions among all threads.
 	 * @param FitQuality Fit's quality in percent. This value is only valid if
 	 * this function returned "true".
+	 * @param Params Additional search parameters. If the search is stopped
+	 * due to the deadline, the cancel flag or by the observer, the best fit
+	 * found so far is returned. Function returns "false" if no fit was
+	 * found until then.
 	 */
 
 	static bool fitAreas( CArray< CFitArea >& AreasToFit,
 		CArray< COutImage >& OutImages, const int aMaxOutImageWidth,
-		const int aMaxOutImageHeight, int aMaxOutImageSize,
+		const int aMaxOutImageHeight, const TSize aMaxOutImageSize,
 		const int MinOutImageCount, const int FitCallsLimit,
-		double& FitQuality )
+		double& FitQuality, const CFitParams& Params )
 	{
+		if( Params.Padding > 0 || Params.Border > 0 )
+		{
+			return( fitAreasPadded( AreasToFit, OutImages, aMaxOutImageWidth,
+				aMaxOutImageHeight, aMaxOutImageSize, MinOutImageCount,
+				FitCallsLimit, FitQuality, Params ));
+		}
+
 		if( AreasToFit.getItemCount() < 2 )
 		{
 			if( AreasToFit.getItemCount() == 1 )
@@ -1095,11 +1604,18 @@ public:
 				AreasToFit[ 0 ].OutImage = 0;
 				AreasToFit[ 0 ].OutX = 0;
 				AreasToFit[ 0 ].OutY = 0;
+				AreasToFit[ 0 ].OutRotated = false;
 
 				OutImages.setItemCount( 1 );
-				OutImages[ 0 ].Width = AreasToFit[ 0 ].Width;
-				OutImages[ 0 ].Height = AreasToFit[ 0 ].Height;
-				OutImages[ 0 ].Size = OutImages[ 0 ].Width *
+				OutImages[ 0 ].Width = alignDim( alignDim(
+					AreasToFit[ 0 ].Width, Params.AreaAlign, false ),
+					Params.OutImageAlign, Params.DoPow2Size );
+
+				OutImages[ 0 ].Height = alignDim( alignDim(
+					AreasToFit[ 0 ].Height, Params.AreaAlign, false ),
+					Params.OutImageAlign, Params.DoPow2Size );
+
+				OutImages[ 0 ].Size = (TSize) OutImages[ 0 ].Width *
 					OutImages[ 0 ].Height;
 			}
 			else
@@ -1107,117 +1623,277 @@ public:
 				OutImages.clear();
 			}
 
+			if( Params.Stats != NULL )
+			{
+				*Params.Stats = CFitStats();
+			}
+
 			FitQuality = 100.0;
 			return( true );
 		}
 
-		qsort( &AreasToFit[ 0 ], AreasToFit.getItemCount(),
-			sizeof( AreasToFit[ 0 ]), FitAreasInSortFn );
+		if( Params.Cache != NULL )
+		{
+			return( fitAreasCached( AreasToFit, OutImages, aMaxOutImageWidth,
+				aMaxOutImageHeight, aMaxOutImageSize, MinOutImageCount,
+				FitCallsLimit, FitQuality, Params ));
+		}
 
-		CGlobals aGlobals;
-		aGlobals.FitCallsLimit = FitCallsLimit;
-		aGlobals.FitCallsLeft = FitCallsLimit;
-		aGlobals.BestOutSize = 0x7FFFFFFF;
-		aGlobals.BestOutImageCount = 0x7FFFFFFF;
+		if( Params.ClusterSize > 0 &&
+			AreasToFit.getItemCount() > Params.ClusterSize )
+		{
+			return( fitAreasClustered( AreasToFit, OutImages,
+				aMaxOutImageWidth, aMaxOutImageHeight, aMaxOutImageSize,
+				MinOutImageCount, FitCallsLimit, FitQuality, Params ));
+		}
+
+		if(( Params.SortOrders & ( Params.SortOrders - 1 )) != 0 )
+		{
+			return( fitAreasMultiOrder( AreasToFit, OutImages,
+				aMaxOutImageWidth, aMaxOutImageHeight, aMaxOutImageSize,
+				MinOutImageCount, FitCallsLimit, FitQuality, Params ));
+		}
+
+		sortFitAreas( AreasToFit, Params.Context,
+			CFitAreaInLess( Params.SortOrders, Params.AllowRotation ));
+
+		if( Params.RestartCount > 0 )
+		{
+			return( searchFitRestarts( AreasToFit, OutImages,
+				aMaxOutImageWidth, aMaxOutImageHeight, aMaxOutImageSize,
+				MinOutImageCount, FitCallsLimit, FitQuality, Params ));
+		}
 
-		#if defined( VOX_AREAFITTER_TEST )
+		if( Params.WorkUnits > 0 )
+		{
+			return( searchFitUnits( AreasToFit, OutImages, aMaxOutImageWidth,
+				aMaxOutImageHeight, aMaxOutImageSize, MinOutImageCount,
+				FitCallsLimit, FitQuality, Params ));
+		}
 
-			BestFitCallCount = 0;
-			BestFitImgCount = 0;
-			BestFitCount = 0;
+		if( searchFit( AreasToFit, OutImages, aMaxOutImageWidth,
+			aMaxOutImageHeight, aMaxOutImageSize, MinOutImageCount,
+			FitCallsLimit, FitQuality, Params, NULL ))
+		{
+			return( true );
+		}
 
-		#endif // VOX_AREAFITTER_TEST
+		OutImages.clear();
+		return( false );
+	}
 
-		CFitData FitData;
-		FitData.UnfittedAreas.alloc( AreasToFit.getItemCount() + 1 );
-		FitData.FittedAreas.alloc( AreasToFit.getItemCount() );
+	/**
+	 * Function that fits all available areas into the specified (or greater)
+	 * number of output images, using the specified number of threads. See
+	 * the fitAreas() function above for the parameters' description.
+	 *
+	 * @param ThreadCount The number of threads to perform the search with,
+	 * see CFitParams :: ThreadCount.
+	 */
 
-		int MinOutSize = 0; // Minimal possible OutSize - achieved either in
-			// optimal packing or when all fit areas were placed in separate
-			// output images.
+	static bool fitAreas( CArray< CFitArea >& AreasToFit,
+		CArray< COutImage >& OutImages, const int aMaxOutImageWidth,
+		const int aMaxOutImageHeight, const TSize aMaxOutImageSize,
+		const int MinOutImageCount, const int FitCallsLimit,
+		double& FitQuality, const int ThreadCount = 1 )
+	{
+		CFitParams Params;
+		Params.ThreadCount = ThreadCount;
+
+		return( fitAreas( AreasToFit, OutImages, aMaxOutImageWidth,
+			aMaxOutImageHeight, aMaxOutImageSize, MinOutImageCount,
+			FitCallsLimit, FitQuality, Params ));
+	}
+
+	/**
+	 * Function that fits new areas into an existing layout, without moving
+	 * the areas already placed. Only the new areas are searched for, in the
+	 * free space around the fixed areas, and in new output images if
+	 * needed, which is fast if the new areas are few. Function returns
+	 * "true" if a fit was found. The layout quality may degrade with each
+	 * refit: to re-optimize the layout, all areas should be passed to the
+	 * fitAreas() function instead.
+	 *
+	 * Areas can be removed from the layout by omitting them from the fixed
+	 * areas. The output images then shrink to the bounding boxes of their
+	 * remaining areas, with the freed space available to the new areas.
+	 *
+	 * @param FixedAreas Areas already placed, with valid OutImage, OutX,
+	 * OutY and OutRotated values, which are not changed. The areas should
+	 * not overlap.
+	 * @param AreasToFit List of new areas to be fitted. If this function
+	 * returned "true", this array receives best fit's areas.
+	 * @param OutImages Output images of the existing layout. If this
+	 * function returned "true", this array receives best fit's output
+	 * images: the existing images keep their indices, and may be enlarged
+	 * within the width and height limits. Otherwise this array is not
+	 * changed.
+	 * @param aMaxOutImageWidth Maximal output image's width in pixels.
+	 * Existing output images are not shrunk to this width.
+	 * @param aMaxOutImageHeight Maximal output image's height in pixels.
+	 * Existing output images are not shrunk to this height.
+	 * @param aMaxOutImageSize Absolute maximum limit imposed on output image
+	 * size in pixels.
+	 * @param FitCallsLimit Do not perform more than this number of fitArea()
+	 * function calls/recursions.
+	 * @param FitQuality Quality of the whole layout in percent. This value
+	 * is only valid if this function returned "true".
+	 * @param Params Additional search parameters. The DoGreedySeed
+	 * parameter is not used.
+	 */
 
+	static bool refitAreas( const CArray< CFitArea >& FixedAreas,
+		CArray< CFitArea >& AreasToFit, CArray< COutImage >& OutImages,
+		const int aMaxOutImageWidth, const int aMaxOutImageHeight,
+		const TSize aMaxOutImageSize, const int FitCallsLimit,
+		double& FitQuality, const CFitParams& Params )
+	{
+		int ImageCount = OutImages.getItemCount();
 		int i;
 
-		for( i = 0; i < AreasToFit.getItemCount(); i++ )
+		for( i = 0; i < FixedAreas.getItemCount(); i++ )
 		{
-			const int AreaSize =
-				AreasToFit[ i ].Width * AreasToFit[ i ].Height;
-
-			if( aMaxOutImageSize < AreaSize )
+			if( FixedAreas[ i ].OutImage >= ImageCount )
 			{
-				aMaxOutImageSize = AreaSize;
+				ImageCount = FixedAreas[ i ].OutImage + 1;
 			}
-
-			MinOutSize += AreaSize;
 		}
 
-		// Prepare the first FitData object.
-
-		FitData.OutSize = 0;
-		FitData.BestOutSize = 0x7FFFFFFE;
-		FitData.BestOutImageCount = 0x7FFFFFFF;
-		FitData.OutImageCount = MinOutImageCount;
-		FitData.OutImages.alloc( FitData.OutImageCount );
+		CBaseLayout Base;
+		Base.OutImages.setItemCount( ImageCount );
+		Base.FixedSize = 0;
 
-		for( i = 0; i < FitData.OutImageCount; i++ )
+		for( i = 0; i < ImageCount; i++ )
 		{
-			FitData.OutImages[ i ].Width = 0;
-			FitData.OutImages[ i ].Height = 0;
-			FitData.OutImages[ i ].Size = 0;
+			Base.OutImages[ i ].Width = 0;
+			Base.OutImages[ i ].Height = 0;
 		}
 
-		FitData.BaseOutAreas.alloc( FitData.OutImageCount + 1 );
-		FitData.OutAreas = &FitData.BaseOutAreas[ 0 ];
-		COutArea* PrevOutArea = FitData.OutAreas;
-
-		for( i = 0; i < FitData.OutImageCount; i++ )
+		for( i = 0; i < FixedAreas.getItemCount(); i++ )
 		{
-			COutArea& OutArea = FitData.BaseOutAreas[ i + 1 ];
-			PrevOutArea -> Next = &OutArea;
-			PrevOutArea = &OutArea;
+			const CFitArea& fa = FixedAreas[ i ];
+			COutImage& OutImage = Base.OutImages[ fa.OutImage ];
+			const int r = alignDim( fa.OutX +
+				( fa.OutRotated ? fa.Height : fa.Width ), Params.AreaAlign,
+				false );
 
-			OutArea.OutImage = i;
-			OutArea.x = 0;
-			OutArea.y = 0;
-			OutArea.Width = ( FitData.OutImages[ i ].Width == 0 ?
-				aMaxOutImageWidth : FitData.OutImages[ i ].Width );
+			const int b = alignDim( fa.OutY +
+				( fa.OutRotated ? fa.Width : fa.Height ), Params.AreaAlign,
+				false );
 
-			OutArea.Height = ( FitData.OutImages[ i ].Height == 0 ?
-				aMaxOutImageHeight : FitData.OutImages[ i ].Height );
+			if( r > OutImage.Width )
+			{
+				OutImage.Width = r;
+			}
+
+			if( b > OutImage.Height )
+			{
+				OutImage.Height = b;
+			}
+
+			Base.FixedSize += (TSize) fa.Width * fa.Height;
 		}
 
-		PrevOutArea -> Next = NULL;
+		TSize OutSize = 0;
+		const int MaxWidth = alignDimDown( aMaxOutImageWidth,
+			Params.OutImageAlign, Params.DoPow2Size );
 
-		CInitArray< CPtrKeeper< CAreaFitter* > > AreaFitters; // A single
-			// fitter object is created for every fit area which will become
-			// the "root area" for the fitter.
+		const int MaxHeight = alignDimDown( aMaxOutImageHeight,
+			Params.OutImageAlign, Params.DoPow2Size );
 
-		for( i = 0; i < 1; i++ )
+		for( i = 0; i < ImageCount; i++ )
 		{
-			AreaFitters.add() = new CAreaFitter( aMaxOutImageWidth,
-				aMaxOutImageHeight, aMaxOutImageSize, &aGlobals, AreasToFit );
-		}
+			COutImage& OutImage = Base.OutImages[ i ];
+
+			if( OutImage.Width > 0 && OutImage.Height > 0 )
+			{
+				OutImage.Width = alignDim( OutImage.Width,
+					Params.OutImageAlign, Params.DoPow2Size );
 
-		AreaFitters[ 0 ] -> fd = &FitData;
-		AreaFitters[ 0 ] -> pushStack();
-		AreaFitters[ 0 ] -> fitUnfittedAreas();
+				OutImage.Height = alignDim( OutImage.Height,
+					Params.OutImageAlign, Params.DoPow2Size );
+			}
+
+			OutImage.Size = (TSize) OutImage.Width * OutImage.Height;
+			OutSize += OutImage.Size;
+
+			addFreeAreas( Base.OutAreas, i,
+				( OutImage.Width > MaxWidth ? OutImage.Width : MaxWidth ),
+				( OutImage.Height > MaxHeight ? OutImage.Height : MaxHeight ),
+				FixedAreas,
+				Params.AreaAlign );
+		}
 
-		if( aGlobals.BestOutSize != 0x7FFFFFFF )
+		if( AreasToFit.getItemCount() == 0 )
 		{
-			AreasToFit = aGlobals.BestFittedAreas;
-			qsort( &AreasToFit[ 0 ], AreasToFit.getItemCount(),
-				sizeof( AreasToFit[ 0 ]), FitAreasOutSortFn );
+			OutImages = Base.OutImages;
+
+			if( Params.Stats != NULL )
+			{
+				*Params.Stats = CFitStats();
+			}
+
+			FitQuality = ( OutSize == 0 ? 100.0 :
+				100.0 * Base.FixedSize / OutSize );
 
-			OutImages = aGlobals.BestOutImages;
-			FitQuality = 100.0 * MinOutSize / aGlobals.BestOutSize;
 			return( true );
 		}
 
-		OutImages.clear();
-		return( false );
+		sortFitAreas( AreasToFit, Params.Context,
+			CFitAreaInLess( Params.SortOrders & -Params.SortOrders,
+			Params.AllowRotation ));
+
+		return( searchFit( AreasToFit, OutImages, aMaxOutImageWidth,
+			aMaxOutImageHeight, aMaxOutImageSize, ImageCount, FitCallsLimit,
+			FitQuality, Params, &Base ));
+	}
+
+	/**
+	 * Function that fits many independent sets of areas. Jobs are taken in
+	 * order by a pool of threads, and each job is searched by a single
+	 * thread: this is more efficient than a multi-threaded search of each
+	 * job if the jobs are small. Each thread reuses its fitter object's
+	 * buffers between jobs. Results are stored in the jobs themselves. If
+	 * Params.Context is not NULL, the threads and their fitter objects are
+	 * kept in the context, and are reused by the following calls with the
+	 * same context. Otherwise, they are created by each call of this
+	 * function, and are released before it returns.
+	 *
+	 * @param Jobs Jobs to perform. The jobs are allocated via the "new"
+	 * operator, and are deleted with the array.
+	 * @param Params Additional search parameters. The ThreadCount parameter
+	 * specifies the number of threads in the pool, it is limited to the
+	 * number of jobs. The deadline and the cancel flag apply to all jobs:
+	 * jobs not started before the search was stopped find no fit. The
+	 * Context parameter keeps the pool of threads. The Observer and Stats
+	 * parameters are not used.
+	 */
+
+	static void fitAreaSets( CFitJobs& Jobs, const CFitParams& Params )
+	{
+		CFitParams JobParams = Params;
+		JobParams.ThreadCount = 1;
+		JobParams.Observer = NULL;
+
+		runBatch( Jobs, JobParams, getThreadCount( Params ));
 	}
 
 private:
+	/**
+	 * Fitted area parameters. These parameters are later transferred to the
+	 * CFitArea structures, when the search finishes. These parameters are
+	 * not defined for unfitted areas.
+	 */
+
+	struct CFittedArea
+	{
+		int OutImage; ///< Output image index.
+		int OutX; ///< X offset of this area within the output image.
+		int OutY; ///< Y offset of this area within the output image.
+		bool IsRotated; ///< "True" if the area was placed rotated relative
+			/// to its orientation in the CUnfittedArea structure.
+	};
+
 	/**
 	 * Structure holds global information about area fit search shared among
 	 * all threads.
@@ -1225,774 +1901,6064 @@ private:
 
 	struct CGlobals
 	{
-		//CSyncSpinLock StateSync; ///< Synchronizer object used to synchronize
-			/// best area search between threads.
+		CSyncSpinLock StateSync; ///< Synchronizer object used to synchronize
+			/// best area fit saving between threads.
 		int FitCallsLimit; ///< Initial value of the FitCallsLeft variable.
-		volatile int FitCallsLeft; ///< The number of fitArea()
+		std :: atomic< int > FitCallsLeft; ///< The number of fitArea()
 			/// calls/recursions left shared among all threads.
-		volatile int BestOutSize; ///< Best summary output image size found so
-			/// far among all threads.
-		volatile int BestOutImageCount; ///< Best summary number of output
-			/// images found so far among all threads.
-		CArray< CFitArea > BestFittedAreas; ///< List of global best fitted
-			/// areas. Valid only if the BestOutSize variable was redefined
-			/// from its default value.
-		CArray< COutImage > BestOutImages; ///< List of global best output
-			/// images. Valid only if the BestOutSize variable is redefined
-			/// from its default value.
+		std :: atomic< TSize > BestOutSize; ///< Best summary output image
+			/// size found so far among all threads.
+		std :: atomic< int > BestOutImageCount; ///< Best summary number of
+			/// output images found so far among all threads.
+		std :: atomic< int > NextRootArea; ///< Index of the next root area
+			/// (area fitted first) yet to be taken by a thread.
+		int RootAreaStep; ///< Increment of the root area index, greater
+			/// than 1 in a work unit of the deterministic search.
+		std :: atomic< int > ActiveFitters; ///< The number of fitters
+			/// currently processing a work item. Idle fitters stop the search
+			/// when this number reaches 0 and no work is left to steal.
+		bool HasDeadline; ///< "True" if the Deadline variable should be used.
+		std :: chrono :: steady_clock :: time_point Deadline; ///< Search
+			/// deadline.
+		const std :: atomic< bool >* CancelFlag; ///< Search cancel flag, NULL
+			/// if not used.
+		std :: atomic< bool > IsStopped; ///< "True" if the search was stopped
+			/// due to the deadline, the cancel flag or by the observer.
+		CFitObserver* Observer; ///< Best fit observer, NULL if not used.
+		bool AllowRotation; ///< "True" if areas may be rotated.
+		int AreaAlign; ///< Alignment of area offsets.
+		int OutImageAlign; ///< Granularity of output image dimensions.
+		bool DoPow2Size; ///< "True" if output image dimensions are powers
+			/// of two.
+		TSize ImageCost; ///< Cost of each non-empty output image.
+		TSize ImageDimCost; ///< Cost of the larger output image dimension.
+		std :: chrono :: steady_clock :: time_point StartTime; ///< Time the
+			/// search was started at.
+		CFitStats Stats; ///< Best fit improvement statistics. Other
+			/// statistics are collected by each fitter separately.
+		TSize MinOutSize; ///< Summary size of all areas, used to calculate
+			/// fit quality.
+		CAreaFitter** Fitters; ///< Pointers to all fitters participating in
+			/// the search.
+		int FitterCount; ///< The number of items in the Fitters array.
+		CBuffer< CFittedArea > BestFittedAreas; ///< Placements of global best
+			/// fitted areas, in the order of sorted areas. Valid only if the
+			/// BestOutSize variable was redefined from its default value.
+		CBuffer< COutImage > BestOutImages; ///< Global best output images,
+			/// BestFitOutImageCount items. Valid only if the BestOutSize
+			/// variable was redefined from its default value.
+		int BestFitOutImageCount; ///< The number of output images in the
+			/// global best fit. Unlike BestOutImageCount, this value is not
+			/// reset when the search is repeated with more output images.
+		CArray< CFitArea > ObserverAreas; ///< Sorted areas that receive
+			/// placements of each new best fit before passing them to the
+			/// Observer. Not used if Observer is NULL.
+		CArray< COutImage > ObserverOutImages; ///< Output images passed to
+			/// the Observer.
 	};
 
 	/**
-	 * A constructor.
+	 * Function transfers the global best fit to the specified arrays.
 	 *
-	 * @param aMaxOutImageWidth Maximal output image's width in pixels.
-	 * @param aMaxOutImageHeight Maximal output image's height in pixels.
-	 * @param aMaxOutImageSize Absolute maximum limit imposed on output image
-	 * size in pixels.
-	 * @param aGlobals Pointer to structure containing global, shared among
-	 * all threads, search state information.
-	 * @param SortedAreas Areas to be fitted, in a sorted order.
+	 * @param g Global search state with a valid best fit.
+	 * @param SortedAreas Sorted areas (as passed to fitters) that receive
+	 * placements of the best fit.
+	 * @param OutImages Receives best fit's output images.
 	 */
 
-	CAreaFitter( const int aMaxOutImageWidth, const int aMaxOutImageHeight,
-		const int aMaxOutImageSize, CGlobals* const aGlobals,
-		const CArray< CFitArea >& SortedAreas )
-		: MaxOutImageWidth( aMaxOutImageWidth )
-		, MaxOutImageHeight( aMaxOutImageHeight )
-		, MaxOutImageSize( aMaxOutImageSize )
-		, Globals( aGlobals )
-		, FitCallsLeft( 0 )
-		, Areas( SortedAreas )
-		, Stack( SortedAreas.getItemCount() )
-		, Depth( -1 )
-	{
-		UnfittedAreas = &InitArea;
-		CFitArea* PrevImgArea = UnfittedAreas;
+	static void getBestFit( const CGlobals& g,
+		CArray< CFitArea >& SortedAreas, CArray< COutImage >& OutImages )
+	{
 		int i;
 
-		for( i = 0; i < Areas.getItemCount(); i++ )
+		for( i = 0; i < SortedAreas.getItemCount(); i++ )
 		{
-			PrevImgArea -> Next = &Areas[ i ];
-			PrevImgArea = &Areas[ i ];
+			CFitArea& Area = SortedAreas[ i ];
+			const CFittedArea& fa = g.BestFittedAreas[ i ];
+			Area.OutImage = fa.OutImage;
+			Area.OutX = fa.OutX;
+			Area.OutY = fa.OutY;
+
+			// Fitters keep rotatable areas in the landscape orientation.
+
+			Area.OutRotated = ( g.AllowRotation && Area.MayRotate &&
+				Area.Width < Area.Height ? !fa.IsRotated : fa.IsRotated );
 		}
 
-		PrevImgArea -> Next = NULL;
+		const int ImageCount = g.BestFitOutImageCount;
+		OutImages.setItemCount( ImageCount );
+
+		for( i = 0; i < ImageCount; i++ )
+		{
+			OutImages[ i ] = g.BestOutImages[ i ];
+		}
 	}
 
 	/**
-	 * Fitted area parameters. These parameters are later transferred to the
-	 * CFitArea structures, the moment the last area was fitted. These
-	 * parameters are not defined for unfitted areas.
+	 * @return Summary size of the global best fit's output images. Unlike
+	 * BestOutSize, does not include the image cost terms.
+	 *
+	 * @param g Global search state with a valid best fit.
 	 */
 
-	struct CFittedArea
+	static TSize getBestFitSize( const CGlobals& g )
 	{
-		uint16_t OutImage; ///< Output image index.
-		uint16_t OutX; ///< X offset of this area within the output image.
-		uint16_t OutY; ///< Y offset of this area within the output image.
-	};
+		TSize OutSize = 0;
+		int i;
+
+		for( i = 0; i < g.BestFitOutImageCount; i++ )
+		{
+			OutSize += g.BestOutImages[ i ].Size;
+		}
+
+		return( OutSize );
+	}
+
+	/**
+	 * @return Quality of the global best fit, in percent.
+	 *
+	 * @param g Global search state with a valid best fit.
+	 */
+
+	static double getBestFitQuality( const CGlobals& g )
+	{
+		return( 100.0 * g.MinOutSize / getBestFitSize( g ));
+	}
+
+	/**
+	 * A constructor.
+	 *
+	 * @param aMaxOutImageWidth Maximal output image's width in pixels.
+	 * @param aMaxOutImageHeight Maximal output image's height in pixels.
+	 * @param aMaxOutImageSize Absolute maximum limit imposed on output image
+	 * size in pixels.
+	 * @param aGlobals Pointer to structure containing global, shared among
+	 * all threads, search state information.
+	 * @param SortedAreas Areas to be fitted, in a sorted order.
+	 */
+
+	CAreaFitter( const int aMaxOutImageWidth, const int aMaxOutImageHeight,
+		const TSize aMaxOutImageSize, CGlobals* const aGlobals,
+		const CArray< CFitArea >& SortedAreas )
+	{
+		fd = &FitData;
+		init( aMaxOutImageWidth, aMaxOutImageHeight, aMaxOutImageSize,
+			aGlobals, SortedAreas );
+	}
+
+	/**
+	 * A constructor that creates a fitter that should be prepared for the
+	 * search via the init() function.
+	 */
+
+	CAreaFitter()
+		: AreaCount( 0 )
+	{
+		fd = &FitData;
+	}
+
+	/**
+	 * Function prepares *this fitter for a new search. Buffers allocated by
+	 * a previous search are reused if they are large enough. See the
+	 * constructor for the parameters' description.
+	 */
+
+	void init( const int aMaxOutImageWidth, const int aMaxOutImageHeight,
+		const TSize aMaxOutImageSize, CGlobals* const aGlobals,
+		const CArray< CFitArea >& SortedAreas )
+	{
+		MaxOutImageWidth = aMaxOutImageWidth;
+		MaxOutImageHeight = aMaxOutImageHeight;
+		MaxOutImageSize = aMaxOutImageSize;
+		MinOutSize = aGlobals -> MinOutSize;
+		OutImageAlign = aGlobals -> OutImageAlign;
+		DoPow2Size = aGlobals -> DoPow2Size;
+		ImageCost = aGlobals -> ImageCost;
+		ImageDimCost = aGlobals -> ImageDimCost;
+		Globals = aGlobals;
+		FitCallsLeft = 0;
+		Stats = CFitStats();
+		AreaCount = SortedAreas.getItemCount();
+		LastStamp = 0;
+		Depth = -1;
+		BaseDepth = 0;
+		IsBranchWork = false;
+		StealDepth = ( Globals -> FitterCount > 1 ? MaxStealDepth : 0 );
+
+		if( Stack.getCapacity() < AreaCount )
+		{
+			Stack.alloc( AreaCount );
+			ClassStamps.alloc( AreaCount );
+			FitData.UnfittedAreas.alloc( AreaCount + 1 );
+			FitData.FittedAreas.alloc( AreaCount );
+			FitData.MinWidthCounts.alloc( AreaCount );
+			FitData.MinHeightCounts.alloc( AreaCount );
+			MinWidthValues.alloc( AreaCount );
+			MinHeightValues.alloc( AreaCount );
+		}
+
+		int i;
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			const CFitArea& fa = SortedAreas[ i ];
+			CUnfittedArea& ua = FitData.UnfittedAreas[ i ];
+			const int w = alignDim( fa.Width, Globals -> AreaAlign, false );
+			const int h = alignDim( fa.Height, Globals -> AreaAlign, false );
+			ua.CanRotate = ( Globals -> AllowRotation && fa.MayRotate &&
+				w != h );
+
+			// Rotatable areas are kept in the landscape orientation, so
+			// that areas equal up to rotation have equal dimensions.
+
+			if( ua.CanRotate && w < h )
+			{
+				ua.Width = h;
+				ua.Height = w;
+			}
+			else
+			{
+				ua.Width = w;
+				ua.Height = h;
+			}
+
+			MinOutSize += (TSize) w * h - (TSize) fa.Width * fa.Height;
+
+			ua.IsRotated = false;
+		}
+
+		initSizeClasses();
+		initMinSizeRanks( MinWidthValues, true );
+		initMinSizeRanks( MinHeightValues, false );
+
+		for( i = 0; i <= MaxStealDepth; i++ )
+		{
+			WorkSlots[ i ].IsActive = false;
+			WorkSlots[ i ].NextCandidate = 0;
+			WorkSlots[ i ].CandidateCount = 0;
+			WorkSlots[ i ].IsBranchFree = false;
+		}
+	}
 
 	/**
-	 * Structure that holds index of an area not yet fitted.
+	 * Structure holds an unfitted area's dimensions and a link to the next
+	 * unfitted area.
 	 */
 
 	struct CUnfittedArea
 	{
-		int Index; ///< Area index in the original AreasToFit array.
-		int Next; ///< Next unfitted area. -1 if *this item is the last item
-			/// in the list.
+		int Width; ///< Width of the area.
+		int Height; ///< Height of the area.
+		int Next; ///< Index of the next unfitted area in a list, -1 if this
+			/// area is the last item in the list.
+		int MinWidthRank; ///< Position of the minimal width the area can be
+			/// placed with, in any orientation, among distinct minimal widths
+			/// of all areas in ascending order.
+		int MinHeightRank; ///< Position of the minimal height the area can
+			/// be placed with among distinct minimal heights of all areas.
+		int SizeClass; ///< Index of the first area with the same dimensions
+			/// and rotatability. Such areas are interchangeable, so only the
+			/// first of them is tried at each stack level.
+		bool CanRotate; ///< "True" if the area can be rotated.
+		bool IsRotated; ///< "True" if Width and Height are currently swapped
+			/// relative to the area's initial orientation.
 	};
 
 	/**
-	 * Structure that holds information about an available area within one of
-	 * the output images.
+	 * Structure holds details about an available output image area.
 	 */
 
 	struct COutArea
 	{
 		int OutImage; ///< Output image index.
-		int x; ///< X position of the output area within the output image.
-		int y; ///< Y position of the output area within the output image.
-		int Width; ///< Width of the output area.
-		int Height; ///< Height of the output area.
-		COutArea* Next; ///< Next area in a chain.
+		int x; ///< X position of the area within the output image.
+		int y; ///< Y position of the area within the output image.
+		int Width; ///< Width of the area.
+		int Height; ///< Height of the area.
 	};
 
 	/**
-	 * This structure holds the current state of the area fitting process.
-	 * Note that this structure may also hold a copy of the fitting process
-	 * state of a parallel thread.
+	 * Function returns the number of threads specified by the search
+	 * parameters, with 0 replaced by the number of hardware threads.
+	 *
+	 * @param Params Search parameters.
 	 */
 
-	struct CFitData
+	static int getThreadCount( const CFitParams& Params )
 	{
-		CBuffer< CUnfittedArea > UnfittedAreas; ///< A buffer containing items
-			/// of the unfitted areas list + 1 "initial" item.
-		int FirstUnfittedArea; ///< The first unfitted area. -1 if no unfitted
-			/// areas are left.
-		CBuffer< CFittedArea > FittedAreas; ///< Parameters of all fitted
-			/// areas. The indices of elements of this buffer correspond to
-			/// the indices of areas in the original AreasToFit list. The
-			/// number of elements is also equal to that of the AreasToFit
-			/// list.
-		COutArea* OutAreas; ///< List of available output areas on the current
-			/// fitting step. Output areas are stored in the BaseOutAreas
-			/// buffer and temporarily on stack.
-		CBuffer< COutArea > BaseOutAreas; ///< Array of output image areas at
-			/// the very start of the fitting process. The very first area is
-			/// the "initial" output area, always present in the OutAreas list
-			/// as the first item. Variable values in this area structure
-			/// except Next have no meaning.
-		CBuffer< COutImage > OutImages; ///< Details of the output images
-			/// created so far, including initially-provided output images.
-		int OutImageCount; ///< The number of output images in the OutImages
-			/// buffer.
-		int OutSize; ///< Summary size of all output images so far.
-		int BestOutSize; ///< Best summary output image size found so far.
-			/// May be equal to the global best size found by another thread.
-		int BestOutImageCount; ///< Number of output images in the best fit.
-			/// May be equal to the global best image count found by another
-			/// thread.
-	};
+		if( Params.ThreadCount > 0 )
+		{
+			return( Params.ThreadCount );
+		}
 
-	int MaxOutImageWidth; ///< Maximal output image's width in pixels.
-	int MaxOutImageHeight; ///< Maximal output image's height in pixels.
-	int MaxOutImageSize; ///< Absolute maximum limit imposed on output image
-		/// size in pixels.
-	CGlobals* Globals; ///< Pointer to global area fit search state shared
-		/// among all threads.
-	int FitCallsLeft; ///< The number of fitArea() function calls/recursions
-		/// left before the next slice of calls can be taken from the
-		/// Globals -> FitCallsLeft.
+		const int c = (int) std :: thread :: hardware_concurrency();
 
-	CFitArea* UnfittedAreas; ///< List of areas not yet fitted, points to
-		/// areas in the Areas array.
-	CFitArea InitArea; ///< The "initial" area, always present in the
-		/// UnfittedAreas list as the first item. Variable values in this area
-		/// structure except Next have no meaning.
-	CArray< CFitArea > Areas; ///< All areas to be fitted into the output
-		/// image(s).
-	CFitData* fd; ///< The current state of the area fitting process.
+		return( c > 0 ? c : 1 );
+	}
 
 	/**
-	 * Structure that holds details about the fitUnfittedAreas() function call
-	 * step, similarly to how a recursive stack would be organized. This
-	 * structre is used to "linearize" the fitUnfittedAreas() function so that
-	 * it does not depend on the stack storage.
+	 * Function that performs jobs of a batch until no untaken jobs are
+	 * left, run by each thread of a batch pool.
+	 *
+	 * @param Jobs Jobs of the batch.
+	 * @param NextJob Index of the next job yet to be taken by a thread.
+	 * @param Params Search parameters of all jobs.
+	 * @param Context Context of the thread, reused between jobs.
 	 */
 
-	struct CFitAreaStackItem
-	{
-		int CodeLoc; ///< Index of code location where the execution should be
-			/// continued.
-		CFitArea* Area; ///< Fit area currently being evaluated.
-		CFitArea* PrevArea; ///< Previous area.
-		COutArea NewOutAreas[ 3 ]; ///< Storage for temporarily-created
-			/// output image areas. Area at index 2 is used when a new output
-			/// image is created.
-		COutArea* PrevNewOutAreas[ 2 ]; ///< Areas that preceed newly inserted
-			/// areas. When a new output area is inserted, the output area
-			/// that preceeds this area will be pointed to by the PrevOutArea
-			/// variable.
-		COutArea* OutArea; ///< Output image area being checked.
-		COutArea* PrevOutArea; ///< Previously checked output image area.
-		int OutAreasTried; ///< The number of output image areas checked.
-		int OutAreaRemainRight; ///< Output image area remaining on the right
-			/// after placement of the fit area.
-		int OutAreaRemainBottom; ///< Output image area remaining on the
-			/// bottom after placement of the fit area.
-		bool WasOutImageAdded; ///< "True" if OutArea was created to contain
-			/// a new output image. If "true", OutArea's dimensions are big
-			/// enough to contain Area.
-		bool DoOutImageRestore; ///< "True" if output image's dimensions
-			/// should be restored.
-		COutImage OutImageSave; ///< Previous output image's dimensions.
-		int OutSizeSave; ///< Previous summary output images' size.
-		int MinAreaWidth; ///< Minimal width among remaining unfitted areas.
-		int MinAreaHeight; ///< Minimal height among remaining unfitted areas.
-		int c; ///< Variable used to store the number of added temporary
-			/// areas.
-		int c1; ///< Same as "c", used for future reuse.
-	};
-
-	CBuffer< CFitAreaStackItem > Stack; ///< fitUnfittedAreas() function's
-		/// stack.
-	int Depth; ///< Current stack depth.
-	CFitAreaStackItem* s; ///< Current stack item.
+	typedef void (*TBatchWorker)( CFitJobs* Jobs,
+		std :: atomic< int >* NextJob, const CFitParams* Params,
+		CFitContext* Context );
 
 	/**
-	 * Function "pushes" stack in order to process the next set of unfitted
-	 * areas.
+	 * Function performs jobs of a batch using a pool of threads. The pool of
+	 * JobParams.Context is used if it is not NULL, otherwise a temporary
+	 * pool is created.
+	 *
+	 * @param Jobs Jobs to perform.
+	 * @param JobParams Search parameters of the jobs.
+	 * @param ThreadCount The number of threads in the pool, limited to the
+	 * number of jobs.
+	 * @param Worker Function run by each thread of the pool.
 	 */
 
-	void pushStack()
+	static void runBatch( CFitJobs& Jobs, const CFitParams& JobParams,
+		int ThreadCount,
+		const TBatchWorker Worker = runBatchWorker )
 	{
-		Depth++;
-		Stack[ Depth ].Area = UnfittedAreas -> Next;
-		Stack[ Depth ].PrevArea = UnfittedAreas;
-		s = &Stack[ Depth ];
+		if( ThreadCount > Jobs.getItemCount() )
+		{
+			ThreadCount = Jobs.getItemCount();
+		}
+
+		if( JobParams.Context != NULL )
+		{
+			JobParams.Context -> Pool.run( Jobs, JobParams, ThreadCount,
+				Worker );
+		}
+		else
+		{
+			CFitContext :: CBatchPool Pool;
+			Pool.run( Jobs, JobParams, ThreadCount, Worker );
+		}
 	}
 
 	/**
-	 * Function that iterates through all available output image areas where
-	 * the unfitted areas could be fitted, recursively calling the same
-	 * function for the remaining areas.
+	 * Function converts the areas of a fit found by the search with spacing
+	 * to the final areas: removes Padding from their dimensions, and offsets
+	 * them by Border. Function returns the summary size of the areas.
 	 *
-	 * The available output image area where the area was placed is
-	 * temporarily divided into two parts and the algorithm is executed again
-	 * for the remaining areas.
+	 * @param Areas Areas to convert.
+	 * @param Params Search parameters.
 	 */
 
-	void fitUnfittedAreas()
+	static TSize unpadAreas( CArray< CFitArea >& Areas,
+		const CFitParams& Params )
 	{
-		CFitArea* Area;
-		COutArea* OutArea;
+		TSize AreaSize = 0;
+		int i;
 
-	CodeLoc1:
-		while( s -> Area != NULL )
+		for( i = 0; i < Areas.getItemCount(); i++ )
 		{
-			if( fd -> OutSize >= fd -> BestOutSize ||
-				fd -> OutImageCount > fd -> BestOutImageCount )
+			CFitArea& fa = Areas[ i ];
+
+			if( fa.Width > 0 && fa.Height > 0 )
 			{
-				break;
+				fa.Width -= Params.Padding;
+				fa.Height -= Params.Padding;
 			}
 
-			if( FitCallsLeft == 0 )
-			{
-				// Compare *this thread's BestFitCount and
-				// BestFitOutImageCount to the global best.
+			fa.OutX += Params.Border;
+			fa.OutY += Params.Border;
+			AreaSize += (TSize) fa.Width * fa.Height;
+		}
 
-				//VOXSYNCSPIN( Globals -> StateSync );
+		return( AreaSize );
+	}
 
-				if( fd -> BestOutSize > Globals -> BestOutSize ||
-					fd -> BestOutImageCount > Globals -> BestOutImageCount )
-				{
-					fd -> BestOutSize = Globals -> BestOutSize;
-					fd -> BestOutImageCount = Globals -> BestOutImageCount;
+	/**
+	 * Function converts the output images of a fit found by the search with
+	 * spacing to the final output images: extends them by twice Border
+	 * minus Padding, and rounds their dimensions if this difference is not
+	 * zero. Function returns the summary size of the output images.
+	 *
+	 * @param OutImages Output images to convert.
+	 * @param Params Search parameters.
+	 */
 
-					break;
-				}
+	static TSize unpadOutImages( CArray< COutImage >& OutImages,
+		const CFitParams& Params )
+	{
+		const int Margin = Params.Border * 2 - Params.Padding;
+		TSize OutSize = 0;
+		int i;
 
-				if( Globals -> FitCallsLeft == 0 )
-				{
-					return;
-				}
+		for( i = 0; i < OutImages.getItemCount(); i++ )
+		{
+			COutImage& OutImage = OutImages[ i ];
 
-				if( Globals -> FitCallsLeft >= 512 )
-				{
-					FitCallsLeft = 512;
-					Globals -> FitCallsLeft -= 512;
-				}
-				else
-				{
-					FitCallsLeft = Globals -> FitCallsLeft;
-					Globals -> FitCallsLeft = 0;
-				}
+			if( OutImage.Width > 0 && OutImage.Height > 0 )
+			{
+				OutImage.Width = alignDim( OutImage.Width + Margin,
+					Params.OutImageAlign, Params.DoPow2Size );
+
+				OutImage.Height = alignDim( OutImage.Height + Margin,
+					Params.OutImageAlign, Params.DoPow2Size );
 			}
 
-			FitCallsLeft--;
-			Area = s -> Area;
-			s -> PrevArea -> Next = Area -> Next;
+			OutImage.Size = (TSize) OutImage.Width * OutImage.Height;
+			OutSize += OutImage.Size;
+		}
 
-			OutArea = fd -> OutAreas -> Next;
-			s -> PrevOutArea = fd -> OutAreas;
-			s -> OutAreasTried = 0;
+		return( OutSize );
+	}
 
-			while( true )
-			{
-				if( OutArea == NULL )
-				{
-					if( s -> OutAreasTried > 0 )
-					{
-						break;
-					}
+	/**
+	 * Observer that converts the fits of the search with spacing, like the
+	 * fitAreasPadded() function converts the returned fit, before passing
+	 * them to the observer of the search parameters.
+	 */
 
-					if( fd -> OutImageCount == fd -> BestOutImageCount )
-					{
-						break;
-					}
+	class CPaddedObserver : public CFitObserver
+	{
+	public:
+		/**
+		 * A constructor.
+		 *
+		 * @param aParams Search parameters, with the observer to pass the
+		 * fits to.
+		 */
+
+		CPaddedObserver( const CFitParams& aParams )
+			: Params( &aParams )
+		{
+		}
 
-					OutArea = &s -> NewOutAreas[ 2 ];
-					OutArea -> x = 0;
-					OutArea -> y = 0;
-					OutArea -> Width = ( Area -> Width > MaxOutImageWidth ?
-						Area -> Width : MaxOutImageWidth );
+		virtual bool onBestFit( const CArray< CFitArea >& FittedAreas,
+			const CArray< COutImage >& aOutImages, double )
+		{
+			Areas = FittedAreas;
+			OutImages = aOutImages;
+			const TSize AreaSize = unpadAreas( Areas, *Params );
+			const TSize OutSize = unpadOutImages( OutImages, *Params );
 
-					OutArea -> Height = ( Area -> Height > MaxOutImageHeight ?
-						Area -> Height : MaxOutImageHeight );
+			return( Params -> Observer -> onBestFit( Areas, OutImages,
+				( OutSize == 0 ? 100.0 : 100.0 * AreaSize / OutSize )));
+		}
 
-					s -> PrevOutArea = insertOutArea( OutArea );
+	private:
+		const CFitParams* Params; ///< Search parameters.
+		CArray< CFitArea > Areas; ///< Converted areas.
+		CArray< COutImage > OutImages; ///< Converted output images.
+	};
 
-					OutArea -> OutImage = fd -> OutImageCount;
-					fd -> OutImages.updateCapacity( fd -> OutImageCount + 1 );
-					fd -> OutImages[ fd -> OutImageCount ].Width = 0;
-					fd -> OutImages[ fd -> OutImageCount ].Height = 0;
-					fd -> OutImages[ fd -> OutImageCount ].Size = 0;
-					fd -> OutImageCount++;
+	/**
+	 * Function performs the search with spacing, see CFitParams :: Padding
+	 * and Border. Each non-empty area is extended by Padding to the right
+	 * and bottom, so that neighbouring areas share a single gutter. The
+	 * last gutter at the output image edge is replaced by the borders,
+	 * which is reflected in the search's width and height limits. The
+	 * observer receives fits converted like the returned fit. See the
+	 * fitAreas() function for the parameters' description.
+	 */
 
-					s -> WasOutImageAdded = true;
-				}
-				else
-				{
-					s -> WasOutImageAdded = false;
-				}
+	static bool fitAreasPadded( CArray< CFitArea >& AreasToFit,
+		CArray< COutImage >& OutImages, const int aMaxOutImageWidth,
+		const int aMaxOutImageHeight, const TSize aMaxOutImageSize,
+		const int MinOutImageCount, const int FitCallsLimit,
+		double& FitQuality, const CFitParams& Params )
+	{
+		const int Margin = Params.Border * 2 - Params.Padding; // Difference
+			// between output image dimensions and search's dimensions.
 
-				s -> OutArea = OutArea;
-				s -> OutAreaRemainRight = OutArea -> Width - Area -> Width;
-				s -> OutAreaRemainBottom = OutArea -> Height - Area -> Height;
+		CFitParams PadParams = Params;
+		PadParams.Padding = 0;
+		PadParams.Border = 0;
+		CPaddedObserver Observer( Params );
 
-				if( s -> OutAreaRemainRight < 0 ||
-					s -> OutAreaRemainBottom < 0 )
-				{
-					s -> PrevOutArea = OutArea;
-					OutArea = OutArea -> Next;
-					continue;
-				}
+		if( Params.Observer != NULL )
+		{
+			PadParams.Observer = &Observer;
+		}
 
-				if( checkAreaFitAgainstBest( OutArea -> x + Area -> Width,
-					OutArea -> y + Area -> Height,
-					fd -> OutImages[ OutArea -> OutImage ],
-					s -> DoOutImageRestore, s -> OutImageSave,
-					s -> OutSizeSave, s -> OutAreasTried ))
-				{
-					Area -> OutImage = OutArea -> OutImage;
-					Area -> OutX = OutArea -> x;
-					Area -> OutY = OutArea -> y;
+		int MaxWidth = aMaxOutImageWidth;
+		int MaxHeight = aMaxOutImageHeight;
 
-					if( UnfittedAreas -> Next == NULL )
-					{
-						// All areas were fitted and the best OutSize was
-						// found so far. Save the best fit areas and out
-						// images.
+		if( Margin != 0 )
+		{
+			// Rounding of the search's dimensions does not round output
+			// image dimensions, it is performed after the search.
 
-						//VOXSYNCSPIN( Globals -> StateSync );
+			PadParams.OutImageAlign = 1;
+			PadParams.DoPow2Size = false;
+			MaxWidth = alignDimDown( MaxWidth, Params.OutImageAlign,
+				Params.DoPow2Size );
 
-						#if defined( VOX_AREAFITTER_TEST )
+			MaxHeight = alignDimDown( MaxHeight, Params.OutImageAlign,
+				Params.DoPow2Size );
+		}
 
-							BestFitCallCount += Globals -> FitCallsLimit -
-								Globals -> FitCallsLeft - FitCallsLeft;
+		int i;
 
-							BestFitImgCount += fd -> OutImageCount;
-							BestFitCount++;
+		for( i = 0; i < AreasToFit.getItemCount(); i++ )
+		{
+			CFitArea& fa = AreasToFit[ i ];
 
-						#endif // VOX_AREAFITTER_TEST
+			if( fa.Width > 0 && fa.Height > 0 )
+			{
+				fa.Width += Params.Padding;
+				fa.Height += Params.Padding;
+			}
+		}
 
-						if( fd -> OutSize < Globals -> BestOutSize &&
-							fd -> OutImageCount <=
-							Globals -> BestOutImageCount )
-						{
-							fd -> BestOutSize = fd -> OutSize;
-							fd -> BestOutImageCount = fd -> OutImageCount;
+		const bool Success = fitAreas( AreasToFit, OutImages,
+			MaxWidth - Margin, MaxHeight - Margin, aMaxOutImageSize,
+			MinOutImageCount, FitCallsLimit, FitQuality, PadParams );
 
-							Globals -> BestFittedAreas = Areas;
-							Globals -> BestOutSize = fd -> OutSize;
-							Globals -> BestOutImageCount =
-								fd -> OutImageCount;
+		const TSize AreaSize = unpadAreas( AreasToFit, Params );
 
-							Globals -> BestOutImages.setItemCount(
-								fd -> OutImageCount );
+		if( !Success )
+		{
+			return( false );
+		}
 
-							int i;
+		const TSize OutSize = unpadOutImages( OutImages, Params );
+		FitQuality = ( OutSize == 0 ? 100.0 : 100.0 * AreaSize / OutSize );
 
-							for( i = 0; i < fd -> OutImageCount; i++ )
-							{
-								Globals -> BestOutImages[ i ] =
-									fd -> OutImages[ i ];
-							}
-						}
-						else
-						{
-							fd -> BestOutSize = Globals -> BestOutSize;
+		return( true );
+	}
+
+	/**
+	 * Function performs the hierarchical search, see CFitParams ::
+	 * ClusterSize. Each output image (strip) of a cluster becomes a
+	 * super-area that may be rotated if all of its areas may be rotated: a
+	 * rotated super-area's layout is transposed. The fit of the single
+	 * search is returned instead if it is not worse. See the fitAreas()
+	 * function for the parameters' description.
+	 */
+
+	static bool fitAreasClustered( CArray< CFitArea >& AreasToFit,
+		CArray< COutImage >& OutImages, const int aMaxOutImageWidth,
+		const int aMaxOutImageHeight, const TSize aMaxOutImageSize,
+		const int MinOutImageCount, const int FitCallsLimit,
+		double& FitQuality, const CFitParams& Params )
+	{
+		const int AreaCount = AreasToFit.getItemCount();
+		const int ClusterCount = ( AreaCount + Params.ClusterSize - 1 ) /
+			Params.ClusterSize;
+
+		const int ClusterCallsLimit = FitCallsLimit / ( ClusterCount + 2 );
+
+		if( ClusterCallsLimit < Params.ClusterSize )
+		{
+			// FitCallsLimit is too small to be divided.
+
+			CFitParams FlatParams = Params;
+			FlatParams.ClusterSize = 0;
+
+			return( fitAreas( AreasToFit, OutImages, aMaxOutImageWidth,
+				aMaxOutImageHeight, aMaxOutImageSize, MinOutImageCount,
+				FitCallsLimit, FitQuality, FlatParams ));
+		}
+
+		// The single search uses a copy of the areas, and receives an equal
+		// share of calls.
+
+		CArray< CFitArea > FlatAreas = AreasToFit;
+		CArray< COutImage > FlatOutImages;
+		CFitStats FlatStats;
+		CFitParams FlatParams = Params;
+		FlatParams.Observer = NULL;
+		FlatParams.Cache = NULL;
+		FlatParams.Stats = &FlatStats;
+		FlatParams.ClusterSize = 0;
+		FlatParams.DoGreedySeed = true;
+		double FlatQuality;
+
+		const bool IsFlatFound = fitAreas( FlatAreas, FlatOutImages,
+			aMaxOutImageWidth, aMaxOutImageHeight, aMaxOutImageSize,
+			MinOutImageCount, ClusterCallsLimit, FlatQuality, FlatParams );
+
+		CFitStats ClusterStats;
+
+		const bool IsFound = fitClusters( AreasToFit, OutImages,
+			aMaxOutImageWidth, aMaxOutImageHeight, aMaxOutImageSize,
+			MinOutImageCount, ClusterCount, ClusterCallsLimit,
+			FitCallsLimit - ClusterCallsLimit * ( ClusterCount + 1 ),
+			FitQuality, ClusterStats, Params );
+
+		if( IsFlatFound && ( !IsFound || getOutCost( FlatOutImages,
+			Params ) <= getOutCost( OutImages, Params )))
+		{
+			AreasToFit = FlatAreas;
+			OutImages = FlatOutImages;
+			FitQuality = FlatQuality;
+			FlatStats.FitCallCount += ClusterStats.FitCallCount;
+			ClusterStats = FlatStats;
+		}
+		else
+		{
+			if( !IsFound )
+			{
+				OutImages.clear();
+				return( false );
+			}
+
+			ClusterStats.FitCallCount += FlatStats.FitCallCount;
+		}
+
+		if( Params.Stats != NULL )
+		{
+			*Params.Stats = ClusterStats;
+		}
+
+		return( true );
+	}
+
+	/**
+	 * Function fits the areas in clusters into strips, and the strips into
+	 * the output images, see the fitAreasClustered() function. Stats
+	 * receives statistics of the top-level search, with the calls of all
+	 * searches.
+	 */
+
+	static bool fitClusters( CArray< CFitArea >& AreasToFit,
+		CArray< COutImage >& OutImages, const int aMaxOutImageWidth,
+		const int aMaxOutImageHeight, const TSize aMaxOutImageSize,
+		const int MinOutImageCount, const int ClusterCount,
+		const int ClusterCallsLimit, const int TopCallsLimit,
+		double& FitQuality, CFitStats& Stats, const CFitParams& Params )
+	{
+		const int AreaCount = AreasToFit.getItemCount();
+
+		sortFitAreas( AreasToFit, Params.Context,
+			CFitAreaInLess( SortByHeight, Params.AllowRotation ));
+
+		CFitJobs Jobs;
+		int i;
+
+		for( i = 0; i < ClusterCount; i++ )
+		{
+			CFitJob* const Job = new CFitJob;
+			Jobs.add() = Job;
+
+			const int First = i * Params.ClusterSize;
+			const int Last = ( First + Params.ClusterSize < AreaCount ?
+				First + Params.ClusterSize : AreaCount );
+
+			int StripHeight = 0; // Height of the cluster's tallest area,
+				// in its lower orientation.
+
+			int j;
+
+			for( j = First; j < Last; j++ )
+			{
+				CFitArea& fa = Job -> AreasToFit.add( AreasToFit[ j ]);
+				fa.Object = (void*) (intptr_t) j;
+
+				const int h = ( Params.AllowRotation && fa.MayRotate &&
+					fa.Width < fa.Height ? fa.Width : fa.Height );
+
+				if( h > StripHeight )
+				{
+					StripHeight = h;
+				}
+			}
+
+			StripHeight = alignDim( StripHeight, Params.AreaAlign, false );
+			Job -> MaxOutImageWidth = aMaxOutImageWidth;
+			Job -> MaxOutImageHeight = ( StripHeight < aMaxOutImageHeight ?
+				StripHeight : aMaxOutImageHeight );
+
+			Job -> MaxOutImageSize = aMaxOutImageSize;
+			Job -> FitCallsLimit = ClusterCallsLimit;
+		}
+
+		// Super-areas need no output image alignment: they are placed
+		// with it at the top level.
+
+		CFitParams ClusterParams = Params;
+		ClusterParams.Cache = NULL;
+		ClusterParams.ClusterSize = 0;
+		ClusterParams.OutImageAlign = 1;
+		ClusterParams.DoPow2Size = false;
+		fitAreaSets( Jobs, ClusterParams );
+
+		CArray< CFitArea > SuperAreas;
+		CArray< int > AreaSupers( AreaCount ); // Super-area of each area.
+		int ClusterCalls = 0;
+
+		for( i = 0; i < ClusterCount; i++ )
+		{
+			const CFitJob& Job = *Jobs[ i ];
+
+			if( !Job.Success )
+			{
+				return( false );
+			}
+
+			ClusterCalls += Job.Stats.FitCallCount;
+			const int FirstSuper = SuperAreas.getItemCount();
+			int j;
+
+			for( j = 0; j < Job.OutImages.getItemCount(); j++ )
+			{
+				CFitArea& sa = SuperAreas.add();
+				sa.Object = (void*) (intptr_t) ( FirstSuper + j );
+				sa.Width = Job.OutImages[ j ].Width;
+				sa.Height = Job.OutImages[ j ].Height;
+				sa.MayRotate = Params.AllowRotation;
+			}
+
+			for( j = 0; j < Job.AreasToFit.getItemCount(); j++ )
+			{
+				const CFitArea& ja = Job.AreasToFit[ j ];
+				const int a = (int) (intptr_t) ja.Object;
+				AreasToFit[ a ].OutX = ja.OutX;
+				AreasToFit[ a ].OutY = ja.OutY;
+				AreasToFit[ a ].OutRotated = ja.OutRotated;
+				AreaSupers[ a ] = FirstSuper + ja.OutImage;
+
+				if( !ja.MayRotate )
+				{
+					SuperAreas[ FirstSuper + ja.OutImage ].MayRotate = false;
+				}
+			}
+		}
+
+		CArray< CFitArea > TopAreas = SuperAreas;
+		CFitParams TopParams = Params;
+		TopParams.Observer = NULL;
+		TopParams.Cache = NULL;
+		TopParams.Stats = &Stats;
+		TopParams.ClusterSize = 0;
+		double TopQuality;
+
+		if( !fitAreas( TopAreas, OutImages, aMaxOutImageWidth,
+			aMaxOutImageHeight, aMaxOutImageSize, MinOutImageCount,
+			TopCallsLimit, TopQuality, TopParams ))
+		{
+			return( false );
+		}
+
+		for( i = 0; i < TopAreas.getItemCount(); i++ )
+		{
+			SuperAreas[ (int) (intptr_t) TopAreas[ i ].Object ] =
+				TopAreas[ i ];
+		}
+
+		TSize AreaSize = 0;
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			CFitArea& fa = AreasToFit[ i ];
+			const CFitArea& sa = SuperAreas[ AreaSupers[ i ]];
+			AreaSize += (TSize) fa.Width * fa.Height;
+
+			if( sa.OutRotated )
+			{
+				const int x = fa.OutX;
+				fa.OutX = fa.OutY;
+				fa.OutY = x;
+				fa.OutRotated = !fa.OutRotated;
+			}
+
+			fa.OutImage = sa.OutImage;
+			fa.OutX += sa.OutX;
+			fa.OutY += sa.OutY;
+		}
+
+		TSize OutSize = 0;
+
+		for( i = 0; i < OutImages.getItemCount(); i++ )
+		{
+			OutSize += OutImages[ i ].Size;
+		}
+
+		FitQuality = ( OutSize == 0 ? 100.0 : 100.0 * AreaSize / OutSize );
+
+		Stats.FitCallCount += ClusterCalls;
+		return( true );
+	}
+
+	/**
+	 * Structure holds an area's item of a result cache key.
+	 */
+
+	struct CCacheKeyItem
+	{
+		int64_t Value; ///< Area's dimensions and rotation flag.
+		int Area; ///< Index of the area.
+		bool IsFlipped; ///< "True" if the area's dimensions were swapped to
+			/// the landscape orientation.
+	};
+
+	/**
+	 * Function produces the result cache key of the areas: the search
+	 * parameters the result depends on (CFitCache :: KeyHeaderSize values),
+	 * followed by the areas' items in the ascending order, so that the key
+	 * does not depend on the order of the areas. Rotatable areas use the
+	 * landscape orientation.
+	 *
+	 * @param AreasToFit Areas to be fitted.
+	 * @param aMaxOutImageWidth Maximal output image's width in pixels.
+	 * @param aMaxOutImageHeight Maximal output image's height in pixels.
+	 * @param aMaxOutImageSize Absolute maximum limit imposed on output image
+	 * size in pixels.
+	 * @param MinOutImageCount Starting number of output images.
+	 * @param Params Search parameters.
+	 * @param Items Receives the sorted areas' items,
+	 * AreasToFit.getItemCount() items.
+	 * @param Key Receives the key.
+	 */
+
+	static void makeCacheKey( const CArray< CFitArea >& AreasToFit,
+		const int aMaxOutImageWidth, const int aMaxOutImageHeight,
+		const TSize aMaxOutImageSize, const int MinOutImageCount,
+		const CFitParams& Params, CBuffer< CCacheKeyItem >& Items,
+		CArray< int64_t >& Key )
+	{
+		const int AreaCount = AreasToFit.getItemCount();
+		Items.alloc( AreaCount );
+		int i;
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			const CFitArea& fa = AreasToFit[ i ];
+			const bool CanRotate = ( Params.AllowRotation && fa.MayRotate );
+			CCacheKeyItem& ki = Items[ i ];
+			ki.Area = i;
+			ki.IsFlipped = ( CanRotate && fa.Width < fa.Height );
+
+			const int w = ( ki.IsFlipped ? fa.Height : fa.Width );
+			const int h = ( ki.IsFlipped ? fa.Width : fa.Height );
+			ki.Value = ( (int64_t) w << 32 ) | ( (int64_t) h << 1 ) |
+				( CanRotate ? 1 : 0 );
+		}
+
+		CBuffer< CCacheKeyItem > Temp;
+		sortItems( (CCacheKeyItem*) Items, AreaCount, Temp,
+			CCacheKeyItemLess() );
+
+		Key.clear();
+		Key.add( AreaCount );
+		Key.add( aMaxOutImageWidth );
+		Key.add( aMaxOutImageHeight );
+		Key.add( aMaxOutImageSize );
+		Key.add( MinOutImageCount );
+		Key.add( Params.MinOutImageCountLimit );
+		Key.add( Params.SortOrders );
+		Key.add( Params.DoGreedySeed );
+		Key.add( Params.AreaAlign );
+		Key.add( Params.OutImageAlign );
+		Key.add( Params.DoPow2Size );
+		Key.add( Params.ImageCost );
+		Key.add( Params.ImageDimCost );
+		Key.add( Params.ClusterSize );
+		Key.add( Params.WorkUnits );
+		Key.add( Params.RestartCount );
+		Key.add( Params.RestartSeed );
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			Key.add( Items[ i ].Value );
+		}
+	}
+
+	/**
+	 * Function performs the fitAreas() function's search via the result
+	 * cache specified in Params.Cache. A cached result is returned if it was
+	 * found with at least FitCallsLimit calls. Otherwise the search is
+	 * performed, and the better of the found and the cached fits is
+	 * returned and kept in the cache. Results of the searches that may be
+	 * stopped early by the Deadline, CancelFlag or Observer parameters are
+	 * not stored. See the fitAreas() function for the parameters'
+	 * description.
+	 */
+
+	static bool fitAreasCached( CArray< CFitArea >& AreasToFit,
+		CArray< COutImage >& OutImages, const int aMaxOutImageWidth,
+		const int aMaxOutImageHeight, const TSize aMaxOutImageSize,
+		const int MinOutImageCount, const int FitCallsLimit,
+		double& FitQuality, const CFitParams& Params )
+	{
+		CFitCache& Cache = *Params.Cache;
+		CBuffer< CCacheKeyItem > Items;
+		CArray< int64_t > Key;
+		makeCacheKey( AreasToFit, aMaxOutImageWidth, aMaxOutImageHeight,
+			aMaxOutImageSize, MinOutImageCount, Params, Items, Key );
+
+		const uint64_t Hash = CFitCache :: hashKey( Key );
+		CFitCache :: CEntry Found;
+		bool IsFound = false;
+
+		{
+			VOXSYNCSPIN( Cache.Sync );
+			const int e = Cache.findEntry( Hash, Key );
+
+			if( e != -1 )
+			{
+				Found = *Cache.Entries[ e ];
+				IsFound = true;
+			}
+		}
+
+		if( IsFound && Found.FitCallsLimit >= FitCallsLimit )
+		{
+			Found.apply( AreasToFit, OutImages, Items );
+			FitQuality = Found.FitQuality;
+
+			if( Params.Stats != NULL )
+			{
+				*Params.Stats = CFitStats();
+			}
+
+			return( true );
+		}
+
+		CFitParams SearchParams = Params;
+		SearchParams.Cache = NULL;
+
+		if( !fitAreas( AreasToFit, OutImages, aMaxOutImageWidth,
+			aMaxOutImageHeight, aMaxOutImageSize, MinOutImageCount,
+			FitCallsLimit, FitQuality, SearchParams ))
+		{
+			if( !IsFound )
+			{
+				return( false );
+			}
+
+			Found.apply( AreasToFit, OutImages, Items );
+			FitQuality = Found.FitQuality;
+			return( true );
+		}
+
+		if( IsFound && getOutCost( Found.OutImages, Params ) <
+			getOutCost( OutImages, Params ))
+		{
+			// The areas were reordered by the search.
+
+			makeCacheKey( AreasToFit, aMaxOutImageWidth, aMaxOutImageHeight,
+				aMaxOutImageSize, MinOutImageCount, Params, Items, Key );
+
+			Found.apply( AreasToFit, OutImages, Items );
+			FitQuality = Found.FitQuality;
+		}
+
+		if( Params.HasDeadline || Params.CancelFlag != NULL ||
+			Params.Observer != NULL )
+		{
+			return( true );
+		}
+
+		makeCacheKey( AreasToFit, aMaxOutImageWidth, aMaxOutImageHeight,
+			aMaxOutImageSize, MinOutImageCount, Params, Items, Key );
+
+		CFitCache :: CEntry* const NewEntry = new CFitCache :: CEntry;
+		NewEntry -> Hash = Hash;
+		NewEntry -> Key = Key;
+		NewEntry -> FitCallsLimit = FitCallsLimit;
+		NewEntry -> FitQuality = FitQuality;
+		NewEntry -> OutImages = OutImages;
+		NewEntry -> Areas.setItemCount( AreasToFit.getItemCount() );
+		int i;
+
+		for( i = 0; i < AreasToFit.getItemCount(); i++ )
+		{
+			const CCacheKeyItem& ki = Items[ i ];
+			const CFitArea& fa = AreasToFit[ ki.Area ];
+			CFitCache :: CCachedArea& ca = NewEntry -> Areas[ i ];
+			ca.OutImage = fa.OutImage;
+			ca.OutX = fa.OutX;
+			ca.OutY = fa.OutY;
+			ca.OutRotated = ( fa.OutRotated != ki.IsFlipped );
+		}
+
+		VOXSYNCSPIN( Cache.Sync );
+		Cache.addEntry( NewEntry );
+
+		return( true );
+	}
+
+	/**
+	 * Function creates jobs that search the same sorted areas, to be
+	 * performed by the runSearchWorker() function. See the fitAreas()
+	 * function for the parameters' description.
+	 *
+	 * @param Jobs Receives the jobs.
+	 * @param JobCount The number of jobs to create.
+	 * @param JobCallsLimit FitCallsLimit of each job, at least 1.
+	 */
+
+	static void makeSearchJobs( CFitJobs& Jobs,
+		const int JobCount, const CArray< CFitArea >& AreasToFit,
+		const CArray< COutImage >& OutImages, const int aMaxOutImageWidth,
+		const int aMaxOutImageHeight, const TSize aMaxOutImageSize,
+		const int MinOutImageCount, const int JobCallsLimit )
+	{
+		int i;
+
+		for( i = 0; i < JobCount; i++ )
+		{
+			CFitJob* const Job = new CFitJob();
+			Jobs.add() = Job;
+			Job -> AreasToFit = AreasToFit;
+			Job -> OutImages = OutImages;
+			Job -> MaxOutImageWidth = aMaxOutImageWidth;
+			Job -> MaxOutImageHeight = aMaxOutImageHeight;
+			Job -> MaxOutImageSize = aMaxOutImageSize;
+			Job -> MinOutImageCount = MinOutImageCount;
+			Job -> FitCallsLimit = ( JobCallsLimit > 0 ? JobCallsLimit : 1 );
+		}
+	}
+
+	/**
+	 * Function returns the best fit among the performed search jobs: of
+	 * fits of equal size, the fit with fewer output images, and then the
+	 * fit of the lower job, is chosen. Function returns "false" if no job
+	 * found a fit. See the fitAreas() function for the parameters'
+	 * description.
+	 *
+	 * @param Jobs Performed jobs.
+	 * @param Params Search parameters: the Stats receive the summary
+	 * statistics of the jobs, with the best fit's times.
+	 */
+
+	static bool getBestJobFit( const CFitJobs& Jobs,
+		CArray< CFitArea >& AreasToFit, CArray< COutImage >& OutImages,
+		double& FitQuality, const CFitParams& Params )
+	{
+		const CFitJob* Best = NULL;
+		TSize BestCost = 0;
+		CFitStats Stats;
+		int i;
+
+		for( i = 0; i < Jobs.getItemCount(); i++ )
+		{
+			const CFitJob* const Job = Jobs[ i ];
+			const CFitStats& js = Job -> Stats;
+			Stats.FitCallCount += js.FitCallCount;
+			Stats.BestOutSizePruneCount += js.BestOutSizePruneCount;
+			Stats.MaxOutImageSizePruneCount += js.MaxOutImageSizePruneCount;
+			Stats.LowerBoundPruneCount += js.LowerBoundPruneCount;
+			Stats.NewOutImageCount += js.NewOutImageCount;
+
+			if( js.MaxDepth > Stats.MaxDepth )
+			{
+				Stats.MaxDepth = js.MaxDepth;
+			}
+
+			if( Job -> Success )
+			{
+				const TSize Cost = getOutCost( Job -> OutImages, Params );
+
+				if( Best == NULL || Cost < BestCost || ( Cost == BestCost &&
+					Job -> OutImages.getItemCount() <
+					Best -> OutImages.getItemCount() ))
+				{
+					Best = Job;
+					BestCost = Cost;
+				}
+			}
+		}
+
+		if( Params.Stats != NULL )
+		{
+			if( Best != NULL )
+			{
+				Stats.BestFitCount = Best -> Stats.BestFitCount;
+				Stats.BestFitCallCount = Best -> Stats.BestFitCallCount;
+				Stats.FirstBestFitTime = Best -> Stats.FirstBestFitTime;
+				Stats.LastBestFitTime = Best -> Stats.LastBestFitTime;
+			}
+
+			*Params.Stats = Stats;
+		}
+
+		if( Best == NULL )
+		{
+			OutImages.clear();
+			return( false );
+		}
+
+		AreasToFit = Best -> AreasToFit;
+		OutImages = Best -> OutImages;
+		FitQuality = Best -> FitQuality;
+
+		return( true );
+	}
+
+	/**
+	 * Function performs the deterministic search of the sorted areas, see
+	 * CFitParams :: WorkUnits. See the fitAreas() function for the
+	 * parameters' description.
+	 */
+
+	static bool searchFitUnits( CArray< CFitArea >& AreasToFit,
+		CArray< COutImage >& OutImages, const int aMaxOutImageWidth,
+		const int aMaxOutImageHeight, const TSize aMaxOutImageSize,
+		const int MinOutImageCount, const int FitCallsLimit,
+		double& FitQuality, const CFitParams& Params )
+	{
+		const int UnitCount = ( Params.WorkUnits < AreasToFit.getItemCount() ?
+			Params.WorkUnits : AreasToFit.getItemCount() );
+
+		CFitJobs Jobs;
+		makeSearchJobs( Jobs, UnitCount, AreasToFit, OutImages,
+			aMaxOutImageWidth, aMaxOutImageHeight, aMaxOutImageSize,
+			MinOutImageCount, FitCallsLimit / UnitCount );
+
+		CFitParams UnitParams = Params;
+		UnitParams.ThreadCount = 1;
+		UnitParams.Observer = NULL;
+		runBatch( Jobs, UnitParams, getThreadCount( Params ),
+			runSearchWorker );
+
+		return( getBestJobFit( Jobs, AreasToFit, OutImages, FitQuality,
+			Params ));
+	}
+
+	/**
+	 * Function performs the search of the sorted areas with restarts, see
+	 * CFitParams :: RestartCount. Each restart searches the areas in an
+	 * order perturbed by the perturbAreas() function. See the fitAreas()
+	 * function for the parameters' description.
+	 */
+
+	static bool searchFitRestarts( CArray< CFitArea >& AreasToFit,
+		CArray< COutImage >& OutImages, const int aMaxOutImageWidth,
+		const int aMaxOutImageHeight, const TSize aMaxOutImageSize,
+		const int MinOutImageCount, const int FitCallsLimit,
+		double& FitQuality, const CFitParams& Params )
+	{
+		const int RunCount = Params.RestartCount + 1;
+
+		CFitJobs Jobs;
+		makeSearchJobs( Jobs, RunCount, AreasToFit, OutImages,
+			aMaxOutImageWidth, aMaxOutImageHeight, aMaxOutImageSize,
+			MinOutImageCount, FitCallsLimit / RunCount );
+
+		int i;
+
+		for( i = 1; i < RunCount; i++ )
+		{
+			perturbAreas( Jobs[ i ] -> AreasToFit,
+				( Params.RestartSeed + i ) * 2654435761U );
+		}
+
+		CFitParams RunParams = Params;
+		RunParams.ThreadCount = 1;
+		RunParams.Observer = NULL;
+		RunParams.WorkUnits = 0;
+		runBatch( Jobs, RunParams, getThreadCount( Params ),
+			runSearchWorker );
+
+		return( getBestJobFit( Jobs, AreasToFit, OutImages, FitQuality,
+			Params ));
+	}
+
+	/**
+	 * Function perturbs the order of the areas: some areas are swapped with
+	 * one of the next few areas at random.
+	 *
+	 * @param Areas Areas to reorder.
+	 * @param Seed Seed of the pseudo-random sequence.
+	 */
+
+	static void perturbAreas( CArray< CFitArea >& Areas, unsigned int Seed )
+	{
+		static const int MaxDist = 4; // Maximal distance between the
+			// swapped areas.
+
+		const int AreaCount = Areas.getItemCount();
+		int i;
+
+		for( i = 0; i < AreaCount - 1; i++ )
+		{
+			Seed = Seed * 1103515245 + 12345;
+			const unsigned int r = Seed >> 8;
+
+			if(( r & 3 ) == 0 )
+			{
+				const int Dist = ( AreaCount - 1 - i < MaxDist ?
+					AreaCount - 1 - i : MaxDist );
+
+				const int j = i + 1 + (int) (( r >> 2 ) % Dist );
+				const CFitArea a = Areas[ i ];
+				Areas[ i ] = Areas[ j ];
+				Areas[ j ] = a;
+			}
+		}
+	}
+
+	/**
+	 * Function performs a separate search for each of the sort orders
+	 * specified in Params.SortOrders, and returns the best fit. See the
+	 * fitAreas() function for the parameters' description.
+	 */
+
+	static bool fitAreasMultiOrder( CArray< CFitArea >& AreasToFit,
+		CArray< COutImage >& OutImages, const int aMaxOutImageWidth,
+		const int aMaxOutImageHeight, const TSize aMaxOutImageSize,
+		const int MinOutImageCount, const int FitCallsLimit,
+		double& FitQuality, const CFitParams& Params )
+	{
+		CFitJobs Jobs;
+		int Order;
+
+		for( Order = SortByWidth; Order <= SortByPerimeter; Order <<= 1 )
+		{
+			if(( Params.SortOrders & Order ) != 0 )
+			{
+				CFitJob* const Job = new CFitJob();
+				Jobs.add() = Job;
+				Job -> AreasToFit = AreasToFit;
+				Job -> OutImages = OutImages;
+				Job -> MaxOutImageWidth = aMaxOutImageWidth;
+				Job -> MaxOutImageHeight = aMaxOutImageHeight;
+				Job -> MaxOutImageSize = aMaxOutImageSize;
+				Job -> MinOutImageCount = MinOutImageCount;
+				Job -> FitCallsLimit = FitCallsLimit;
+				Job -> SortOrders = Order;
+			}
+		}
+
+		// Threads are divided among the searches.
+
+		const int ThreadCount = getThreadCount( Params );
+		CFitParams JobParams = Params;
+		JobParams.ThreadCount = ThreadCount / Jobs.getItemCount();
+		JobParams.Observer = NULL;
+
+		if( JobParams.ThreadCount < 1 )
+		{
+			JobParams.ThreadCount = 1;
+		}
+
+		runBatch( Jobs, JobParams, ThreadCount );
+
+		CFitJob* Best = NULL;
+		TSize BestCost = 0;
+		int i;
+
+		for( i = 0; i < Jobs.getItemCount(); i++ )
+		{
+			CFitJob* const Job = Jobs[ i ];
+
+			if( Job -> Success )
+			{
+				const TSize Cost = getOutCost( Job -> OutImages, Params );
+
+				if( Best == NULL || Cost < BestCost || ( Cost == BestCost &&
+					Job -> OutImages.getItemCount() <
+					Best -> OutImages.getItemCount() ))
+				{
+					Best = Job;
+					BestCost = Cost;
+				}
+			}
+		}
+
+		if( Params.Stats != NULL )
+		{
+			*Params.Stats = ( Best != NULL ? Best -> Stats :
+				Jobs[ 0 ] -> Stats );
+		}
+
+		if( Best == NULL )
+		{
+			OutImages.clear();
+			return( false );
+		}
+
+		AreasToFit = Best -> AreasToFit;
+		OutImages = Best -> OutImages;
+		FitQuality = Best -> FitQuality;
+
+		return( true );
+	}
+
+	/**
+	 * Function performs jobs of a batch until no untaken jobs are left, see
+	 * the fitAreaSets() function.
+	 *
+	 * @param Jobs Jobs of the batch.
+	 * @param NextJob Index of the next job yet to be taken by a thread.
+	 * @param Params Search parameters of all jobs.
+	 * @param Context Context of the thread, reused between jobs.
+	 */
+
+	static void runBatchWorker( CFitJobs* const Jobs,
+		std :: atomic< int >* const NextJob, const CFitParams* const Params,
+		CFitContext* const Context )
+	{
+		CFitParams JobParams = *Params;
+		JobParams.Context = Context;
+
+		while( true )
+		{
+			const int j = NextJob -> fetch_add( 1 );
+
+			if( j >= Jobs -> getItemCount() )
+			{
+				break;
+			}
+
+			CFitJob& Job = *( *Jobs )[ j ];
+			JobParams.Stats = &Job.Stats;
+			JobParams.SortOrders = ( Job.SortOrders != 0 ? Job.SortOrders :
+				Params -> SortOrders );
+
+			Job.Success = fitAreas( Job.AreasToFit, Job.OutImages,
+				Job.MaxOutImageWidth, Job.MaxOutImageHeight,
+				Job.MaxOutImageSize, Job.MinOutImageCount, Job.FitCallsLimit,
+				Job.FitQuality, JobParams );
+		}
+	}
+
+	/**
+	 * Function performs searches of sorted areas, created by the
+	 * makeSearchJobs() function, until no untaken jobs are left. If
+	 * Params -> WorkUnits is greater than 0, each job is a work unit of the
+	 * deterministic search, with the job's index being the unit's index.
+	 *
+	 * @param Jobs Jobs of the searches.
+	 * @param NextJob Index of the next job yet to be taken by a thread.
+	 * @param Params Search parameters of all jobs.
+	 * @param Context Context of the thread, reused between jobs.
+	 */
+
+	static void runSearchWorker( CFitJobs* const Jobs,
+		std :: atomic< int >* const NextJob, const CFitParams* const Params,
+		CFitContext* const Context )
+	{
+		CFitParams JobParams = *Params;
+		JobParams.Context = Context;
+
+		while( true )
+		{
+			const int j = NextJob -> fetch_add( 1 );
+
+			if( j >= Jobs -> getItemCount() )
+			{
+				break;
+			}
+
+			CFitJob& Job = *( *Jobs )[ j ];
+			JobParams.Stats = &Job.Stats;
+			const bool IsUnit = ( Params -> WorkUnits > 0 );
+
+			Job.Success = searchFit( Job.AreasToFit, Job.OutImages,
+				Job.MaxOutImageWidth, Job.MaxOutImageHeight,
+				Job.MaxOutImageSize, Job.MinOutImageCount, Job.FitCallsLimit,
+				Job.FitQuality, JobParams, NULL, ( IsUnit ? j : 0 ),
+				( IsUnit ? Jobs -> getItemCount() : 1 ));
+		}
+	}
+
+	/**
+	 * Function rounds a dimension up to the required granularity.
+	 *
+	 * @param v Dimension to round, in pixels.
+	 * @param Align Granularity of the dimension.
+	 * @param DoPow2 "True" if the dimension should be rounded up to a
+	 * power of two first.
+	 */
+
+	static int alignDim( int v, const int Align, const bool DoPow2 )
+	{
+		if( DoPow2 )
+		{
+			int p = 1;
+
+			while( p < v )
+			{
+				p <<= 1;
+			}
+
+			v = p;
+		}
+
+		if( Align > 1 )
+		{
+			v = ( v + Align - 1 ) / Align * Align;
+		}
+
+		return( v );
+	}
+
+	/**
+	 * Function rounds a dimension limit down to the required granularity,
+	 * see the alignDim() function. The returned value is never lesser than
+	 * the smallest aligned dimension.
+	 *
+	 * @param v Dimension limit to round, in pixels.
+	 * @param Align Granularity of the dimension.
+	 * @param DoPow2 "True" if the dimension should be a power of two.
+	 */
+
+	static int alignDimDown( int v, const int Align, const bool DoPow2 )
+	{
+		if( DoPow2 )
+		{
+			int p = 1;
+
+			while( p <= v / 2 )
+			{
+				p <<= 1;
+			}
+
+			v = p;
+		}
+
+		if( Align > 1 )
+		{
+			v = ( v < Align ? Align : v / Align * Align );
+		}
+
+		return( v );
+	}
+
+	/**
+	 * @return Cost of an output image, see CFitParams :: ImageCost. An
+	 * empty image has a zero cost.
+	 *
+	 * @param w Output image width, in pixels.
+	 * @param h Output image height, in pixels.
+	 * @param ImageCost Cost of a non-empty output image.
+	 * @param ImageDimCost Cost of the larger output image dimension.
+	 */
+
+	static TSize getImageCost( const int w, const int h,
+		const TSize ImageCost, const TSize ImageDimCost )
+	{
+		if( w == 0 || h == 0 )
+		{
+			return( 0 );
+		}
+
+		return( (TSize) w * h + ImageCost +
+			ImageDimCost * ( w > h ? w : h ));
+	}
+
+	/**
+	 * @return Summary cost of output images, see CFitParams :: ImageCost.
+	 *
+	 * @param OutImages Output images.
+	 * @param Params Search parameters.
+	 */
+
+	static TSize getOutCost( const CArray< COutImage >& OutImages,
+		const CFitParams& Params )
+	{
+		TSize Cost = 0;
+		int i;
+
+		for( i = 0; i < OutImages.getItemCount(); i++ )
+		{
+			Cost += getImageCost( OutImages[ i ].Width,
+				OutImages[ i ].Height, Params.ImageCost,
+				Params.ImageDimCost );
+		}
+
+		return( Cost );
+	}
+
+	/**
+	 * Structure holds a layout of fixed areas the search starts from,
+	 * instead of empty output images.
+	 */
+
+	struct CBaseLayout
+	{
+		CArray< COutImage > OutImages; ///< Output images, with the
+			/// dimensions of the fixed areas' bounding boxes.
+		CArray< COutArea > OutAreas; ///< Non-overlapping free output image
+			/// areas around the fixed areas.
+		TSize FixedSize; ///< Summary size of the fixed areas.
+	};
+
+	/**
+	 * Function adds free areas of an output image to the list of output
+	 * image areas. The image's rectangle without the fixed areas is split
+	 * into horizontal strips at the fixed areas' edges, and the gaps of
+	 * strips are merged vertically where their x extents are equal.
+	 *
+	 * @param OutAreas Receives free areas.
+	 * @param OutImage Output image index.
+	 * @param Width Width of the output image's rectangle.
+	 * @param Height Height of the output image's rectangle.
+	 * @param FixedAreas Fixed areas, only areas placed into OutImage are
+	 * used.
+	 * @param AreaAlign Alignment of area offsets: fixed areas are extended
+	 * to the enclosing AreaAlign x AreaAlign blocks, so that free areas
+	 * start at aligned offsets.
+	 */
+
+	static void addFreeAreas( CArray< COutArea >& OutAreas,
+		const int OutImage, const int Width, const int Height,
+		const CArray< CFitArea >& FixedAreas, const int AreaAlign )
+	{
+		CArray< COutArea > Rects; // Fixed areas of the output image.
+		CArray< int > Edges; // Strip boundaries.
+		Edges.add( 0 );
+		Edges.add( Height );
+		int i;
+
+		for( i = 0; i < FixedAreas.getItemCount(); i++ )
+		{
+			const CFitArea& fa = FixedAreas[ i ];
+
+			if( fa.OutImage != OutImage || fa.Width == 0 || fa.Height == 0 )
+			{
+				continue;
+			}
+
+			COutArea& r = Rects.add();
+			r.OutImage = OutImage;
+			r.x = fa.OutX / AreaAlign * AreaAlign;
+			r.y = fa.OutY / AreaAlign * AreaAlign;
+			r.Width = alignDim( fa.OutX +
+				( fa.OutRotated ? fa.Height : fa.Width ), AreaAlign,
+				false ) - r.x;
+
+			r.Height = alignDim( fa.OutY +
+				( fa.OutRotated ? fa.Width : fa.Height ), AreaAlign,
+				false ) - r.y;
+			Edges.add( r.y );
+			Edges.add( r.y + r.Height );
+		}
+
+		CBuffer< int > EdgesTemp;
+		sortItems( &Edges[ 0 ], Edges.getItemCount(), EdgesTemp,
+			CIntLess() );
+
+		CArray< COutArea > Spans; // Fixed areas crossing the current strip.
+		CBuffer< COutArea > SpansTemp;
+		CArray< int > Open; // Free areas that end at the current strip.
+		CArray< int > NewOpen;
+
+		for( i = 1; i < Edges.getItemCount(); i++ )
+		{
+			const int y0 = Edges[ i - 1 ];
+			const int y1 = Edges[ i ];
+
+			if( y0 == y1 )
+			{
+				continue;
+			}
+
+			Spans.clear();
+			int j;
+
+			for( j = 0; j < Rects.getItemCount(); j++ )
+			{
+				if( Rects[ j ].y < y1 && Rects[ j ].y + Rects[ j ].Height > y0 )
+				{
+					Spans.add( Rects[ j ]);
+				}
+			}
+
+			if( Spans.getItemCount() > 1 )
+			{
+				sortItems( &Spans[ 0 ], Spans.getItemCount(), SpansTemp,
+					COutAreaXLess() );
+			}
+
+			NewOpen.clear();
+			int x = 0;
+
+			for( j = 0; j <= Spans.getItemCount(); j++ )
+			{
+				const int x1 = ( j < Spans.getItemCount() ?
+					Spans[ j ].x : Width );
+
+				if( x1 > x )
+				{
+					int k;
+
+					for( k = 0; k < Open.getItemCount(); k++ )
+					{
+						COutArea& oa = OutAreas[ Open[ k ]];
+
+						if( oa.x == x && oa.Width == x1 - x &&
+							oa.y + oa.Height == y0 )
+						{
+							oa.Height += y1 - y0;
+							NewOpen.add( Open[ k ]);
+							break;
+						}
+					}
+
+					if( k == Open.getItemCount() )
+					{
+						NewOpen.add( OutAreas.getItemCount() );
+						COutArea& oa = OutAreas.add();
+						oa.OutImage = OutImage;
+						oa.x = x;
+						oa.y = y0;
+						oa.Width = x1 - x;
+						oa.Height = y1 - y0;
+					}
+				}
+
+				if( j < Spans.getItemCount() &&
+					Spans[ j ].x + Spans[ j ].Width > x )
+				{
+					x = Spans[ j ].x + Spans[ j ].Width;
+				}
+			}
+
+			Open = NewOpen;
+		}
+	}
+
+	/**
+	 * Function performs the search for the best fit of the sorted areas.
+	 * Function returns "true" if a fit was found. See the fitAreas() and
+	 * refitAreas() functions for the parameters' description.
+	 *
+	 * @param Base Layout of fixed areas the search starts from, NULL if the
+	 * search starts from MinOutImageCount empty output images.
+	 * @param FirstRootArea Index of the first root area to search.
+	 * @param RootAreaStep Increment of the index of root areas to search.
+	 */
+
+	static bool searchFit( CArray< CFitArea >& AreasToFit,
+		CArray< COutImage >& OutImages, const int aMaxOutImageWidth,
+		const int aMaxOutImageHeight, TSize aMaxOutImageSize,
+		const int MinOutImageCount, const int FitCallsLimit,
+		double& FitQuality, const CFitParams& Params,
+		const CBaseLayout* const Base, const int FirstRootArea = 0,
+		const int RootAreaStep = 1 )
+	{
+		CFitContext* const Context = Params.Context;
+		CGlobals LocalGlobals;
+		CGlobals& aGlobals = ( Context != NULL ? Context -> Globals :
+			LocalGlobals );
+
+		aGlobals.AllowRotation = Params.AllowRotation;
+		aGlobals.AreaAlign = Params.AreaAlign;
+		aGlobals.OutImageAlign = Params.OutImageAlign;
+		aGlobals.DoPow2Size = Params.DoPow2Size;
+		aGlobals.ImageCost = Params.ImageCost;
+		aGlobals.ImageDimCost = Params.ImageDimCost;
+		aGlobals.FitCallsLimit = FitCallsLimit;
+		aGlobals.FitCallsLeft = FitCallsLimit;
+		aGlobals.BestOutSize = std :: numeric_limits< TSize > :: max();
+		aGlobals.BestOutImageCount = 0x7FFFFFFF;
+		aGlobals.NextRootArea = FirstRootArea;
+		aGlobals.RootAreaStep = RootAreaStep;
+		aGlobals.ActiveFitters = 0;
+		aGlobals.HasDeadline = Params.HasDeadline;
+		aGlobals.Deadline = Params.Deadline;
+		aGlobals.CancelFlag = Params.CancelFlag;
+		aGlobals.IsStopped = false;
+		aGlobals.Observer = Params.Observer;
+		aGlobals.StartTime = std :: chrono :: steady_clock :: now();
+		aGlobals.Stats = CFitStats();
+
+		if( aGlobals.BestFittedAreas.getCapacity() <
+			AreasToFit.getItemCount() )
+		{
+			aGlobals.BestFittedAreas.alloc( AreasToFit.getItemCount() );
+		}
+
+		if( aGlobals.Observer != NULL )
+		{
+			aGlobals.ObserverAreas = AreasToFit;
+		}
+
+		TSize MinOutSize = ( Base == NULL ? 0 : Base -> FixedSize ); // Minimal
+			// possible OutSize - achieved either in optimal packing or when
+			// all fit areas were placed in separate output images.
+
+		int i;
+
+		for( i = 0; i < AreasToFit.getItemCount(); i++ )
+		{
+			const CFitArea& fa = AreasToFit[ i ];
+			const TSize AlignedSize = (TSize) alignDim( alignDim( fa.Width,
+				Params.AreaAlign, false ), Params.OutImageAlign,
+				Params.DoPow2Size ) * alignDim( alignDim( fa.Height,
+				Params.AreaAlign, false ), Params.OutImageAlign,
+				Params.DoPow2Size );
+
+			if( aMaxOutImageSize < AlignedSize )
+			{
+				aMaxOutImageSize = AlignedSize;
+			}
+
+			MinOutSize += (TSize) fa.Width * fa.Height;
+		}
+
+		// Output image dimensions are rounded up during the search, the
+		// limits are rounded down so that they are not exceeded.
+
+		const int MaxWidth = alignDimDown( aMaxOutImageWidth,
+			Params.OutImageAlign, Params.DoPow2Size );
+
+		const int MaxHeight = alignDimDown( aMaxOutImageHeight,
+			Params.OutImageAlign, Params.DoPow2Size );
+
+		aGlobals.MinOutSize = MinOutSize;
+
+		int ThreadCount = getThreadCount( Params );
+
+		if( ThreadCount > AreasToFit.getItemCount() )
+		{
+			// Each thread needs at least one root area.
+
+			ThreadCount = AreasToFit.getItemCount();
+		}
+
+		CInitArray< CPtrKeeper< CAreaFitter* > > AreaFitters; // A single
+			// fitter object is created for every thread. Each fitter takes
+			// "root areas" from the shared pool until the pool is exhausted,
+			// and then steals untried areas from other fitters.
+
+		CBuffer< CAreaFitter* > Fitters( ThreadCount );
+		aGlobals.Fitters = Fitters;
+		aGlobals.FitterCount = ThreadCount;
+
+		for( i = 0; i < ThreadCount; i++ )
+		{
+			if( Context != NULL )
+			{
+				if( i == Context -> Fitters.getItemCount() )
+				{
+					Context -> Fitters.add() = new CAreaFitter();
+				}
+
+				Fitters[ i ] = Context -> Fitters[ i ];
+				Fitters[ i ] -> init( MaxWidth, MaxHeight, aMaxOutImageSize,
+					&aGlobals, AreasToFit );
+			}
+			else
+			{
+				Fitters[ i ] = new CAreaFitter( MaxWidth, MaxHeight,
+					aMaxOutImageSize, &aGlobals, AreasToFit );
+
+				AreaFitters.add() = Fitters[ i ];
+			}
+
+			Fitters[ i ] -> initFitData( MinOutImageCount, Base );
+		}
+
+		// The greedy fit starts from empty output images only.
+
+		if( Params.DoGreedySeed && Base == NULL )
+		{
+			Fitters[ 0 ] -> seedGreedyFit();
+		}
+
+		int OutImageCount = MinOutImageCount;
+
+		while( true )
+		{
+			CArray< std :: thread* > Threads;
+
+			for( i = 1; i < ThreadCount; i++ )
+			{
+				Threads.add() = new std :: thread( runFitter, Fitters[ i ]);
+			}
+
+			runFitter( Fitters[ 0 ]);
+
+			for( i = 0; i < Threads.getItemCount(); i++ )
+			{
+				Threads[ i ] -> join();
+				delete Threads[ i ];
+			}
+
+			OutImageCount++;
+
+			// A fit without unused space can not be improved by more output
+			// images. BestOutSize includes the image cost terms, so the
+			// sizes of the best fit's output images are compared instead.
+
+			const bool HasBestFit = ( aGlobals.BestOutSize !=
+				std :: numeric_limits< TSize > :: max() );
+
+			if( Base != NULL || OutImageCount > Params.MinOutImageCountLimit ||
+				aGlobals.IsStopped ||
+				( HasBestFit && getBestFitSize( aGlobals ) == MinOutSize ) ||
+				FitCallsLimit > 0x7FFFFFFF - aGlobals.FitCallsLimit )
+			{
+				break;
+			}
+
+			// Repeat the search with one more output image. The best fit
+			// found so far is kept, and its size prunes the repeated search.
+			// Fits with more output images are now allowed.
+
+			aGlobals.BestOutImageCount = 0x7FFFFFFF;
+			aGlobals.FitCallsLimit += FitCallsLimit;
+			aGlobals.FitCallsLeft = FitCallsLimit;
+			aGlobals.NextRootArea = FirstRootArea;
+
+			for( i = 0; i < ThreadCount; i++ )
+			{
+				Fitters[ i ] -> initFitData( OutImageCount, Base );
+			}
+
+			if( Params.DoGreedySeed )
+			{
+				Fitters[ 0 ] -> seedGreedyFit();
+			}
+		}
+
+		if( Params.Stats != NULL )
+		{
+			CFitStats& Stats = *Params.Stats;
+			Stats = aGlobals.Stats;
+
+			for( i = 0; i < ThreadCount; i++ )
+			{
+				const CFitStats& fs = Fitters[ i ] -> Stats;
+				Stats.FitCallCount += fs.FitCallCount;
+				Stats.BestOutSizePruneCount += fs.BestOutSizePruneCount;
+				Stats.MaxOutImageSizePruneCount +=
+					fs.MaxOutImageSizePruneCount;
+
+				Stats.LowerBoundPruneCount += fs.LowerBoundPruneCount;
+				Stats.NewOutImageCount += fs.NewOutImageCount;
+
+				if( fs.MaxDepth > Stats.MaxDepth )
+				{
+					Stats.MaxDepth = fs.MaxDepth;
+				}
+			}
+		}
+
+		if( aGlobals.BestOutSize != std :: numeric_limits< TSize > :: max())
+		{
+			getBestFit( aGlobals, AreasToFit, OutImages );
+			sortFitAreas( AreasToFit, Params.Context, CFitAreaOutLess() );
+
+			FitQuality = getBestFitQuality( aGlobals );
+			return( true );
+		}
+
+		return( false );
+	}
+
+	/**
+	 * This structure holds the current state of the area fitting process.
+	 * Note that this structure may also hold a copy of the fitting process
+	 * state of a parallel thread.
+	 *
+	 * Unfitted areas and available output areas are kept in contiguous
+	 * buffers, and referenced by element indices, so that the state can be
+	 * accessed sequentially and copied without pointer adjustment.
+	 */
+
+	struct CFitData
+	{
+		CBuffer< CUnfittedArea > UnfittedAreas; ///< List of unfitted areas.
+			/// The indices of elements of this buffer correspond to the
+			/// indices of areas in the sorted AreasToFit list. The last item
+			/// (with the index equal to the number of areas) is the
+			/// "initial" item, always present in the list as the first item.
+		CBuffer< CFittedArea > FittedAreas; ///< Parameters of all fitted
+			/// areas. The indices of elements of this buffer correspond to
+			/// the indices of areas in the sorted AreasToFit list. The
+			/// number of elements is also equal to that of the AreasToFit
+			/// list.
+		CBuffer< COutArea > OutAreas; ///< Storage of output areas: output
+			/// image areas at the very start of the fitting process, followed
+			/// by 3 items per stack level used for temporarily-created output
+			/// areas.
+		int TempOutAreas; ///< Index of the first output area item used for
+			/// temporarily-created output areas.
+		CBuffer< int > SortedOutAreas; ///< Indices of output areas available
+			/// on the current fitting step, sorted by ascending height. Areas
+			/// of equal height are kept in the order of their insertion.
+		CBuffer< int > SortedOutAreaHeights; ///< Heights of output areas in
+			/// the SortedOutAreas buffer, used for binary search.
+		CBuffer< int > SortedOutAreaWidths; ///< Widths of output areas in
+			/// the SortedOutAreas buffer, scanned for the output areas wide
+			/// enough for the current area.
+		int SortedOutAreaCount; ///< The number of items in the
+			/// SortedOutAreas buffer.
+		CBuffer< int > MinWidthCounts; ///< The number of unfitted areas of
+			/// each minimal width, indexed by CUnfittedArea :: MinWidthRank.
+		CBuffer< int > MinHeightCounts; ///< The number of unfitted areas of
+			/// each minimal height, indexed by
+			/// CUnfittedArea :: MinHeightRank.
+		CBuffer< COutImage > OutImages; ///< Details of the output images
+			/// created so far, including initially-provided output images.
+		int OutImageCount; ///< The number of output images in the OutImages
+			/// buffer.
+		TSize OutSize; ///< Summary cost of all output images so far, see
+			/// the getImageCost() function.
+		TSize WasteSize; ///< Summary size of the free space within the
+			/// current output image dimensions that was discarded, because
+			/// none of the remaining areas could fit into it.
+		TSize BestOutSize; ///< Best summary output image cost found so far.
+			/// May be equal to the global best cost found by another thread.
+		int BestOutImageCount; ///< Number of output images in the best fit.
+			/// May be equal to the global best image count found by another
+			/// thread.
+	};
+
+	int MaxOutImageWidth; ///< Maximal output image's width in pixels.
+	int MaxOutImageHeight; ///< Maximal output image's height in pixels.
+	TSize MaxOutImageSize; ///< Absolute maximum limit imposed on output
+		/// image size in pixels.
+	TSize MinOutSize; ///< Summary size of all areas, including the
+		/// alignment padding of the areas.
+	int OutImageAlign; ///< Granularity of output image dimensions.
+	bool DoPow2Size; ///< "True" if output image dimensions are powers of
+		/// two.
+	TSize ImageCost; ///< Cost of each non-empty output image.
+	TSize ImageDimCost; ///< Cost of the larger output image dimension.
+	CGlobals* Globals; ///< Pointer to global area fit search state shared
+		/// among all threads.
+	int FitCallsLeft; ///< The number of fitArea() function calls/recursions
+		/// left before the next slice of calls can be taken from the
+		/// Globals -> FitCallsLeft.
+	CFitStats Stats; ///< Statistics collected by *this fitter. The
+		/// FitCallCount value is increased by the whole slice of calls
+		/// taken, and is decreased by the calls left unused.
+	int AreaCount; ///< The number of areas to be fitted into the output
+		/// image(s). Also the index of the "initial" item of the list of
+		/// unfitted areas.
+	CFitData* fd; ///< The current state of the area fitting process.
+	CFitData FitData; ///< Fitting process state owned by *this fitter.
+
+	/**
+	 * Structure that holds details about the fitUnfittedAreas() function call
+	 * step, similarly to how a recursive stack would be organized. This
+	 * structre is used to "linearize" the fitUnfittedAreas() function so that
+	 * it does not depend on the stack storage.
+	 */
+
+	struct CFitAreaStackItem
+	{
+		int CodeLoc; ///< Index of code location where the execution should be
+			/// continued.
+		int Area; ///< Index of the fit area currently being evaluated, -1 if
+			/// no areas are left to evaluate.
+		int PrevArea; ///< Previous item in the list of unfitted areas.
+		int CandidateIndex; ///< Index of Area within the list of unfitted
+			/// areas of this level.
+		int NewOutAreas; ///< Index of the first of 3 output area items for
+			/// temporarily-created output image areas. Item at index 2 is
+			/// used when a new output image is created.
+		int NewOutAreaIndices[ 2 ]; ///< Positions of newly inserted areas
+			/// within the SortedOutAreas buffer.
+		int OutArea; ///< Output image area being checked.
+		int OutAreaIndex; ///< Position of OutArea within the SortedOutAreas
+			/// buffer.
+		int OutAreasTried; ///< The number of output image areas checked.
+		int OutAreaRemainRight; ///< Output image area remaining on the right
+			/// after placement of the fit area.
+		int OutAreaRemainBottom; ///< Output image area remaining on the
+			/// bottom after placement of the fit area.
+		bool WasOutImageAdded; ///< "True" if OutArea was created to contain
+			/// a new output image. If "true", OutArea's dimensions are big
+			/// enough to contain Area.
+		bool DoOutImageRestore; ///< "True" if output image's dimensions
+			/// should be restored.
+		COutImage OutImageSave; ///< Previous output image's dimensions.
+		TSize OutSizeSave; ///< Previous summary output images' size.
+		TSize WasteSizeSave; ///< Summary discarded free space size before
+			/// the new output areas were inserted.
+		int64_t Stamp; ///< Value unique to this visit of the stack level.
+			/// Size classes of areas passed at this level are marked with it
+			/// in the ClassStamps buffer.
+		int LevelMinWidthRank; ///< Rank of the minimal width among unfitted
+			/// areas of this level, including Area.
+		int LevelMinHeightRank; ///< Rank of the minimal height among
+			/// unfitted areas of this level, including Area.
+		int MinWidthRank; ///< Rank of the minimal width among remaining
+			/// unfitted areas.
+		int MinHeightRank; ///< Rank of the minimal height among remaining
+			/// unfitted areas.
+		int MinAreaWidth; ///< Minimal width among remaining unfitted areas.
+		int MinAreaHeight; ///< Minimal height among remaining unfitted areas.
+		int c; ///< Variable used to store the number of added temporary
+			/// areas.
+		int c1; ///< Same as "c", used for future reuse.
+		bool IsBranchPublished; ///< "True" if the configuration 2 branch of
+			/// this level's placement was published for stealing, see
+			/// CWorkSlot :: IsBranchFree.
+	};
+
+	/**
+	 * Structure that describes a single area placement on a search path.
+	 * A sequence of such steps is enough to reproduce the search state of
+	 * another thread, because the search is deterministic for the same
+	 * sorted list of areas.
+	 */
+
+	struct CPathStep
+	{
+		int AreaIndex; ///< Index of the placed area.
+		int OutAreaIndex; ///< Index of the output image area within the
+			/// list of output image areas, -1 if the area was placed into a
+			/// newly-created output image.
+		int CodeLoc; ///< Configuration of new output areas (2 or 3, as in
+			/// CFitAreaStackItem :: CodeLoc).
+		bool IsRotated; ///< "True" if the area was placed rotated.
+	};
+
+	static const int MaxStealDepth = 4; ///< The maximal stack depth at which
+		/// untried areas can be stolen by idle threads. The configuration 2
+		/// branch (CodeLoc 3) of the placement at the previous level can be
+		/// stolen as well, while the thread that made the placement searches
+		/// its configuration 1 branch.
+
+	/**
+	 * Structure that publishes untried areas of a single stack level to
+	 * other threads. Both the owning thread and stealing threads take areas
+	 * by incrementing the NextCandidate variable, so that each area of the
+	 * level is tried exactly once. The configuration 2 branch of the
+	 * placement that led to this level is taken by resetting the
+	 * IsBranchFree variable, either by a stealing thread, or by the owning
+	 * thread when it returns from the configuration 1 branch.
+	 */
+
+	struct CWorkSlot
+	{
+		CSyncSpinLock Sync; ///< Synchronizer of the IsActive and Path
+			/// variables.
+		bool IsActive; ///< "True" if the slot can be stolen from.
+		std :: atomic< int > NextCandidate; ///< Index of the next untried
+			/// area in the list of unfitted areas of this level.
+		int CandidateCount; ///< The number of unfitted areas at this level.
+		std :: atomic< bool > IsBranchFree; ///< "True" if the configuration
+			/// 2 branch of the last Path step was not taken yet. A stolen
+			/// branch is searched with all areas of this level.
+		CPathStep Path[ MaxStealDepth ]; ///< Steps leading to this level.
+	};
+
+	CBuffer< CFitAreaStackItem > Stack; ///< fitUnfittedAreas() function's
+		/// stack.
+	CBuffer< int64_t > ClassStamps; ///< Stamps of stack levels that passed
+		/// an area of a given size class, indexed by size class.
+	int64_t LastStamp; ///< The last stamp assigned to a stack level.
+	int Depth; ///< Current stack depth.
+	CFitAreaStackItem* s; ///< Current stack item.
+	int BaseDepth; ///< Stack depth of the current work item. Only a single
+		/// area at this depth is tried, unless IsBranchWork is "true", lower
+		/// depths belong to another thread's (or root) search.
+	bool IsBranchWork; ///< "True" if the current work item is a stolen
+		/// configuration 2 branch: all areas at the BaseDepth are tried.
+	int StealDepth; ///< The maximal stack depth which is published for
+		/// stealing, 0 if stealing is disabled.
+	int MinOutImageCount; ///< Starting number of output images.
+	const CBaseLayout* Base; ///< Layout of fixed areas the search starts
+		/// from, NULL if not used.
+	CWorkSlot WorkSlots[ MaxStealDepth + 1 ]; ///< Published stack levels,
+		/// indexed by stack depth. Item 0 is not used as root areas are
+		/// taken from the Globals -> NextRootArea pool.
+
+	/**
+	 * Function "pushes" stack in order to process the next set of unfitted
+	 * areas.
+	 */
+
+	void pushStack()
+	{
+		Depth++;
+		s = &Stack[ Depth ];
+		s -> Area = fd -> UnfittedAreas[ AreaCount ].Next;
+		LastStamp++;
+		s -> Stamp = LastStamp;
+
+		if( Depth > Stats.MaxDepth )
+		{
+			Stats.MaxDepth = Depth;
+		}
+
+		s -> PrevArea = AreaCount;
+		s -> CandidateIndex = 0;
+		s -> NewOutAreas = fd -> TempOutAreas + Depth * 3;
+
+		if( Depth == 0 )
+		{
+			s -> LevelMinWidthRank = findMinSizeRank( fd -> MinWidthCounts,
+				0 );
+
+			s -> LevelMinHeightRank = findMinSizeRank( fd -> MinHeightCounts,
+				0 );
+		}
+		else
+		{
+			// Unfitted areas of this level are the areas that remained
+			// after the placement at the previous level.
+
+			s -> LevelMinWidthRank = Stack[ Depth - 1 ].MinWidthRank;
+			s -> LevelMinHeightRank = Stack[ Depth - 1 ].MinHeightRank;
+		}
+
+		if( Depth <= StealDepth &&
+			( Depth > BaseDepth || ( Depth == BaseDepth && IsBranchWork )))
+		{
+			publishLevel();
+		}
+	}
+
+	/**
+	 * Function makes untried areas of the current stack level available for
+	 * stealing by other threads. The current area (with index 0) is taken by
+	 * *this thread. If the placement at the previous level uses the
+	 * configuration 1, its configuration 2 branch is published as well.
+	 */
+
+	void publishLevel()
+	{
+		CWorkSlot& ws = WorkSlots[ Depth ];
+		VOXSYNCSPIN( ws.Sync );
+		int i;
+
+		for( i = 0; i < Depth; i++ )
+		{
+			ws.Path[ i ].AreaIndex = Stack[ i ].Area;
+			ws.Path[ i ].OutAreaIndex = ( Stack[ i ].WasOutImageAdded ? -1 :
+				Stack[ i ].OutAreaIndex );
+
+			ws.Path[ i ].CodeLoc = Stack[ i ].CodeLoc;
+			ws.Path[ i ].IsRotated =
+				fd -> UnfittedAreas[ Stack[ i ].Area ].IsRotated;
+		}
+
+		ws.CandidateCount = AreaCount - Depth;
+		ws.NextCandidate = 1;
+		ws.IsBranchFree = ( Stack[ Depth - 1 ].CodeLoc == 2 );
+		Stack[ Depth - 1 ].IsBranchPublished = ws.IsBranchFree;
+		ws.IsActive = true;
+	}
+
+	/**
+	 * Function withdraws the specified stack level from stealing.
+	 *
+	 * @param Level Stack level to withdraw.
+	 */
+
+	void unpublishLevel( const int Level )
+	{
+		CWorkSlot& ws = WorkSlots[ Level ];
+		VOXSYNCSPIN( ws.Sync );
+		ws.IsActive = false;
+	}
+
+	/**
+	 * Function prepares *this fitter's own FitData object for the search
+	 * start: all areas become unfitted, and MinOutImageCount empty output
+	 * images are created, or the output images of the base layout are
+	 * used.
+	 *
+	 * @param aMinOutImageCount Starting number of output images.
+	 * @param aBase Layout of fixed areas the search starts from, NULL if
+	 * not used.
+	 */
+
+	void initFitData( const int aMinOutImageCount,
+		const CBaseLayout* const aBase )
+	{
+		MinOutImageCount = aMinOutImageCount;
+		Base = aBase;
+
+		int i;
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			FitData.UnfittedAreas[ i ].Next =
+				( i + 1 < AreaCount ? i + 1 : -1 );
+
+			if( FitData.UnfittedAreas[ i ].IsRotated )
+			{
+				rotateArea( i );
+			}
+		}
+
+		FitData.UnfittedAreas[ AreaCount ].Next = ( AreaCount > 0 ? 0 : -1 );
+
+		memset( FitData.MinWidthCounts, 0, AreaCount * sizeof( int ));
+		memset( FitData.MinHeightCounts, 0, AreaCount * sizeof( int ));
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			const CUnfittedArea& ua = FitData.UnfittedAreas[ i ];
+			FitData.MinWidthCounts[ ua.MinWidthRank ]++;
+			FitData.MinHeightCounts[ ua.MinHeightRank ]++;
+		}
+
+		FitData.OutSize = 0;
+		FitData.WasteSize = 0;
+		FitData.BestOutSize = std :: numeric_limits< TSize > :: max() - 1;
+		FitData.BestOutImageCount = 0x7FFFFFFF;
+		FitData.OutImageCount = ( Base == NULL ? MinOutImageCount :
+			Base -> OutImages.getItemCount() );
+
+		FitData.OutImages.updateCapacity( FitData.OutImageCount );
+
+		for( i = 0; i < FitData.OutImageCount; i++ )
+		{
+			if( Base == NULL )
+			{
+				FitData.OutImages[ i ].Width = 0;
+				FitData.OutImages[ i ].Height = 0;
+				FitData.OutImages[ i ].Size = 0;
+			}
+			else
+			{
+				const COutImage& OutImage = Base -> OutImages[ i ];
+				FitData.OutImages[ i ] = OutImage;
+				FitData.OutSize += getImageCost( OutImage.Width,
+					OutImage.Height );
+			}
+		}
+
+		FitData.TempOutAreas = ( Base == NULL ? FitData.OutImageCount :
+			Base -> OutAreas.getItemCount() );
+
+		const int OutAreaCount = FitData.TempOutAreas + AreaCount * 3;
+
+		if( FitData.OutAreas.getCapacity() < OutAreaCount )
+		{
+			FitData.OutAreas.alloc( OutAreaCount );
+			FitData.SortedOutAreas.alloc( OutAreaCount );
+			FitData.SortedOutAreaHeights.alloc( OutAreaCount );
+			FitData.SortedOutAreaWidths.alloc( OutAreaCount );
+		}
+
+		FitData.SortedOutAreaCount = 0;
+
+		if( Base != NULL )
+		{
+			for( i = 0; i < FitData.TempOutAreas; i++ )
+			{
+				FitData.OutAreas[ i ] = Base -> OutAreas[ i ];
+				insertOutArea( i );
+			}
+
+			return;
+		}
+
+		for( i = 0; i < FitData.OutImageCount; i++ )
+		{
+			COutArea& OutArea = FitData.OutAreas[ i ];
+			OutArea.OutImage = i;
+			OutArea.x = 0;
+			OutArea.y = 0;
+			OutArea.Width = ( FitData.OutImages[ i ].Width == 0 ?
+				MaxOutImageWidth : FitData.OutImages[ i ].Width );
+
+			OutArea.Height = ( FitData.OutImages[ i ].Height == 0 ?
+				MaxOutImageHeight : FitData.OutImages[ i ].Height );
+
+			FitData.SortedOutAreas[ i ] = i;
+			FitData.SortedOutAreaHeights[ i ] = OutArea.Height;
+			FitData.SortedOutAreaWidths[ i ] = OutArea.Width;
+			FitData.SortedOutAreaCount++;
+		}
+	}
+
+	/**
+	 * Function takes the next work item: either an untried area or a
+	 * configuration 2 branch stolen from a shallow stack level of another
+	 * thread, or a root area from the pool shared among all threads.
+	 * Function returns "false" if no work item is available at the moment.
+	 * On success, the stack is set up so that the fitUnfittedAreas()
+	 * function tries the taken area (or all areas, for a branch) at the
+	 * BaseDepth level, and the Globals -> ActiveFitters counter is
+	 * incremented.
+	 */
+
+	bool takeWork()
+	{
+		CPathStep Path[ MaxStealDepth ];
+		int Level;
+
+		// Steal from the shallowest levels first, as they contain the
+		// largest subtrees. At each level, a branch is preferred to a
+		// single area, as it includes all areas of the level. Stolen work is
+		// preferred to root areas, as it is closer to the sequential search
+		// order which tries the most promising areas first.
+
+		for( Level = 1; Level <= MaxStealDepth; Level++ )
+		{
+			int i;
+
+			for( i = 0; i < Globals -> FitterCount; i++ )
+			{
+				CAreaFitter* const Victim = Globals -> Fitters[ i ];
+
+				if( Victim == this || Level > Victim -> StealDepth )
+				{
+					continue;
+				}
+
+				CWorkSlot& ws = Victim -> WorkSlots[ Level ];
+				int Candidate = 0;
+				bool IsBranch = false;
+
+				{
+					VOXSYNCSPIN( ws.Sync );
+
+					if( !ws.IsActive )
+					{
+						continue;
+					}
+
+					if( ws.IsBranchFree && ws.IsBranchFree.exchange( false ))
+					{
+						IsBranch = true;
+					}
+					else
+					{
+						if( ws.NextCandidate >= ws.CandidateCount )
+						{
+							continue;
+						}
+
+						Candidate = ws.NextCandidate.fetch_add( 1 );
+
+						if( Candidate >= ws.CandidateCount )
+						{
+							continue;
+						}
+					}
+
+					// Increment the counter while the victim cannot
+					// finish its work item, so that idle threads do not
+					// observe a zero counter prematurely.
+
+					Globals -> ActiveFitters++;
+					memcpy( Path, ws.Path, Level * sizeof( Path[ 0 ]));
+				}
+
+				if( IsBranch )
+				{
+					Path[ Level - 1 ].CodeLoc = 3;
+				}
+
+				replayPath( Path, Level, Candidate, IsBranch );
+				return( true );
+			}
+		}
+
+		while( Globals -> NextRootArea < AreaCount )
+		{
+			Globals -> ActiveFitters++;
+			const int RootIndex = Globals -> NextRootArea.fetch_add(
+				Globals -> RootAreaStep );
+
+			if( RootIndex < AreaCount &&
+				fd -> UnfittedAreas[ RootIndex ].SizeClass == RootIndex )
+			{
+				// Areas equal to any of the preceeding areas are not
+				// taken as root areas.
+
+				resetState();
+				BaseDepth = 0;
+				IsBranchWork = false;
+				pushStack();
+
+				// At the root level all areas are present in the
+				// UnfittedAreas list in their original order.
+
+				s -> Area = RootIndex;
+				s -> PrevArea = ( RootIndex == 0 ? AreaCount :
+					RootIndex - 1 );
+
+				s -> CandidateIndex = RootIndex;
+
+				return( true );
+			}
+
+			Globals -> ActiveFitters--;
+		}
+
+		return( false );
+	}
+
+	/**
+	 * Function restores the initial search state: all areas become
+	 * unfitted, and output images become empty. The best fit found so far
+	 * is taken from the global search state.
+	 */
+
+	void resetState()
+	{
+		initFitData( MinOutImageCount, Base );
+		Depth = -1;
+
+		const TSize GlobalBestOutSize = Globals -> BestOutSize;
+
+		if( GlobalBestOutSize < fd -> BestOutSize )
+		{
+			fd -> BestOutSize = GlobalBestOutSize;
+			fd -> BestOutImageCount = Globals -> BestOutImageCount;
+		}
+	}
+
+	/**
+	 * Function reproduces the search state at the specified stack level by
+	 * repeating area placements of another thread, and makes the specified
+	 * unfitted area of that level current.
+	 *
+	 * @param Path Placement steps leading to the level.
+	 * @param Level Stack level to reproduce.
+	 * @param Candidate Index of the area to try at the level, within the
+	 * list of unfitted areas.
+	 * @param IsBranch "True" if the last step is a stolen configuration 2
+	 * branch: all areas of the level are tried, starting with the
+	 * Candidate. The conditions the owner checks before entering the
+	 * branch are checked here, and the work item is empty if they fail.
+	 */
+
+	void replayPath( const CPathStep* const Path, const int Level,
+		const int Candidate, const bool IsBranch )
+	{
+		resetState();
+		BaseDepth = Level;
+		IsBranchWork = IsBranch;
+		pushStack();
+
+		CUnfittedArea* const UnfittedAreas = fd -> UnfittedAreas;
+		COutArea* const OutAreas = fd -> OutAreas;
+		int i;
+
+		for( i = 0; i < Level; i++ )
+		{
+			const CPathStep& ps = Path[ i ];
+			const int Area = ps.AreaIndex;
+			int PrevArea = AreaCount;
+
+			while( UnfittedAreas[ PrevArea ].Next != Area )
+			{
+				PrevArea = UnfittedAreas[ PrevArea ].Next;
+			}
+
+			s -> Area = Area;
+			s -> PrevArea = PrevArea;
+			UnfittedAreas[ PrevArea ].Next = UnfittedAreas[ Area ].Next;
+
+			if( ps.IsRotated )
+			{
+				rotateArea( Area );
+			}
+
+			int OutArea;
+
+			if( ps.OutAreaIndex < 0 )
+			{
+				OutArea = addOutImageArea( Area );
+				s -> WasOutImageAdded = true;
+			}
+			else
+			{
+				s -> OutAreaIndex = ps.OutAreaIndex;
+				OutArea = fd -> SortedOutAreas[ s -> OutAreaIndex ];
+				s -> WasOutImageAdded = false;
+			}
+
+			const CUnfittedArea& ua = UnfittedAreas[ Area ];
+			const COutArea& oa = OutAreas[ OutArea ];
+			s -> OutArea = OutArea;
+			s -> OutAreaRemainRight = oa.Width - ua.Width;
+			s -> OutAreaRemainBottom = oa.Height - ua.Height;
+
+			COutImage& OutImage = fd -> OutImages[ oa.OutImage ];
+			const int NewWidth = oa.x + ua.Width;
+			const int NewHeight = oa.y + ua.Height;
+
+			if( NewWidth > OutImage.Width || NewHeight > OutImage.Height )
+			{
+				const TSize PrevCost = getImageCost( OutImage.Width,
+					OutImage.Height );
+
+				if( NewWidth > OutImage.Width )
+				{
+					OutImage.Width = alignOutImageDim( NewWidth );
+				}
+
+				if( NewHeight > OutImage.Height )
+				{
+					OutImage.Height = alignOutImageDim( NewHeight );
+				}
+
+				OutImage.Size = (TSize) OutImage.Width * OutImage.Height;
+				fd -> OutSize += getImageCost( OutImage.Width,
+					OutImage.Height ) - PrevCost;
+			}
+
+			setFittedArea( Area, OutArea );
+			updateMinAreaSize( Area );
+			removeOutArea( s -> OutAreaIndex );
+
+			if( IsBranch && i == Level - 1 )
+			{
+				// The configuration 1 split is only counted, like the
+				// owner does before entering the configuration 2 branch.
+
+				s -> c = insertSplitOutAreas( Area, OutArea, false );
+				s -> c1 = s -> c;
+				removeSplitOutAreas();
+				s -> c = insertSplitOutAreas( Area, OutArea, true );
+
+				if( s -> c + s -> c1 == 0 ||
+					fd -> OutSize >= fd -> BestOutSize ||
+					fd -> OutImageCount > fd -> BestOutImageCount ||
+					!checkLowerBound() )
+				{
+					// The level is not published, as the branch cannot
+					// improve the best fit.
+
+					IsBranchWork = false;
+				}
+			}
+			else
+			{
+				s -> c = insertSplitOutAreas( Area, OutArea,
+					ps.CodeLoc == 3 );
+
+				s -> c1 = s -> c;
+			}
+
+			s -> CodeLoc = ps.CodeLoc;
+			pushStack();
+		}
+
+		if( IsBranch && !IsBranchWork )
+		{
+			s -> Area = -1;
+			return;
+		}
+
+		s -> CandidateIndex = Candidate;
+
+		for( i = 0; i < Candidate; i++ )
+		{
+			ClassStamps[ UnfittedAreas[ s -> Area ].SizeClass ] = s -> Stamp;
+			s -> PrevArea = s -> Area;
+			s -> Area = UnfittedAreas[ s -> Area ].Next;
+		}
+
+		if( ClassStamps[ UnfittedAreas[ s -> Area ].SizeClass ] ==
+			s -> Stamp )
+		{
+			// An equal area is tried by the owner of the level.
+
+			s -> Area = -1;
+		}
+	}
+
+	/**
+	 * Thread function that performs area fit search via the specified fitter
+	 * object. The fitter takes work items until the root area pool is
+	 * exhausted and no other thread has untried areas left to steal.
+	 *
+	 * @param Fitter Fitter object to run.
+	 */
+
+	static void runFitter( CAreaFitter* const Fitter )
+	{
+		CGlobals* const Globals = Fitter -> Globals;
+
+		while( true )
+		{
+			if( !Fitter -> takeWork() )
+			{
+				if( Globals -> ActiveFitters == 0 ||
+					Globals -> FitCallsLeft == 0 )
+				{
+					break;
+				}
+
+				std :: this_thread :: yield();
+				continue;
+			}
+
+			Fitter -> fitUnfittedAreas();
+
+			int i;
+
+			for( i = Fitter -> BaseDepth; i <= Fitter -> StealDepth; i++ )
+			{
+				Fitter -> unpublishLevel( i );
+			}
+
+			Globals -> ActiveFitters--;
+
+			if(( Fitter -> FitCallsLeft == 0 &&
+				Globals -> FitCallsLeft == 0 ) || Globals -> IsStopped )
+			{
+				break;
+			}
+		}
+
+		Fitter -> Stats.FitCallCount -= Fitter -> FitCallsLeft;
+
+		if( Fitter -> FitCallsLeft > 0 && !Globals -> IsStopped )
+		{
+			Globals -> FitCallsLeft += Fitter -> FitCallsLeft;
+			Fitter -> FitCallsLeft = 0;
+		}
+	}
+
+	/**
+	 * Function sets placement of the specified area in the current fitting
+	 * state.
+	 *
+	 * @param Area Index of the area being placed.
+	 * @param OutArea Output image area the area is placed into.
+	 */
+
+	void setFittedArea( const int Area, const int OutArea )
+	{
+		const COutArea& oa = fd -> OutAreas[ OutArea ];
+		CFittedArea& fa = fd -> FittedAreas[ Area ];
+		fa.OutImage = oa.OutImage;
+		fa.OutX = oa.x;
+		fa.OutY = oa.y;
+		fa.IsRotated = fd -> UnfittedAreas[ Area ].IsRotated;
+	}
+
+	/**
+	 * Structure used to find areas of equal size.
+	 */
+
+	struct CSizeClassKey
+	{
+		int Width; ///< Width of the area.
+		int Height; ///< Height of the area.
+		int CanRotate; ///< Non-zero if the area can be rotated.
+		int Area; ///< Index of the area.
+	};
+
+	CBuffer< CSizeClassKey > SizeClassKeys; ///< Keys used by the
+		/// initSizeClasses() function, kept for reuse.
+	CBuffer< CSizeClassKey > SizeClassTemp; ///< Temporary buffer used to
+		/// sort the keys.
+
+	/**
+	 * Function assigns size classes to unfitted areas, so that areas of
+	 * equal dimensions and rotatability refer to the first of them.
+	 */
+
+	void initSizeClasses()
+	{
+		if( SizeClassKeys.getCapacity() < AreaCount )
+		{
+			SizeClassKeys.alloc( AreaCount );
+		}
+
+		CSizeClassKey* const Keys = SizeClassKeys;
+		int i;
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			const CUnfittedArea& ua = FitData.UnfittedAreas[ i ];
+			Keys[ i ].Width = ua.Width;
+			Keys[ i ].Height = ua.Height;
+			Keys[ i ].CanRotate = ua.CanRotate;
+			Keys[ i ].Area = i;
+			ClassStamps[ i ] = 0;
+		}
+
+		sortItems( Keys, AreaCount, SizeClassTemp, CSizeClassKeyLess() );
+		int SizeClass = 0;
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			const CSizeClassKey& k = Keys[ i ];
+
+			if( i == 0 || k.Width != Keys[ i - 1 ].Width ||
+				k.Height != Keys[ i - 1 ].Height ||
+				k.CanRotate != Keys[ i - 1 ].CanRotate )
+			{
+				SizeClass = k.Area;
+			}
+
+			FitData.UnfittedAreas[ k.Area ].SizeClass = SizeClass;
+		}
+	}
+
+	CBuffer< int > MinWidthValues; ///< Distinct minimal widths of areas, in
+		/// ascending order, indexed by CUnfittedArea :: MinWidthRank.
+	CBuffer< int > MinHeightValues; ///< Distinct minimal heights of areas,
+		/// in ascending order, indexed by CUnfittedArea :: MinHeightRank.
+	CBuffer< int > MinSizeTemp; ///< Temporary buffer used to sort minimal
+		/// widths and heights.
+
+	/**
+	 * Function collects distinct minimal widths or heights of areas, and
+	 * assigns their ranks to unfitted areas. Should be called before any
+	 * area is rotated: rotatable areas are then in the landscape
+	 * orientation, and their height is the minimal dimension.
+	 *
+	 * @param[out] Values Receives distinct values in ascending order.
+	 * @param IsWidth "True" if minimal widths are processed, "false" if
+	 * minimal heights.
+	 */
+
+	void initMinSizeRanks( CBuffer< int >& Values, const bool IsWidth )
+	{
+		CUnfittedArea* const UnfittedAreas = FitData.UnfittedAreas;
+		int i;
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			const CUnfittedArea& ua = UnfittedAreas[ i ];
+			Values[ i ] = ( IsWidth && !ua.CanRotate ? ua.Width :
+				ua.Height );
+		}
+
+		sortItems( (int*) Values, AreaCount, MinSizeTemp, CIntLess() );
+		int ValueCount = 0;
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			if( ValueCount == 0 || Values[ i ] != Values[ ValueCount - 1 ])
+			{
+				Values[ ValueCount ] = Values[ i ];
+				ValueCount++;
+			}
+		}
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			CUnfittedArea& ua = UnfittedAreas[ i ];
+			const int v = ( IsWidth && !ua.CanRotate ? ua.Width :
+				ua.Height );
+			int Lo = 0;
+			int Hi = ValueCount - 1;
+
+			while( Lo < Hi )
+			{
+				const int Mid = ( Lo + Hi ) >> 1;
+
+				if( Values[ Mid ] < v )
+				{
+					Lo = Mid + 1;
+				}
+				else
+				{
+					Hi = Mid;
+				}
+			}
+
+			( IsWidth ? ua.MinWidthRank : ua.MinHeightRank ) = Lo;
+		}
+	}
+
+	/**
+	 * Function rotates the specified unfitted area by 90 degrees by swapping
+	 * its width and height.
+	 *
+	 * @param Area Index of the area to rotate.
+	 */
+
+	void rotateArea( const int Area )
+	{
+		CUnfittedArea& ua = fd -> UnfittedAreas[ Area ];
+		const int w = ua.Width;
+		ua.Width = ua.Height;
+		ua.Height = w;
+		ua.IsRotated = !ua.IsRotated;
+	}
+
+	/**
+	 * Function saves the current fit as the global best fit, and passes it
+	 * to the observer. Should be called while the Globals -> StateSync is
+	 * acquired.
+	 */
+
+	void saveBestFit()
+	{
+		updateBestFitStats();
+		fd -> BestOutSize = fd -> OutSize;
+		fd -> BestOutImageCount = fd -> OutImageCount;
+
+		Globals -> BestOutSize = fd -> OutSize;
+		Globals -> BestOutImageCount = fd -> OutImageCount;
+
+		memcpy( Globals -> BestFittedAreas, fd -> FittedAreas,
+			AreaCount * sizeof( CFittedArea ));
+
+		Globals -> BestFitOutImageCount = fd -> OutImageCount;
+		Globals -> BestOutImages.updateCapacity( fd -> OutImageCount );
+		memcpy( Globals -> BestOutImages, fd -> OutImages,
+			fd -> OutImageCount * sizeof( COutImage ));
+
+		if( Globals -> Observer != NULL && !notifyObserver() )
+		{
+			Globals -> IsStopped = true;
+			Globals -> FitCallsLeft = 0;
+			Stats.FitCallCount -= FitCallsLeft;
+			FitCallsLeft = 0;
+		}
+	}
+
+	/**
+	 * Structure holds a horizontal segment of a "skyline": the upper
+	 * boundary of the areas placed into an output image by the greedy fit.
+	 */
+
+	struct CSkylineNode
+	{
+		int OutImage; ///< Output image index.
+		int x; ///< X offset of the segment.
+		int y; ///< Y offset of the segment, the height of the skyline.
+		int Width; ///< Width of the segment.
+	};
+
+	CArray< CSkylineNode > SkylineNodes; ///< Skyline segments used by the
+		/// seedGreedyFit() function, kept for reuse.
+	CArray< COutImage > SkylineLimits; ///< Output image limits used by the
+		/// seedGreedyFit() function, kept for reuse.
+
+	/**
+	 * Function finds a greedy fit of all areas, in their sorted order, via
+	 * a "skyline" algorithm, and saves it as the global best fit if it is
+	 * smaller. Each area is placed on top of the skyline where it increases
+	 * the summary output image size the least, preferring lower positions.
+	 * A new output image is created if the area cannot be placed into
+	 * existing output images. Should be called after the initFitData()
+	 * function, before the search is started.
+	 */
+
+	void seedGreedyFit()
+	{
+		CArray< CSkylineNode >& Skyline = SkylineNodes; // Skyline segments,
+			// sorted by output image and X offset. Segments of each output
+			// image cover its whole maximal width.
+		CArray< COutImage >& Limits = SkylineLimits; // Maximal dimensions of
+			// output images.
+		Skyline.clear();
+		Limits.clear();
+		int i;
+
+		for( i = 0; i < fd -> OutImageCount; i++ )
+		{
+			const COutArea& oa = fd -> OutAreas[ i ];
+			COutImage& l = Limits.add();
+			l.Width = oa.Width;
+			l.Height = oa.Height;
+
+			CSkylineNode& n = Skyline.add();
+			n.OutImage = i;
+			n.x = 0;
+			n.y = 0;
+			n.Width = oa.Width;
+		}
+
+		for( i = 0; i < AreaCount; i++ )
+		{
+			const CUnfittedArea& ua = fd -> UnfittedAreas[ i ];
+			int BestNode = -1;
+			int BestY = 0;
+			TSize BestCost = 0;
+			int BestTop = 0;
+			bool BestRotated = false;
+			int r;
+
+			for( r = 0; r < ( ua.CanRotate ? 2 : 1 ); r++ )
+			{
+				const int w = ( r == 0 ? ua.Width : ua.Height );
+				const int h = ( r == 0 ? ua.Height : ua.Width );
+				int k;
+
+				for( k = 0; k < Skyline.getItemCount(); k++ )
+				{
+					const CSkylineNode& n = Skyline[ k ];
+					const COutImage& l = Limits[ n.OutImage ];
+
+					if( n.x + w > l.Width )
+					{
+						continue;
+					}
+
+					int y = n.y;
+					int Covered = n.Width;
+					int j = k + 1;
+
+					while( Covered < w )
+					{
+						if( Skyline[ j ].y > y )
+						{
+							y = Skyline[ j ].y;
+						}
+
+						Covered += Skyline[ j ].Width;
+						j++;
+					}
+
+					if( y + h > l.Height )
+					{
+						continue;
+					}
+
+					const COutImage& OutImage = fd -> OutImages[ n.OutImage ];
+					const int NewWidth = ( n.x + w > OutImage.Width ?
+						alignOutImageDim( n.x + w ) : OutImage.Width );
+
+					const int NewHeight = ( y + h > OutImage.Height ?
+						alignOutImageDim( y + h ) : OutImage.Height );
+
+					const TSize NewSize = (TSize) NewWidth * NewHeight;
+
+					if( NewSize > MaxOutImageSize )
+					{
+						continue;
+					}
+
+					const TSize Cost = getImageCost( NewWidth, NewHeight ) -
+						getImageCost( OutImage.Width, OutImage.Height );
+
+					if( BestNode == -1 || Cost < BestCost ||
+						( Cost == BestCost && y + h < BestTop ))
+					{
+						BestNode = k;
+						BestY = y;
+						BestCost = Cost;
+						BestTop = y + h;
+						BestRotated = ( r != 0 );
+					}
+				}
+			}
+
+			if( BestNode == -1 )
+			{
+				const int m = fd -> OutImageCount;
+				fd -> OutImages.updateCapacity( m + 1 );
+				fd -> OutImages[ m ].Width = 0;
+				fd -> OutImages[ m ].Height = 0;
+				fd -> OutImages[ m ].Size = 0;
+				fd -> OutImageCount++;
+
+				COutImage& l = Limits.add();
+				l.Width = ( ua.Width > MaxOutImageWidth ?
+					ua.Width : MaxOutImageWidth );
+
+				l.Height = ( ua.Height > MaxOutImageHeight ?
+					ua.Height : MaxOutImageHeight );
+
+				CSkylineNode& n = Skyline.add();
+				n.OutImage = m;
+				n.x = 0;
+				n.y = 0;
+				n.Width = l.Width;
+
+				BestNode = Skyline.getItemCount() - 1;
+				BestY = 0;
+				BestRotated = false;
+			}
+
+			const int w = ( BestRotated ? ua.Height : ua.Width );
+			const int h = ( BestRotated ? ua.Width : ua.Height );
+			const int m = Skyline[ BestNode ].OutImage;
+			const int x = Skyline[ BestNode ].x;
+
+			CFittedArea& fa = fd -> FittedAreas[ i ];
+			fa.OutImage = m;
+			fa.OutX = x;
+			fa.OutY = BestY;
+			fa.IsRotated = BestRotated;
+
+			COutImage& OutImage = fd -> OutImages[ m ];
+			fd -> OutSize -= getImageCost( OutImage.Width, OutImage.Height );
+
+			if( x + w > OutImage.Width )
+			{
+				OutImage.Width = alignOutImageDim( x + w );
+			}
+
+			if( BestY + h > OutImage.Height )
+			{
+				OutImage.Height = alignOutImageDim( BestY + h );
+			}
+
+			OutImage.Size = (TSize) OutImage.Width * OutImage.Height;
+			fd -> OutSize += getImageCost( OutImage.Width, OutImage.Height );
+
+			if( w > 0 )
+			{
+				raiseSkyline( Skyline, BestNode, w, BestY + h );
+			}
+		}
+
+		VOXSYNCSPIN( Globals -> StateSync );
+
+		if( fd -> OutSize < Globals -> BestOutSize )
+		{
+			saveBestFit();
+		}
+	}
+
+	/**
+	 * Function raises the skyline over the placed area.
+	 *
+	 * @param Skyline Skyline segments.
+	 * @param Node Index of the segment the area was placed at.
+	 * @param Width Width of the area, greater than 0.
+	 * @param Top New height of the skyline over the area.
+	 */
+
+	static void raiseSkyline( CArray< CSkylineNode >& Skyline, int Node,
+		const int Width, const int Top )
+	{
+		const CSkylineNode Start = Skyline[ Node ];
+		int Remain = Width;
+		int j = Node;
+
+		while( Remain > 0 )
+		{
+			CSkylineNode& n = Skyline[ j ];
+
+			if( n.Width <= Remain )
+			{
+				Remain -= n.Width;
+				Skyline.erase( j );
+			}
+			else
+			{
+				n.x += Remain;
+				n.Width -= Remain;
+				Remain = 0;
+			}
+		}
+
+		if( Node > 0 && Skyline[ Node - 1 ].OutImage == Start.OutImage &&
+			Skyline[ Node - 1 ].y == Top )
+		{
+			// Merge with the preceeding segment of the same height.
+
+			Node--;
+			Skyline[ Node ].Width += Width;
+		}
+		else
+		{
+			CSkylineNode& n = Skyline.insert( Node );
+			n.OutImage = Start.OutImage;
+			n.x = Start.x;
+			n.y = Top;
+			n.Width = Width;
+		}
+
+		if( Node + 1 < Skyline.getItemCount() &&
+			Skyline[ Node + 1 ].OutImage == Start.OutImage &&
+			Skyline[ Node + 1 ].y == Top )
+		{
+			Skyline[ Node ].Width += Skyline[ Node + 1 ].Width;
+			Skyline.erase( Node + 1 );
+		}
+	}
+
+	/**
+	 * Function updates best fit improvement statistics when a new global
+	 * best fit is found. Should be called while the Globals -> StateSync is
+	 * acquired.
+	 */
+
+	void updateBestFitStats()
+	{
+		CFitStats& gs = Globals -> Stats;
+		gs.LastBestFitTime = std :: chrono :: duration< double >(
+			std :: chrono :: steady_clock :: now() -
+			Globals -> StartTime ).count();
+
+		if( gs.BestFitCount == 0 )
+		{
+			gs.FirstBestFitTime = gs.LastBestFitTime;
+		}
+
+		gs.BestFitCount++;
+		gs.BestFitCallCount = Globals -> FitCallsLimit -
+			Globals -> FitCallsLeft - FitCallsLeft;
+	}
+
+	/**
+	 * Function passes the global best fit to the observer. Function returns
+	 * the value returned by the observer. Should be called while the
+	 * Globals -> StateSync is acquired.
+	 */
+
+	bool notifyObserver()
+	{
+		getBestFit( *Globals, Globals -> ObserverAreas,
+			Globals -> ObserverOutImages );
+
+		return( Globals -> Observer -> onBestFit( Globals -> ObserverAreas,
+			Globals -> ObserverOutImages,
+			getBestFitQuality( *Globals )));
+	}
+
+	/**
+	 * Function returns "true" if the search should be stopped due to the
+	 * deadline, the cancel flag, or by the observer.
+	 */
+
+	bool isStopRequested() const
+	{
+		if( Globals -> IsStopped )
+		{
+			return( true );
+		}
+
+		if( Globals -> CancelFlag != NULL && *Globals -> CancelFlag )
+		{
+			return( true );
+		}
+
+		return( Globals -> HasDeadline &&
+			std :: chrono :: steady_clock :: now() >= Globals -> Deadline );
+	}
+
+	/**
+	 * Function creates a new output image, and inserts an output image area
+	 * that covers the whole new image and is large enough to contain the
+	 * specified area. Function returns the created output image area.
+	 *
+	 * @param Area Index of the area the output image is created for.
+	 */
+
+	int addOutImageArea( const int Area )
+	{
+		const CUnfittedArea& ua = fd -> UnfittedAreas[ Area ];
+		const int OutArea = s -> NewOutAreas + 2;
+		COutArea& oa = fd -> OutAreas[ OutArea ];
+		oa.x = 0;
+		oa.y = 0;
+		oa.Width = ( ua.Width > MaxOutImageWidth ?
+			ua.Width : MaxOutImageWidth );
+
+		oa.Height = ( ua.Height > MaxOutImageHeight ?
+			ua.Height : MaxOutImageHeight );
+
+		s -> OutAreaIndex = insertOutArea( OutArea );
+
+		oa.OutImage = fd -> OutImageCount;
+		fd -> OutImages.updateCapacity( fd -> OutImageCount + 1 );
+		fd -> OutImages[ fd -> OutImageCount ].Width = 0;
+		fd -> OutImages[ fd -> OutImageCount ].Height = 0;
+		fd -> OutImages[ fd -> OutImageCount ].Size = 0;
+		fd -> OutImageCount++;
+		Stats.NewOutImageCount++;
+
+		return( OutArea );
+	}
+
+	/**
+	 * Function returns the rank of the minimal width or height among
+	 * unfitted areas: the first rank with a non-zero count, starting at the
+	 * specified rank. Such rank should exist.
+	 *
+	 * @param Counts Counts of unfitted areas of each rank.
+	 * @param Rank Rank to start at, not above the minimal one.
+	 */
+
+	static int findMinSizeRank( const int* const Counts, int Rank )
+	{
+		while( Counts[ Rank ] == 0 )
+		{
+			Rank++;
+		}
+
+		return( Rank );
+	}
+
+	/**
+	 * Function obtains minimal width and height among remaining unfitted
+	 * areas, and stores them in the current stack item. The placed area is
+	 * removed from the counts of unfitted areas of each minimal width and
+	 * height, and should be returned to them via the
+	 * restoreMinAreaSizeCounts() function when the placement is undone. The
+	 * remaining areas are a subset of this level's areas, so the ranks are
+	 * searched from the level's minimal ranks on: the search stops at once
+	 * if any remaining area shares the level's minimum, and otherwise only
+	 * passes ranks whose areas were all placed. The list of unfitted areas
+	 * should not be empty.
+	 *
+	 * @param Area Index of the placed area.
+	 */
+
+	void updateMinAreaSize( const int Area )
+	{
+		const CUnfittedArea& ua = fd -> UnfittedAreas[ Area ];
+		fd -> MinWidthCounts[ ua.MinWidthRank ]--;
+		fd -> MinHeightCounts[ ua.MinHeightRank ]--;
+
+		s -> MinWidthRank = findMinSizeRank( fd -> MinWidthCounts,
+			s -> LevelMinWidthRank );
+
+		s -> MinHeightRank = findMinSizeRank( fd -> MinHeightCounts,
+			s -> LevelMinHeightRank );
+
+		s -> MinAreaWidth = MinWidthValues[ s -> MinWidthRank ];
+		s -> MinAreaHeight = MinHeightValues[ s -> MinHeightRank ];
+	}
+
+	/**
+	 * Function returns an area to the counts of unfitted areas of each
+	 * minimal width and height, undoing the updateMinAreaSize() function.
+	 *
+	 * @param Area Index of the area whose placement is undone.
+	 */
+
+	void restoreMinAreaSizeCounts( const int Area )
+	{
+		const CUnfittedArea& ua = fd -> UnfittedAreas[ Area ];
+		fd -> MinWidthCounts[ ua.MinWidthRank ]++;
+		fd -> MinHeightCounts[ ua.MinHeightRank ]++;
+	}
+
+	/**
+	 * Function divides the output image area remaining after placement of
+	 * the fit area into two new output areas, and inserts them into the list
+	 * of output areas. Areas that cannot contain any of the remaining
+	 * unfitted areas are not inserted. Function returns the number of
+	 * inserted areas.
+	 *
+	 * In configuration 1 the right area spans the whole height of the output
+	 * area, and the bottom area has the width of the fit area. In
+	 * configuration 2 the right area has the height of the fit area, and the
+	 * bottom area spans the whole width of the output area.
+	 *
+	 * The part of a non-inserted area that lies within the current output
+	 * image dimensions is added to the WasteSize, because it can never be
+	 * occupied, but it will be included into the final output image size.
+	 *
+	 * @param Area Index of the fitted area.
+	 * @param OutArea Output image area the area was placed into.
+	 * @param IsConfig2 "True" if configuration 2 should be used.
+	 */
+
+	int insertSplitOutAreas( const int Area, const int OutArea,
+		const bool IsConfig2 )
+	{
+		const CUnfittedArea& ua = fd -> UnfittedAreas[ Area ];
+		const COutArea& oa = fd -> OutAreas[ OutArea ];
+		const int RightHeight = ( IsConfig2 ? ua.Height : oa.Height );
+		const int BottomWidth = ( IsConfig2 ? oa.Width : ua.Width );
+		int c = 0;
+		s -> WasteSizeSave = fd -> WasteSize;
+
+		if( s -> OutAreaRemainRight < s -> MinAreaWidth ||
+			RightHeight < s -> MinAreaHeight )
+		{
+			addWaste( oa.OutImage, oa.x + ua.Width, oa.y,
+				s -> OutAreaRemainRight, RightHeight );
+		}
+		else
+		{
+			const int NewOutArea = s -> NewOutAreas;
+			COutArea& noa = fd -> OutAreas[ NewOutArea ];
+			noa.OutImage = oa.OutImage;
+			noa.x = oa.x + ua.Width;
+			noa.y = oa.y;
+			noa.Width = s -> OutAreaRemainRight;
+			noa.Height = RightHeight;
+			s -> NewOutAreaIndices[ 0 ] = insertOutArea( NewOutArea );
+
+			c = 1;
+		}
+
+		if( BottomWidth < s -> MinAreaWidth ||
+			s -> OutAreaRemainBottom < s -> MinAreaHeight )
+		{
+			addWaste( oa.OutImage, oa.x, oa.y + ua.Height, BottomWidth,
+				s -> OutAreaRemainBottom );
+		}
+		else
+		{
+			const int NewOutArea = s -> NewOutAreas + 1;
+			COutArea& noa = fd -> OutAreas[ NewOutArea ];
+			noa.OutImage = oa.OutImage;
+			noa.x = oa.x;
+			noa.y = oa.y + ua.Height;
+			noa.Width = BottomWidth;
+			noa.Height = s -> OutAreaRemainBottom;
+			s -> NewOutAreaIndices[ c ] = insertOutArea( NewOutArea );
+
+			c++;
+		}
+
+		return( c );
+	}
+
+	/**
+	 * Function removes output areas previously inserted by the
+	 * insertSplitOutAreas() function, from the current stack item.
+	 */
+
+	void removeSplitOutAreas()
+	{
+		while( s -> c > 0 )
+		{
+			s -> c--;
+			removeOutArea( s -> NewOutAreaIndices[ s -> c ]);
+		}
+
+		fd -> WasteSize = s -> WasteSizeSave;
+	}
+
+	/**
+	 * Function adds the part of the discarded free area that lies within
+	 * the current dimensions of the output image to the WasteSize.
+	 *
+	 * @param OutImage Output image index.
+	 * @param x X offset of the area.
+	 * @param y Y offset of the area.
+	 * @param Width Width of the area.
+	 * @param Height Height of the area.
+	 */
+
+	void addWaste( const int OutImage, const int x, const int y,
+		const int Width, const int Height )
+	{
+		const COutImage& oi = fd -> OutImages[ OutImage ];
+		const int w = ( x + Width < oi.Width ? x + Width : oi.Width ) - x;
+		const int h = ( y + Height < oi.Height ? y + Height : oi.Height ) - y;
+
+		if( w > 0 && h > 0 )
+		{
+			fd -> WasteSize += (TSize) w * h;
+		}
+	}
+
+	/**
+	 * Function returns "true" if the lower bound of the final summary
+	 * output image cost is lesser than the best cost found so far, and the
+	 * search should continue with the remaining areas. Since placed areas
+	 * and discarded free space do not overlap and lie within the output
+	 * images, the final size cannot be lesser than the summary size of all
+	 * areas plus the WasteSize. The cost beyond the size cannot be lesser
+	 * than that of the current output images, as they only grow.
+	 */
+
+	bool checkLowerBound()
+	{
+		TSize Bound = MinOutSize + fd -> WasteSize;
+
+		if( ImageCost != 0 || ImageDimCost != 0 )
+		{
+			Bound += fd -> OutSize;
+			int i;
+
+			for( i = 0; i < fd -> OutImageCount; i++ )
+			{
+				Bound -= fd -> OutImages[ i ].Size;
+			}
+		}
+
+		if( Bound < fd -> BestOutSize )
+		{
+			return( true );
+		}
+
+		Stats.LowerBoundPruneCount++;
+		return( false );
+	}
+
+	/**
+	 * Function that iterates through all available output image areas where
+	 * the unfitted areas could be fitted, recursively calling the same
+	 * function for the remaining areas.
+	 *
+	 * The available output image area where the area was placed is
+	 * temporarily divided into two parts and the algorithm is executed again
+	 * for the remaining areas.
+	 */
+
+	void fitUnfittedAreas()
+	{
+		CUnfittedArea* const UnfittedAreas = fd -> UnfittedAreas;
+		COutArea* const OutAreas = fd -> OutAreas;
+		int Area;
+		int AreaWidth;
+		int AreaHeight;
+		int OutArea;
+
+	CodeLoc1:
+		while( s -> Area != -1 )
+		{
+			if( fd -> OutSize >= fd -> BestOutSize ||
+				fd -> OutImageCount > fd -> BestOutImageCount )
+			{
+				break;
+			}
+
+			if( FitCallsLeft == 0 )
+			{
+				// Compare *this thread's BestFitCount and
+				// BestFitOutImageCount to the global best.
+
+				const TSize GlobalBestOutSize = Globals -> BestOutSize;
+				const int GlobalBestOutImageCount =
+					Globals -> BestOutImageCount;
+
+				if( fd -> BestOutSize > GlobalBestOutSize ||
+					fd -> BestOutImageCount > GlobalBestOutImageCount )
+				{
+					// Another thread found a better fit, re-evaluate the
+					// current area against it.
+
+					fd -> BestOutSize = GlobalBestOutSize;
+					fd -> BestOutImageCount = GlobalBestOutImageCount;
+
+					continue;
+				}
+
+				if( isStopRequested() )
+				{
+					// Stop all threads by taking all calls that are left.
+
+					Globals -> IsStopped = true;
+					Globals -> FitCallsLeft = 0;
+					return;
+				}
+
+				// Take the next slice of calls without locking.
+
+				int CallsLeft = Globals -> FitCallsLeft;
+
+				while( true )
+				{
+					if( CallsLeft == 0 )
+					{
+						return;
+					}
+
+					const int Slice = ( CallsLeft >= 512 ? 512 : CallsLeft );
+
+					if( Globals -> FitCallsLeft.compare_exchange_weak(
+						CallsLeft, CallsLeft - Slice ))
+					{
+						FitCallsLeft = Slice;
+						Stats.FitCallCount += Slice;
+						break;
+					}
+				}
+			}
+
+			FitCallsLeft--;
+			Area = s -> Area;
+			ClassStamps[ UnfittedAreas[ Area ].SizeClass ] = s -> Stamp;
+			UnfittedAreas[ s -> PrevArea ].Next = UnfittedAreas[ Area ].Next;
+			s -> OutAreasTried = 0;
+
+		RotatedLoc:
+			AreaWidth = UnfittedAreas[ Area ].Width;
+			AreaHeight = UnfittedAreas[ Area ].Height;
+
+			// Output areas lower than the current area are skipped.
+
+			s -> OutAreaIndex = findOutAreaIndex( AreaHeight );
+
+			while( true )
+			{
+				// Output areas narrower than the current area are skipped.
+
+				s -> OutAreaIndex = findWideOutAreaIndex( s -> OutAreaIndex,
+					AreaWidth );
+
+				if( s -> OutAreaIndex == fd -> SortedOutAreaCount )
+				{
+					if( s -> OutAreasTried > 0 )
+					{
+						break;
+					}
+
+					if( fd -> OutImageCount == fd -> BestOutImageCount )
+					{
+						break;
+					}
+
+					OutArea = addOutImageArea( Area );
+					s -> WasOutImageAdded = true;
+				}
+				else
+				{
+					OutArea = fd -> SortedOutAreas[ s -> OutAreaIndex ];
+					s -> WasOutImageAdded = false;
+				}
+
+				s -> OutArea = OutArea;
+				s -> OutAreaRemainRight =
+					OutAreas[ OutArea ].Width - AreaWidth;
+
+				s -> OutAreaRemainBottom =
+					OutAreas[ OutArea ].Height - AreaHeight;
+
+				if( s -> OutAreaRemainRight < 0 ||
+					s -> OutAreaRemainBottom < 0 )
+				{
+					s -> OutAreaIndex++;
+					continue;
+				}
+
+				if( checkAreaFitAgainstBest(
+					OutAreas[ OutArea ].x + AreaWidth,
+					OutAreas[ OutArea ].y + AreaHeight,
+					fd -> OutImages[ OutAreas[ OutArea ].OutImage ],
+					s -> DoOutImageRestore, s -> OutImageSave,
+					s -> OutSizeSave, s -> OutAreasTried ))
+				{
+					setFittedArea( Area, OutArea );
+
+					if( UnfittedAreas[ AreaCount ].Next == -1 )
+					{
+						// All areas were fitted and the best OutSize was
+						// found so far. Save the best fit areas and out
+						// images.
+
+						VOXSYNCSPIN( Globals -> StateSync );
+
+						if( fd -> OutSize < Globals -> BestOutSize &&
+							fd -> OutImageCount <=
+							Globals -> BestOutImageCount &&
+							!Globals -> IsStopped )
+						{
+							saveBestFit();
+						}
+						else
+						{
+							fd -> BestOutSize = Globals -> BestOutSize;
 							fd -> BestOutImageCount =
 								Globals -> BestOutImageCount;
 						}
 					}
-					else
+					else
+					{
+						updateMinAreaSize( Area );
+
+						// Remove the output area occupied by the current area
+						// temporarily.
+
+						removeOutArea( s -> OutAreaIndex );
+
+						// Try to fit remaining areas with new out areas put
+						// in configuration 1.
+
+						s -> c = insertSplitOutAreas( Area, OutArea, false );
+						s -> c1 = s -> c;
+						s -> IsBranchPublished = false;
+
+						if( checkLowerBound() )
+						{
+							s -> CodeLoc = 2;
+							pushStack();
+							goto CodeLoc1;
+						}
+
+					CodeLoc2:
+						removeSplitOutAreas();
+
+						// Try to fit remaining areas with new out areas put
+						// in configuration 2, unless this branch was
+						// published and taken by another thread.
+
+						if( fd -> OutSize < fd -> BestOutSize &&
+							fd -> OutImageCount <= fd -> BestOutImageCount &&
+							( !s -> IsBranchPublished ||
+							WorkSlots[ Depth + 1 ].IsBranchFree.exchange(
+							false )))
+						{
+							s -> c = insertSplitOutAreas( Area, OutArea,
+								true );
+
+							if( s -> c + s -> c1 > 0 && checkLowerBound() )
+							{
+								s -> CodeLoc = 3;
+								pushStack();
+								goto CodeLoc1;
+							}
+
+						CodeLoc3:
+							removeSplitOutAreas();
+						}
+
+						// Restore output area occupied by the current Area.
+
+						restoreMinAreaSizeCounts( Area );
+						restoreOutArea( s -> OutAreaIndex, OutArea );
+					}
+
+					if( s -> DoOutImageRestore )
+					{
+						fd -> OutImages[ OutAreas[ OutArea ].OutImage ] =
+							s -> OutImageSave;
+
+						fd -> OutSize = s -> OutSizeSave;
+					}
+				}
+
+				if( s -> WasOutImageAdded )
+				{
+					removeOutArea( s -> OutAreaIndex );
+					fd -> OutImageCount--;
+					break;
+				}
+
+				if( fd -> OutSize >= fd -> BestOutSize ||
+					fd -> OutImageCount > fd -> BestOutImageCount )
+				{
+					break;
+				}
+
+				s -> OutAreaIndex++;
+			}
+
+			if( UnfittedAreas[ Area ].CanRotate )
+			{
+				// Try the rotated orientation after the initial one. A new
+				// output image is only created for the rotated orientation
+				// if the initial one did not fit anywhere.
+
+				rotateArea( Area );
+
+				if( UnfittedAreas[ Area ].IsRotated &&
+					fd -> OutSize < fd -> BestOutSize &&
+					fd -> OutImageCount <= fd -> BestOutImageCount )
+				{
+					goto RotatedLoc;
+				}
+
+				if( UnfittedAreas[ Area ].IsRotated )
+				{
+					rotateArea( Area );
+				}
+			}
+
+			UnfittedAreas[ s -> PrevArea ].Next = Area;
+
+			if( Depth == BaseDepth && !IsBranchWork )
+			{
+				// Only a single area is tried at the work item's level,
+				// unless the work item is a branch.
+
+				s -> Area = -1;
+			}
+			else
+			if( Depth <= StealDepth )
+			{
+				// Take the next untried area, skipping areas taken by other
+				// threads, and areas equal to the passed ones.
+
+				do
+				{
+					const int NextCandidate =
+						WorkSlots[ Depth ].NextCandidate.fetch_add( 1 );
+
+					while( s -> CandidateIndex < NextCandidate &&
+						s -> Area != -1 )
+					{
+						ClassStamps[ UnfittedAreas[ s -> Area ].SizeClass ] =
+							s -> Stamp;
+
+						s -> PrevArea = s -> Area;
+						s -> Area = UnfittedAreas[ s -> Area ].Next;
+						s -> CandidateIndex++;
+					}
+				} while( s -> Area != -1 && ClassStamps[
+					UnfittedAreas[ s -> Area ].SizeClass ] == s -> Stamp );
+			}
+			else
+			{
+				// Take the next area, skipping areas equal to the tried
+				// ones.
+
+				s -> PrevArea = Area;
+				s -> Area = UnfittedAreas[ Area ].Next;
+
+				while( s -> Area != -1 && ClassStamps[
+					UnfittedAreas[ s -> Area ].SizeClass ] == s -> Stamp )
+				{
+					s -> PrevArea = s -> Area;
+					s -> Area = UnfittedAreas[ s -> Area ].Next;
+				}
+			}
+		}
+
+		if( Depth > BaseDepth )
+		{
+			if( Depth <= StealDepth )
+			{
+				unpublishLevel( Depth );
+			}
+
+			Depth--;
+			s = &Stack[ Depth ];
+			Area = s -> Area;
+			AreaWidth = UnfittedAreas[ Area ].Width;
+			AreaHeight = UnfittedAreas[ Area ].Height;
+			OutArea = s -> OutArea;
+
+			if( s -> CodeLoc == 2 )
+			{
+				goto CodeLoc2;
+			}
+			else
+			{
+				goto CodeLoc3;
+			}
+		}
+	}
+
+	/**
+	 * @return Output image dimension rounded up according to the
+	 * CFitParams :: OutImageAlign and DoPow2Size parameters.
+	 *
+	 * @param v Output image dimension, in pixels.
+	 */
+
+	int alignOutImageDim( const int v ) const
+	{
+		return( alignDim( v, OutImageAlign, DoPow2Size ));
+	}
+
+	/**
+	 * @return Cost of an output image, see CFitParams :: ImageCost.
+	 *
+	 * @param w Output image width, in pixels.
+	 * @param h Output image height, in pixels.
+	 */
+
+	TSize getImageCost( const int w, const int h ) const
+	{
+		return( getImageCost( w, h, ImageCost, ImageDimCost ));
+	}
+
+	/**
+	 * Function checks if a newly added area when fitted into the output image
+	 * produces overall output image size lesser than BestOutSize.
+	 *
+	 * @param NewWidth New possible width of the output image when the areas
+	 * is placed.
+	 * @param NewHeight New possible height of the output image when the areas
+	 * is placed.
+	 * @param OutImage Current output image's dimensions.
+	 * @param DoOutImageRestore "True" if output image dimensions should be
+	 * restored. This value is valid only if this function returned "true".
+	 * @param OutImageSave Saved output image dimensions.
+	 * @param OutSizeSave Saved summary size of all output images.
+	 * @param OutAreasTried This variable is incremented if the supplied area
+	 * should be marked as "tried" to be fitted. This variable is not
+	 * incremented if the supplied area increases output image's size beyond
+	 * MaxOutImageSize.
+	 */
+
+	bool checkAreaFitAgainstBest( int NewWidth, int NewHeight,
+		COutImage& OutImage, bool& DoOutImageRestore, COutImage& OutImageSave,
+		TSize& OutSizeSave, int& OutAreasTried )
+	{
+		bool DoUpdateSize;
+
+		if( NewWidth > OutImage.Width )
+		{
+			DoUpdateSize = true;
+			NewWidth = alignOutImageDim( NewWidth );
+		}
+		else
+		{
+			DoUpdateSize = false;
+			NewWidth = OutImage.Width;
+		}
+
+		if( NewHeight > OutImage.Height )
+		{
+			DoUpdateSize = true;
+			NewHeight = alignOutImageDim( NewHeight );
+		}
+		else
+		{
+			NewHeight = OutImage.Height;
+		}
+
+		if( DoUpdateSize )
+		{
+			const TSize NewSize = (TSize) NewWidth * NewHeight;
+			const TSize NewOutSize = fd -> OutSize +
+				getImageCost( NewWidth, NewHeight ) -
+				getImageCost( OutImage.Width, OutImage.Height );
+
+			if( NewSize > MaxOutImageSize )
+			{
+				Stats.MaxOutImageSizePruneCount++;
+				return( false );
+			}
+
+			if( NewOutSize >= fd -> BestOutSize )
+			{
+				Stats.BestOutSizePruneCount++;
+				OutAreasTried++;
+				return( false );
+			}
+
+			OutImageSave = OutImage;
+			OutSizeSave = fd -> OutSize;
+
+			OutImage.Width = NewWidth;
+			OutImage.Height = NewHeight;
+			OutImage.Size = NewSize;
+			fd -> OutSize = NewOutSize;
+
+			DoOutImageRestore = true;
+		}
+		else
+		{
+			DoOutImageRestore = false;
+		}
+
+		OutAreasTried++;
+		return( true );
+	}
+
+	/**
+	 * Function returns the position of the first output area in the
+	 * SortedOutAreas buffer which is not lower than the specified height.
+	 * Function returns SortedOutAreaCount if there is no such area. Binary
+	 * search is used to narrow the range down to a few areas, which are
+	 * then scanned sequentially.
+	 *
+	 * @param Height Minimal height of the output area.
+	 */
+
+	int findOutAreaIndex( const int Height ) const
+	{
+		const int* const Heights = fd -> SortedOutAreaHeights;
+		int Lo = 0;
+		int Hi = fd -> SortedOutAreaCount;
+
+		while( Hi - Lo > 8 )
+		{
+			const int Mid = ( Lo + Hi ) >> 1;
+
+			if( Heights[ Mid ] < Height )
+			{
+				Lo = Mid + 1;
+			}
+			else
+			{
+				Hi = Mid;
+			}
+		}
+
+		while( Lo < Hi && Heights[ Lo ] < Height )
+		{
+			Lo++;
+		}
+
+		return( Lo );
+	}
+
+	/**
+	 * Function returns the position of the first output area in the
+	 * SortedOutAreas buffer, starting at the specified position, which is
+	 * not narrower than the specified width. Function returns
+	 * SortedOutAreaCount if there is no such area. With SSE2, the widths
+	 * are compared 8 at a time. Only the width is scanned: the caller checks
+	 * the height and the BestOutSize bound of the returned area one area at
+	 * a time, and the SSE2 kernel does not return a mask of fitting areas.
+	 *
+	 * @param Index Position to start the scan at.
+	 * @param Width Minimal width of the output area.
+	 */
+
+	int findWideOutAreaIndex( int Index, const int Width ) const
+	{
+		const int* const Widths = fd -> SortedOutAreaWidths;
+		const int Count = fd -> SortedOutAreaCount;
+
+	#if AREAFIT_SSE2
+		const __m128i w = _mm_set1_epi32( Width );
+
+		while( Index + 8 <= Count )
+		{
+			const __m128i Narrow1 = _mm_cmplt_epi32( _mm_loadu_si128(
+				(const __m128i*) ( Widths + Index )), w );
+
+			const __m128i Narrow2 = _mm_cmplt_epi32( _mm_loadu_si128(
+				(const __m128i*) ( Widths + Index + 4 )), w );
+
+			if( _mm_movemask_epi8( _mm_and_si128( Narrow1, Narrow2 )) !=
+				0xFFFF )
+			{
+				break;
+			}
+
+			Index += 8;
+		}
+	#endif // AREAFIT_SSE2
+
+		while( Index < Count && Widths[ Index ] < Width )
+		{
+			Index++;
+		}
+
+		return( Index );
+	}
+
+	/**
+	 * Function inserts an output image area into the SortedOutAreas buffer,
+	 * at the appropriate (sorted) position, after all areas of the same
+	 * height. Function returns the position of the inserted area.
+	 *
+	 * @param OutArea An output image area to insert.
+	 */
+
+	int insertOutArea( const int OutArea )
+	{
+		const int Index =
+			findOutAreaIndex( fd -> OutAreas[ OutArea ].Height + 1 );
+
+		restoreOutArea( Index, OutArea );
+
+		return( Index );
+	}
+
+	/**
+	 * Function inserts an output image area into the SortedOutAreas buffer
+	 * at the specified position.
+	 *
+	 * @param Index Position of the output area.
+	 * @param OutArea An output image area to insert.
+	 */
+
+	void restoreOutArea( const int Index, const int OutArea )
+	{
+		int* const SortedOutAreas = fd -> SortedOutAreas;
+		int* const Heights = fd -> SortedOutAreaHeights;
+		int* const Widths = fd -> SortedOutAreaWidths;
+		int i;
+
+		for( i = fd -> SortedOutAreaCount; i > Index; i-- )
+		{
+			SortedOutAreas[ i ] = SortedOutAreas[ i - 1 ];
+			Heights[ i ] = Heights[ i - 1 ];
+			Widths[ i ] = Widths[ i - 1 ];
+		}
+
+		SortedOutAreas[ Index ] = OutArea;
+		Heights[ Index ] = fd -> OutAreas[ OutArea ].Height;
+		Widths[ Index ] = fd -> OutAreas[ OutArea ].Width;
+		fd -> SortedOutAreaCount++;
+	}
+
+	/**
+	 * Function removes an output image area from the SortedOutAreas buffer.
+	 *
+	 * @param Index Position of the output area to remove.
+	 */
+
+	void removeOutArea( const int Index )
+	{
+		int* const SortedOutAreas = fd -> SortedOutAreas;
+		int* const Heights = fd -> SortedOutAreaHeights;
+		int* const Widths = fd -> SortedOutAreaWidths;
+		const int c = --fd -> SortedOutAreaCount;
+		int i;
+
+		for( i = Index; i < c; i++ )
+		{
+			SortedOutAreas[ i ] = SortedOutAreas[ i + 1 ];
+			Heights[ i ] = Heights[ i + 1 ];
+			Widths[ i ] = Widths[ i + 1 ];
+		}
+	}
+
+	/**
+	 * Function sorts items in a stable manner: items that are equal keep
+	 * their relative order. Runs of 16 items are sorted via insertion sort,
+	 * and then merged. The comparison functor is inlined.
+	 *
+	 * @param Items Items to sort.
+	 * @param Count The number of items.
+	 * @param Temp Temporary buffer, reallocated if its capacity is below
+	 * Count. Not used if Count is below 17.
+	 * @param Less Comparison functor: returns "true" if the first item
+	 * should be placed before the second item.
+	 */
+
+	template< class T, class TLess >
+	static void sortItems( T* const Items, const int Count, CBuffer< T >& Temp,
+		const TLess& Less )
+	{
+		static const int RunLen = 16; // Length of insertion-sorted runs.
+		int i;
+
+		for( i = 0; i < Count; i += RunLen )
+		{
+			const int e = ( Count - i < RunLen ? Count : i + RunLen );
+			int j;
+
+			for( j = i + 1; j < e; j++ )
+			{
+				const T v = Items[ j ];
+				int k = j;
+
+				while( k > i && Less( v, Items[ k - 1 ]))
+				{
+					Items[ k ] = Items[ k - 1 ];
+					k--;
+				}
+
+				Items[ k ] = v;
+			}
+		}
+
+		if( Count <= RunLen )
+		{
+			return;
+		}
+
+		if( Temp.getCapacity() < Count )
+		{
+			Temp.alloc( Count );
+		}
+
+		T* Src = Items;
+		T* Dst = Temp;
+		int Width;
+
+		for( Width = RunLen; Width < Count; Width *= 2 )
+		{
+			for( i = 0; i < Count; i += Width * 2 )
+			{
+				const int m = ( Count - i < Width ? Count : i + Width );
+				const int e = ( Count - m < Width ? Count : m + Width );
+				int l = i;
+				int r = m;
+				int j = i;
+
+				while( l < m && r < e )
+				{
+					Dst[ j++ ] = ( Less( Src[ r ], Src[ l ]) ?
+						Src[ r++ ] : Src[ l++ ]);
+				}
+
+				while( l < m )
+				{
+					Dst[ j++ ] = Src[ l++ ];
+				}
+
+				while( r < e )
+				{
+					Dst[ j++ ] = Src[ r++ ];
+				}
+			}
+
+			T* const t = Src;
+			Src = Dst;
+			Dst = t;
+		}
+
+		if( Src != Items )
+		{
+			memcpy( Items, Src, Count * sizeof( T ));
+		}
+	}
+
+	/**
+	 * Function sorts areas via the sortItems() function, using the
+	 * temporary buffer of the context, if available.
+	 *
+	 * @param Areas Areas to sort.
+	 * @param Context Search context, NULL if not used.
+	 * @param Less Comparison functor.
+	 */
+
+	template< class TLess >
+	static void sortFitAreas( CArray< CFitArea >& Areas,
+		CFitContext* const Context, const TLess& Less )
+	{
+		CBuffer< CFitArea > LocalTemp;
+
+		sortItems( &Areas[ 0 ], Areas.getItemCount(),
+			( Context != NULL ? Context -> SortTemp : LocalTemp ), Less );
+	}
+
+	/**
+	 * Function returns the sort key of an area for the specified sort
+	 * order. Rotatable areas are keyed by their landscape orientation, as
+	 * they are kept by the fitters.
+	 *
+	 * @param Area Area to return the key of.
+	 * @param SortOrder A single ESortOrder value.
+	 * @param AllowRotation "True" if areas may be rotated.
+	 */
+
+	static TSize getSortKey( const CFitArea& Area, const int SortOrder,
+		const bool AllowRotation )
+	{
+		int w = Area.Width;
+		int h = Area.Height;
+
+		if( AllowRotation && Area.MayRotate && h > w )
+		{
+			w = Area.Height;
+			h = Area.Width;
+		}
+
+		switch( SortOrder )
+		{
+			case SortByHeight:
+				return( h );
+
+			case SortByArea:
+				return( (TSize) w * h );
+
+			case SortByMaxSide:
+				return( w > h ? w : h );
+
+			case SortByPerimeter:
+				return( (TSize) w + h );
+		}
+
+		return( w );
+	}
+
+	/**
+	 * Fit area initial sorting functor. Sorts areas in the descending order
+	 * of their sort keys.
+	 */
+
+	struct CFitAreaInLess
+	{
+		int SortOrder; ///< A single ESortOrder value.
+		bool AllowRotation; ///< "True" if areas may be rotated.
+
+		CFitAreaInLess( const int aSortOrder, const bool aAllowRotation )
+			: SortOrder( aSortOrder )
+			, AllowRotation( aAllowRotation )
+		{
+		}
+
+		bool operator()( const CFitArea& a1, const CFitArea& a2 ) const
+		{
+			return( getSortKey( a1, SortOrder, AllowRotation ) >
+				getSortKey( a2, SortOrder, AllowRotation ));
+		}
+	};
+
+	/**
+	 * Fit area post sorting functor. Sorts areas so that they "look in
+	 * order" in the finalized best fitted areas list.
+	 */
+
+	struct CFitAreaOutLess
+	{
+		bool operator()( const CFitArea& a1, const CFitArea& a2 ) const
+		{
+			if( a1.OutImage != a2.OutImage )
+			{
+				return( a1.OutImage < a2.OutImage );
+			}
+
+			if( a1.OutX != a2.OutX )
+			{
+				return( a1.OutX < a2.OutX );
+			}
+
+			return( a1.OutY < a2.OutY );
+		}
+	};
+
+	/**
+	 * Size class key sorting functor. Sorts keys so that equal areas are
+	 * adjacent, in the order of their indices.
+	 */
+
+	struct CSizeClassKeyLess
+	{
+		bool operator()( const CSizeClassKey& k1,
+			const CSizeClassKey& k2 ) const
+		{
+			if( k1.Width != k2.Width )
+			{
+				return( k1.Width < k2.Width );
+			}
+
+			if( k1.Height != k2.Height )
+			{
+				return( k1.Height < k2.Height );
+			}
+
+			if( k1.CanRotate != k2.CanRotate )
+			{
+				return( k1.CanRotate < k2.CanRotate );
+			}
+
+			return( k1.Area < k2.Area );
+		}
+	};
+
+	/**
+	 * Integer sorting functor. Sorts values in ascending order.
+	 */
+
+	struct CIntLess
+	{
+		bool operator()( const int a, const int b ) const
+		{
+			return( a < b );
+		}
+	};
+
+	/**
+	 * Result cache key item sorting functor. Sorts items in the ascending
+	 * order of their values.
+	 */
+
+	struct CCacheKeyItemLess
+	{
+		bool operator()( const CCacheKeyItem& k1,
+			const CCacheKeyItem& k2 ) const
+		{
+			return( k1.Value < k2.Value );
+		}
+	};
+
+	/**
+	 * Output image area sorting functor. Sorts areas by their x offset.
+	 */
+
+	struct COutAreaXLess
+	{
+		bool operator()( const COutArea& a1, const COutArea& a2 ) const
+		{
+			return( a1.x < a2.x );
+		}
+	};
+
+public:
+	/**
+	 * Class that keeps the memory buffers of the area fit search between
+	 * calls, see CFitParams :: Context. Buffers are only reallocated when a
+	 * call needs larger buffers than the previous calls. The context also
+	 * keeps the pool of threads that perform batches of jobs: the batches
+	 * of the fitAreaSets() function, and of the searches with WorkUnits,
+	 * RestartCount or several SortOrders. The threads are kept until the
+	 * context is destroyed.
+	 */
+
+	class CFitContext
+	{
+	private:
+		friend class CAreaFitter;
+
+		/**
+		 * Pool of threads that perform jobs of batches, see the runBatch()
+		 * function. Threads are created when a batch needs more threads
+		 * than the pool has, and are kept with their own contexts, so that
+		 * the following batches reuse the threads and their fitter
+		 * objects' buffers. Idle threads wait for the next batch without
+		 * using the CPU. The calling thread takes part in each batch, with
+		 * a context of its own kept by the pool.
+		 */
+
+		class CBatchPool
+		{
+		public:
+			CBatchPool()
+				: Generation( 0 )
+				, IsExiting( false )
+				, ParticipantCount( 0 )
+				, BusyCount( 0 )
+				, Jobs( NULL )
+				, NextJob( 0 )
+				, Params( NULL )
+				, Worker( NULL )
+			{
+			}
+
+			~CBatchPool()
+			{
+				{
+					std :: lock_guard< std :: mutex > Lock( Sync );
+					IsExiting = true;
+				}
+
+				StartCond.notify_all();
+				int i;
+
+				for( i = 0; i < Threads.getItemCount(); i++ )
+				{
+					Threads[ i ] -> join();
+					delete Threads[ i ];
+				}
+			}
+
+			/**
+			 * Function performs jobs of a batch, and returns when all jobs
+			 * were performed. Should not be called by several threads at
+			 * once.
+			 *
+			 * @param aJobs Jobs to perform.
+			 * @param aParams Search parameters of the jobs.
+			 * @param ThreadCount The number of threads to perform the jobs
+			 * with, including the calling thread.
+			 * @param aWorker Function run by each thread.
+			 */
+
+			void run( CFitJobs& aJobs, const CFitParams& aParams,
+				const int ThreadCount, const TBatchWorker aWorker )
+			{
+				if( CallerContext == NULL )
+				{
+					CallerContext = new CFitContext();
+				}
+
+				{
+					std :: lock_guard< std :: mutex > Lock( Sync );
+					Jobs = &aJobs;
+					NextJob = 0;
+					Params = &aParams;
+					Worker = aWorker;
+					ParticipantCount = ( ThreadCount > 1 ?
+						ThreadCount - 1 : 0 );
+
+					BusyCount = ParticipantCount;
+					Generation++;
+				}
+
+				// New threads start with the current generation.
+
+				while( Threads.getItemCount() < ParticipantCount )
+				{
+					Threads.add() = new std :: thread( runThread, this,
+						Threads.getItemCount() );
+				}
+
+				StartCond.notify_all();
+				aWorker( &aJobs, &NextJob, &aParams, CallerContext );
+
+				std :: unique_lock< std :: mutex > Lock( Sync );
+
+				while( BusyCount > 0 )
+				{
+					DoneCond.wait( Lock );
+				}
+			}
+
+		private:
+			CArray< std :: thread* > Threads; ///< Threads of the pool,
+				/// deleted by the destructor.
+			CPtrKeeper< CFitContext* > CallerContext; ///< Context of the
+				/// calling thread, created on the first batch.
+			std :: mutex Sync; ///< Synchronizer of the variables below,
+				/// except NextJob.
+			std :: condition_variable StartCond; ///< Signals a new batch
+				/// or the pool's destruction to the threads.
+			std :: condition_variable DoneCond; ///< Signals the end of the
+				/// batch to the calling thread.
+			int Generation; ///< Index of the current batch.
+			bool IsExiting; ///< "True" if the threads should exit.
+			int ParticipantCount; ///< The number of threads of the pool
+				/// taking part in the current batch, starting from the
+				/// first one.
+			int BusyCount; ///< The number of participating threads that did
+				/// not finish the current batch yet.
+			CFitJobs* Jobs; ///< Jobs of the current batch.
+			std :: atomic< int > NextJob; ///< Index of the next job yet to
+				/// be taken by a thread.
+			const CFitParams* Params; ///< Search parameters of the current
+				/// batch.
+			TBatchWorker Worker; ///< Worker function of the current batch.
+
+			/**
+			 * Thread function of the pool: performs the jobs of each batch
+			 * the thread takes part in, until the pool is destroyed.
+			 *
+			 * @param Pool Pool of the thread.
+			 * @param Index Index of the thread in the pool.
+			 */
+
+			static void runThread( CBatchPool* const Pool, const int Index )
+			{
+				CFitContext Context; // Reused between batches.
+				int DoneGeneration = 0;
+				std :: unique_lock< std :: mutex > Lock( Pool -> Sync );
+
+				while( true )
+				{
+					while( !Pool -> IsExiting &&
+						Pool -> Generation == DoneGeneration )
+					{
+						Pool -> StartCond.wait( Lock );
+					}
+
+					if( Pool -> IsExiting )
+					{
+						break;
+					}
+
+					DoneGeneration = Pool -> Generation;
+
+					if( Index < Pool -> ParticipantCount )
+					{
+						Lock.unlock();
+						Pool -> Worker( Pool -> Jobs, &Pool -> NextJob,
+							Pool -> Params, &Context );
+
+						Lock.lock();
+						Pool -> BusyCount--;
+
+						if( Pool -> BusyCount == 0 )
+						{
+							Pool -> DoneCond.notify_one();
+						}
+					}
+				}
+			}
+		};
+
+		CGlobals Globals; ///< Global search state, including the best fit
+			/// buffers.
+		CInitArray< CPtrKeeper< CAreaFitter* > > Fitters; ///< Fitter
+			/// objects, one per thread.
+		CBuffer< CFitArea > SortTemp; ///< Temporary buffer used to sort
+			/// areas.
+		CBatchPool Pool; ///< Pool of threads that perform batches of jobs.
+	};
+
+	/**
+	 * Class that places areas one at a time, as they arrive, without a
+	 * search: each area is put into the free output image area with the
+	 * smallest suitable height, and a new output image is created only if
+	 * no free area can contain it. Of the first MaxCandidates free areas
+	 * that can contain the area, the one that grows its output image the
+	 * least is chosen. Free areas are kept in a treap (a randomized binary
+	 * search tree) ordered by height, whose nodes also keep the maximal
+	 * width of their subtrees, so that free areas too narrow for the area
+	 * are skipped by subtrees. A placement thus takes O(log n) expected
+	 * time, where n is the number of free areas.
+	 *
+	 * The layout can be tightened from time to time by passing a copy of
+	 * the getAreas() array to the fitAreas() function, possibly in a
+	 * background thread, and then passing the result to the setLayout()
+	 * function. Areas added after the copy was made are placed into the new
+	 * layout by the setLayout() function. This class is not thread-safe:
+	 * its calls should be serialized by the caller, but the fitAreas()
+	 * call itself needs no synchronization.
+	 */
+
+	class COnlinePacker
+	{
+	public:
+		/**
+		 * A constructor.
+		 *
+		 * @param aMaxOutImageWidth Maximal output image's width in pixels.
+		 * The actual output image width can be as large as the widest area.
+		 * @param aMaxOutImageHeight Maximal output image's height in pixels.
+		 * The actual output image height can be as large as the tallest
+		 * area.
+		 * @param Params Placement parameters. Only the AllowRotation,
+		 * AreaAlign, OutImageAlign and DoPow2Size parameters are used. The
+		 * same parameters should be passed to the fitAreas() function that
+		 * produces layouts for the setLayout() function.
+		 */
+
+		COnlinePacker( const int aMaxOutImageWidth,
+			const int aMaxOutImageHeight, const CFitParams& Params )
+			: MaxOutImageWidth( alignDimDown( aMaxOutImageWidth,
+				Params.OutImageAlign, Params.DoPow2Size ))
+			, MaxOutImageHeight( alignDimDown( aMaxOutImageHeight,
+				Params.OutImageAlign, Params.DoPow2Size ))
+			, AllowRotation( Params.AllowRotation )
+			, AreaAlign( Params.AreaAlign )
+			, OutImageAlign( Params.OutImageAlign )
+			, DoPow2Size( Params.DoPow2Size )
+			, OutSize( 0 )
+			, FreeRoot( -1 )
+			, FreeOrder( 0 )
+			, Seed( 1 )
+		{
+		}
+
+		/**
+		 * Function places an area into the layout.
+		 *
+		 * @param Area Area to place. Receives the OutImage, OutX, OutY and
+		 * OutRotated values. A copy of the area is added to the array
+		 * returned by the getAreas() function.
+		 */
+
+		void addArea( CFitArea& Area )
+		{
+			placeArea( Area );
+			Areas.add( Area );
+		}
+
+		/**
+		 * Function replaces the layout, usually with a tighter layout
+		 * produced by the fitAreas() function from a copy of the getAreas()
+		 * array. Areas added after this copy was made, i.e. areas beyond
+		 * the number of areas in aAreas, are placed into the new layout
+		 * again, and follow the aAreas areas in the getAreas() array.
+		 *
+		 * @param aAreas Areas of the new layout, in any order. They should
+		 * not overlap.
+		 * @param aOutImages Output images of the new layout.
+		 */
+
+		void setLayout( const CArray< CFitArea >& aAreas,
+			const CArray< COutImage >& aOutImages )
+		{
+			CArray< CFitArea > LaterAreas;
+			int i;
+
+			for( i = aAreas.getItemCount(); i < Areas.getItemCount(); i++ )
+			{
+				LaterAreas.add( Areas[ i ]);
+			}
+
+			Areas = aAreas;
+			OutImages = aOutImages;
+			clearFreeAreas();
+			OutSize = 0;
+
+			for( i = 0; i < OutImages.getItemCount(); i++ )
+			{
+				const COutImage& OutImage = OutImages[ i ];
+				OutSize += OutImage.Size;
+
+				CArray< COutArea > ImageFreeAreas;
+				addFreeAreas( ImageFreeAreas, i,
+					( OutImage.Width > MaxOutImageWidth ?
+					OutImage.Width : MaxOutImageWidth ),
+					( OutImage.Height > MaxOutImageHeight ?
+					OutImage.Height : MaxOutImageHeight ), Areas,
+					AreaAlign );
+
+				int j;
+
+				for( j = 0; j < ImageFreeAreas.getItemCount(); j++ )
+				{
+					const COutArea& oa = ImageFreeAreas[ j ];
+					addFreeArea( i, oa.x, oa.y, oa.Width, oa.Height );
+				}
+			}
+
+			for( i = 0; i < LaterAreas.getItemCount(); i++ )
+			{
+				addArea( LaterAreas[ i ]);
+			}
+		}
+
+		/**
+		 * Function removes all areas and output images.
+		 */
+
+		void clear()
+		{
+			Areas.clear();
+			OutImages.clear();
+			clearFreeAreas();
+			OutSize = 0;
+		}
+
+		/**
+		 * @return Placed areas, in the order of their addition.
+		 */
+
+		const CArray< CFitArea >& getAreas() const
+		{
+			return( Areas );
+		}
+
+		/**
+		 * @return Output images of the layout.
+		 */
+
+		const CArray< COutImage >& getOutImages() const
+		{
+			return( OutImages );
+		}
+
+		/**
+		 * @return Summary size of all output images.
+		 */
+
+		TSize getOutSize() const
+		{
+			return( OutSize );
+		}
+
+	private:
+		static const int MaxCandidates = 16; ///< The maximal number of the
+			/// free areas that can contain an area, of which the one that
+			/// grows its output image the least is chosen.
+
+		/**
+		 * Structure holds a node of the free areas' treap. The nodes are
+		 * ordered by the heights of their free areas, and then by the
+		 * insertion order of the free areas.
+		 */
+
+		struct CFreeNode
+		{
+			COutArea Area; ///< Free area.
+			int Order; ///< Insertion order of the free area.
+			unsigned int Priority; ///< Random priority of the node, not
+				/// lower than the priorities of its child nodes.
+			int MaxWidth; ///< Maximal width of the free areas of the
+				/// node's subtree.
+			int Left; ///< Left child node index, or -1.
+			int Right; ///< Right child node index, or -1.
+		};
+
+		int MaxOutImageWidth; ///< Maximal output image's width in pixels,
+			/// rounded down to the output image granularity.
+		int MaxOutImageHeight; ///< Maximal output image's height in pixels,
+			/// rounded down to the output image granularity.
+		bool AllowRotation; ///< "True" if areas may be rotated.
+		int AreaAlign; ///< Alignment of area offsets.
+		int OutImageAlign; ///< Granularity of output image dimensions.
+		bool DoPow2Size; ///< "True" if output image dimensions are powers
+			/// of two.
+		CArray< CFitArea > Areas; ///< Placed areas.
+		CArray< COutImage > OutImages; ///< Output images.
+		TSize OutSize; ///< Summary size of all output images.
+		CArray< CFreeNode > FreeNodes; ///< Nodes of the free output image
+			/// areas, including unused nodes.
+		CArray< int > UnusedNodes; ///< Indices of the unused FreeNodes
+			/// items.
+		int FreeRoot; ///< Root node index of the free areas' treap, or -1.
+		int FreeOrder; ///< Insertion order of the next free area.
+		unsigned int Seed; ///< State of the pseudo-random sequence of the
+			/// nodes' priorities.
+
+		/**
+		 * Function removes all free areas.
+		 */
+
+		void clearFreeAreas()
+		{
+			FreeNodes.clear();
+			UnusedNodes.clear();
+			FreeRoot = -1;
+			FreeOrder = 0;
+			Seed = 1;
+		}
+
+		/**
+		 * @return "True" if the node precedes the specified position in the
+		 * order of the treap.
+		 *
+		 * @param n Node index.
+		 * @param Height Height of the position.
+		 * @param Order Insertion order of the position.
+		 */
+
+		bool isBefore( const int n, const int Height, const int Order ) const
+		{
+			const CFreeNode& fn = FreeNodes[ n ];
+
+			return( fn.Area.Height < Height ||
+				( fn.Area.Height == Height && fn.Order < Order ));
+		}
+
+		/**
+		 * Function updates the MaxWidth value of the node.
+		 *
+		 * @param n Node index.
+		 */
+
+		void updateNode( const int n )
+		{
+			CFreeNode& fn = FreeNodes[ n ];
+			fn.MaxWidth = fn.Area.Width;
+
+			if( fn.Left != -1 && FreeNodes[ fn.Left ].MaxWidth > fn.MaxWidth )
+			{
+				fn.MaxWidth = FreeNodes[ fn.Left ].MaxWidth;
+			}
+
+			if( fn.Right != -1 &&
+				FreeNodes[ fn.Right ].MaxWidth > fn.MaxWidth )
+			{
+				fn.MaxWidth = FreeNodes[ fn.Right ].MaxWidth;
+			}
+		}
+
+		/**
+		 * Function merges two subtrees.
+		 *
+		 * @param Lower Root node index of the subtree, or -1.
+		 * @param Upper Root node index of the subtree whose nodes follow
+		 * the Lower subtree's nodes, or -1.
+		 * @return Root node index of the merged subtree.
+		 */
+
+		int mergeNodes( const int Lower, const int Upper )
+		{
+			if( Lower == -1 )
+			{
+				return( Upper );
+			}
+
+			if( Upper == -1 )
+			{
+				return( Lower );
+			}
+
+			if( FreeNodes[ Lower ].Priority > FreeNodes[ Upper ].Priority )
+			{
+				const int r = mergeNodes( FreeNodes[ Lower ].Right, Upper );
+				FreeNodes[ Lower ].Right = r;
+				updateNode( Lower );
+				return( Lower );
+			}
+
+			const int l = mergeNodes( Lower, FreeNodes[ Upper ].Left );
+			FreeNodes[ Upper ].Left = l;
+			updateNode( Upper );
+			return( Upper );
+		}
+
+		/**
+		 * Function inserts a node into the subtree. The node is rotated up
+		 * while its priority is higher than its parent's priority.
+		 *
+		 * @param n Root node index of the subtree, or -1.
+		 * @param New Index of the node to insert, with no child nodes.
+		 * @return Root node index of the subtree.
+		 */
+
+		int insertNode( const int n, const int New )
+		{
+			if( n == -1 )
+			{
+				return( New );
+			}
+
+			CFreeNode& fn = FreeNodes[ n ];
+			const CFreeNode& nn = FreeNodes[ New ];
+
+			if( isBefore( n, nn.Area.Height, nn.Order ))
+			{
+				const int r = insertNode( fn.Right, New );
+				CFreeNode& fr = FreeNodes[ r ];
+				fn.Right = r;
+
+				if( fr.Priority > fn.Priority )
+				{
+					fn.Right = fr.Left;
+					fr.Left = n;
+					updateNode( n );
+					updateNode( r );
+					return( r );
+				}
+			}
+			else
+			{
+				const int l = insertNode( fn.Left, New );
+				CFreeNode& fl = FreeNodes[ l ];
+				fn.Left = l;
+
+				if( fl.Priority > fn.Priority )
+				{
+					fn.Left = fl.Right;
+					fl.Right = n;
+					updateNode( n );
+					updateNode( l );
+					return( l );
+				}
+			}
+
+			updateNode( n );
+			return( n );
+		}
+
+		/**
+		 * Function removes a node from the subtree. The removed node is
+		 * replaced by the merge of its child nodes.
+		 *
+		 * @param n Root node index of the subtree, containing the node.
+		 * @param Old Index of the node to remove.
+		 * @return Root node index of the subtree, or -1.
+		 */
+
+		int eraseNode( const int n, const int Old )
+		{
+			CFreeNode& fn = FreeNodes[ n ];
+
+			if( n == Old )
+			{
+				return( mergeNodes( fn.Left, fn.Right ));
+			}
+
+			const CFreeNode& on = FreeNodes[ Old ];
+
+			if( isBefore( n, on.Area.Height, on.Order ))
+			{
+				fn.Right = eraseNode( fn.Right, Old );
+			}
+			else
+			{
+				fn.Left = eraseNode( fn.Left, Old );
+			}
+
+			updateNode( n );
+			return( n );
+		}
+
+		/**
+		 * Function visits the nodes of the subtree, in the order of the
+		 * treap, whose free areas can contain an area of the specified
+		 * dimensions, and updates the best free area's node with the least
+		 * increase of the output image size.
+		 *
+		 * @param n Root node index of the subtree, or -1.
+		 * @param Width Width of the area.
+		 * @param Height Height of the area.
+		 * @param[in,out] Count The number of the visited free areas.
+		 * @param[in,out] Best The best free area's node index, or -1.
+		 * @param[in,out] Cost Output image size increase of the best free
+		 * area.
+		 * @return "True" if the visit should be stopped: MaxCandidates free
+		 * areas were visited, or a free area with no increase was found.
+		 */
+
+		bool visitFreeAreas( const int n, const int Width, const int Height,
+			int& Count, int& Best, TSize& Cost ) const
+		{
+			if( n == -1 || FreeNodes[ n ].MaxWidth < Width )
+			{
+				return( false );
+			}
+
+			const CFreeNode& fn = FreeNodes[ n ];
+			const COutArea& fa = fn.Area;
+
+			if( fa.Height < Height )
+			{
+				return( visitFreeAreas( fn.Right, Width, Height, Count, Best,
+					Cost ));
+			}
+
+			if( visitFreeAreas( fn.Left, Width, Height, Count, Best, Cost ))
+			{
+				return( true );
+			}
+
+			if( fa.Width >= Width )
+			{
+				const COutImage& OutImage = OutImages[ fa.OutImage ];
+				const int NewWidth = ( fa.x + Width > OutImage.Width ?
+					alignDim( fa.x + Width, OutImageAlign, DoPow2Size ) :
+					OutImage.Width );
+
+				const int NewHeight = ( fa.y + Height > OutImage.Height ?
+					alignDim( fa.y + Height, OutImageAlign, DoPow2Size ) :
+					OutImage.Height );
+
+				const TSize c = (TSize) NewWidth * NewHeight - OutImage.Size;
+
+				if( Best == -1 || c < Cost )
+				{
+					Best = n;
+					Cost = c;
+
+					if( c == 0 )
 					{
-						s -> MinAreaWidth = UnfittedAreas -> Next -> Width;
-						s -> MinAreaHeight = UnfittedAreas -> Next -> Height;
+						return( true );
+					}
+				}
+
+				Count++;
+
+				if( Count == MaxCandidates )
+				{
+					return( true );
+				}
+			}
+
+			return( visitFreeAreas( fn.Right, Width, Height, Count, Best,
+				Cost ));
+		}
+
+		/**
+		 * Function returns the index of the free area's node that can
+		 * contain an area of the specified dimensions with the least
+		 * increase of the output image size, preferring lower free areas, or
+		 * -1 if there is no such free area. Only the first MaxCandidates
+		 * free areas that can contain the area are considered.
+		 *
+		 * @param Width Width of the area.
+		 * @param Height Height of the area.
+		 * @param Cost Receives the output image size increase.
+		 */
+
+		int findFreeArea( const int Width, const int Height,
+			TSize& Cost ) const
+		{
+			int Count = 0;
+			int Best = -1;
+			visitFreeAreas( FreeRoot, Width, Height, Count, Best, Cost );
+
+			return( Best );
+		}
+
+		/**
+		 * Function inserts a free area into the treap. Empty areas are not
+		 * inserted.
+		 *
+		 * @param OutImage Output image index.
+		 * @param x X offset of the area.
+		 * @param y Y offset of the area.
+		 * @param Width Width of the area.
+		 * @param Height Height of the area.
+		 */
+
+		void addFreeArea( const int OutImage, const int x, const int y,
+			const int Width, const int Height )
+		{
+			if( Width <= 0 || Height <= 0 )
+			{
+				return;
+			}
+
+			int n;
+
+			if( UnusedNodes.getItemCount() > 0 )
+			{
+				n = UnusedNodes[ UnusedNodes.getItemCount() - 1 ];
+				UnusedNodes.setItemCount( UnusedNodes.getItemCount() - 1 );
+			}
+			else
+			{
+				n = FreeNodes.getItemCount();
+				FreeNodes.add();
+			}
+
+			Seed = Seed * 1103515245 + 12345;
+
+			CFreeNode& fn = FreeNodes[ n ];
+			fn.Area.OutImage = OutImage;
+			fn.Area.x = x;
+			fn.Area.y = y;
+			fn.Area.Width = Width;
+			fn.Area.Height = Height;
+			fn.Order = FreeOrder;
+			fn.Priority = Seed >> 8;
+			fn.MaxWidth = Width;
+			fn.Left = -1;
+			fn.Right = -1;
+
+			FreeRoot = insertNode( FreeRoot, n );
+			FreeOrder++;
+		}
+
+		/**
+		 * Function removes a free area from the treap.
+		 *
+		 * @param n Node index of the free area.
+		 */
+
+		void removeFreeArea( const int n )
+		{
+			FreeRoot = eraseNode( FreeRoot, n );
+			UnusedNodes.add( n );
+		}
+
+		/**
+		 * Function places an area into the lowest suitable free area, or
+		 * into a new output image. The remaining part of the free area is
+		 * split into two free areas along the shorter leftover side.
+		 *
+		 * @param Area Area to place.
+		 */
+
+		void placeArea( CFitArea& Area )
+		{
+			const int aw = alignDim( Area.Width, AreaAlign, false );
+			const int ah = alignDim( Area.Height, AreaAlign, false );
+			const bool CanRotate = ( AllowRotation && Area.MayRotate &&
+				aw != ah );
+
+			TSize Cost = 0;
+			int k = findFreeArea( aw, ah, Cost );
+			bool IsRotated = false;
+
+			if( CanRotate )
+			{
+				TSize CostRotated = 0;
+				const int kr = findFreeArea( ah, aw, CostRotated );
+
+				if( kr != -1 && ( k == -1 || CostRotated < Cost ||
+					( CostRotated == Cost &&
+					FreeNodes[ kr ].Area.Height <
+					FreeNodes[ k ].Area.Height )))
+				{
+					k = kr;
+					IsRotated = true;
+				}
+			}
+
+			if( k == -1 )
+			{
+				COutImage& NewImage = OutImages.add();
+				NewImage.Width = 0;
+				NewImage.Height = 0;
+				NewImage.Size = 0;
+
+				addFreeArea( OutImages.getItemCount() - 1, 0, 0,
+					( aw > MaxOutImageWidth ? aw : MaxOutImageWidth ),
+					( ah > MaxOutImageHeight ? ah : MaxOutImageHeight ));
+
+				k = findFreeArea( aw, ah, Cost );
+			}
+
+			const COutArea fa = FreeNodes[ k ].Area;
+			removeFreeArea( k );
+
+			const int w = ( IsRotated ? ah : aw );
+			const int h = ( IsRotated ? aw : ah );
+			const int RemainRight = fa.Width - w;
+			const int RemainBottom = fa.Height - h;
+
+			if( RemainRight < RemainBottom )
+			{
+				addFreeArea( fa.OutImage, fa.x + w, fa.y, RemainRight, h );
+				addFreeArea( fa.OutImage, fa.x, fa.y + h, fa.Width,
+					RemainBottom );
+			}
+			else
+			{
+				addFreeArea( fa.OutImage, fa.x + w, fa.y, RemainRight,
+					fa.Height );
+
+				addFreeArea( fa.OutImage, fa.x, fa.y + h, w, RemainBottom );
+			}
+
+			Area.OutImage = fa.OutImage;
+			Area.OutX = fa.x;
+			Area.OutY = fa.y;
+			Area.OutRotated = IsRotated;
+
+			COutImage& OutImage = OutImages[ fa.OutImage ];
+
+			if( fa.x + w > OutImage.Width || fa.y + h > OutImage.Height )
+			{
+				if( fa.x + w > OutImage.Width )
+				{
+					OutImage.Width = alignDim( fa.x + w, OutImageAlign,
+						DoPow2Size );
+				}
+
+				if( fa.y + h > OutImage.Height )
+				{
+					OutImage.Height = alignDim( fa.y + h, OutImageAlign,
+						DoPow2Size );
+				}
+
+				const TSize NewSize = (TSize) OutImage.Width *
+					OutImage.Height;
+
+				OutSize += NewSize - OutImage.Size;
+				OutImage.Size = NewSize;
+			}
+		}
+	};
+
+	/**
+	 * Cache of the fitAreas() function's results, see CFitParams :: Cache.
+	 * Results are keyed by the multiset of the areas' dimensions and by the
+	 * search parameters the result depends on, so a layout found once is
+	 * returned instantly for the same areas passed in any order, with any
+	 * Object pointers. The cache can be shared by several threads, and it
+	 * can be saved to a file to be reused by later runs.
+	 */
+
+	class CFitCache
+	{
+	public:
+		CFitCache()
+		{
+		}
+
+		~CFitCache()
+		{
+			deleteEntries();
+		}
+
+		/**
+		 * Function removes all cached results.
+		 */
+
+		void clear()
+		{
+			VOXSYNCSPIN( Sync );
+			deleteEntries();
+		}
+
+		/**
+		 * @return The number of cached results.
+		 */
+
+		int getEntryCount() const
+		{
+			VOXSYNCSPIN( Sync );
+			return( Entries.getItemCount() );
+		}
+
+		/**
+		 * Function saves all cached results to the specified file. The file
+		 * uses the native byte order. Function returns "false" if the file
+		 * could not be written.
+		 *
+		 * @param FileName Name of the file.
+		 */
+
+		bool save( const char* const FileName ) const
+		{
+			FILE* const f = fopen( FileName, "wb" );
+
+			if( f == NULL )
+			{
+				return( false );
+			}
+
+			VOXSYNCSPIN( Sync );
+			const int32_t EntryCount = Entries.getItemCount();
+			bool IsOk = ( fwrite( getFileMagic(), 4, 1, f ) == 1 &&
+				writeValue( f, EntryCount ));
+
+			int i;
+
+			for( i = 0; IsOk && i < EntryCount; i++ )
+			{
+				IsOk = writeEntry( f, *Entries[ i ]);
+			}
+
+			return( fclose( f ) == 0 && IsOk );
+		}
+
+		/**
+		 * Function adds results previously saved by the save() function to
+		 * the cache. Function returns "false" and adds nothing if the file
+		 * could not be read, or if its format is invalid.
+		 *
+		 * @param FileName Name of the file.
+		 */
+
+		bool load( const char* const FileName )
+		{
+			FILE* const f = fopen( FileName, "rb" );
+
+			if( f == NULL )
+			{
+				return( false );
+			}
+
+			// The file size bounds the item counts read from the file.
+
+			long FileSize = -1;
+
+			if( fseek( f, 0, SEEK_END ) == 0 )
+			{
+				FileSize = ftell( f );
+			}
+
+			CArray< CEntry* > Loaded;
+			char Magic[ 4 ];
+			int32_t EntryCount;
+			bool IsOk = ( FileSize >= 0 && fseek( f, 0, SEEK_SET ) == 0 &&
+				fread( Magic, 4, 1, f ) == 1 &&
+				memcmp( Magic, getFileMagic(), 4 ) == 0 &&
+				readValue( f, EntryCount ) && EntryCount >= 0 );
+
+			int i;
+
+			for( i = 0; IsOk && i < EntryCount; i++ )
+			{
+				CEntry* const e = new CEntry;
+				Loaded.add( e );
+				IsOk = readEntry( f, FileSize, *e );
+			}
+
+			fclose( f );
+
+			if( !IsOk )
+			{
+				for( i = 0; i < Loaded.getItemCount(); i++ )
+				{
+					delete Loaded[ i ];
+				}
+
+				return( false );
+			}
+
+			VOXSYNCSPIN( Sync );
+
+			for( i = 0; i < Loaded.getItemCount(); i++ )
+			{
+				addEntry( Loaded[ i ]);
+			}
+
+			return( true );
+		}
+
+	private:
+		friend class CAreaFitter;
+
+		/**
+		 * Structure holds a cached placement of an area.
+		 */
+
+		struct CCachedArea
+		{
+			int OutImage; ///< Output image index.
+			int OutX; ///< X offset of the area within the output image.
+			int OutY; ///< Y offset of the area within the output image.
+			bool OutRotated; ///< "True" if the area was rotated relative to
+				/// its orientation in the key.
+		};
+
+		/**
+		 * Structure holds a cached result.
+		 */
+
+		struct CEntry
+		{
+			uint64_t Hash; ///< Hash of the Key.
+			CArray< int64_t > Key; ///< Key of the result, see the
+				/// CAreaFitter :: makeCacheKey() function.
+			int FitCallsLimit; ///< The largest FitCallsLimit the result was
+				/// searched with.
+			double FitQuality; ///< Quality of the fit.
+			CArray< COutImage > OutImages; ///< Output images of the fit.
+			CArray< CCachedArea > Areas; ///< Placements of the areas, in the
+				/// order of the key's items.
+
+			/**
+			 * @return Summary cost of the output images, with the ImageCost
+			 * and ImageDimCost parameters stored in the key, see the
+			 * CAreaFitter :: makeCacheKey() function. This is the cost the
+			 * search minimizes.
+			 */
+
+			TSize getOutCost() const
+			{
+				TSize Cost = 0;
+				int i;
+
+				for( i = 0; i < OutImages.getItemCount(); i++ )
+				{
+					Cost += getImageCost( OutImages[ i ].Width,
+						OutImages[ i ].Height, (TSize) Key[ 11 ],
+						(TSize) Key[ 12 ]);
+				}
+
+				return( Cost );
+			}
+
+			/**
+			 * Function assigns the cached placements to the areas.
+			 *
+			 * @param AreasToFit Areas that receive placements.
+			 * @param aOutImages Receives output images.
+			 * @param Items Sorted key items of the areas.
+			 */
+
+			void apply( CArray< CFitArea >& AreasToFit,
+				CArray< COutImage >& aOutImages,
+				const CBuffer< CCacheKeyItem >& Items ) const
+			{
+				int i;
+
+				for( i = 0; i < Areas.getItemCount(); i++ )
+				{
+					const CCacheKeyItem& ki = Items[ i ];
+					const CCachedArea& ca = Areas[ i ];
+					CFitArea& fa = AreasToFit[ ki.Area ];
+					fa.OutImage = ca.OutImage;
+					fa.OutX = ca.OutX;
+					fa.OutY = ca.OutY;
+					fa.OutRotated = ( ca.OutRotated != ki.IsFlipped );
+				}
+
+				aOutImages = OutImages;
+			}
+		};
+
+		static const int KeyHeaderSize = 17; ///< The number of the search
+			/// parameters' values that precede the areas' items in a key.
+
+		/**
+		 * @return File format signature, 4 characters.
+		 */
+
+		static const char* getFileMagic()
+		{
+			return( "AFC3" );
+		}
+
+		CArray< CEntry* > Entries; ///< Cached results, sorted in the
+			/// ascending order of their hashes. The entries are owned by the
+			/// cache.
+		mutable CSyncSpinLock Sync; ///< Synchronizer of the Entries access.
+
+		CFitCache( const CFitCache& );
+		CFitCache& operator = ( const CFitCache& );
+
+		/**
+		 * Function deletes all entries.
+		 */
+
+		void deleteEntries()
+		{
+			int i;
+
+			for( i = 0; i < Entries.getItemCount(); i++ )
+			{
+				delete Entries[ i ];
+			}
+
+			Entries.clear();
+		}
+
+		/**
+		 * @return Hash of the key.
+		 *
+		 * @param Key Key to hash.
+		 */
+
+		static uint64_t hashKey( const CArray< int64_t >& Key )
+		{
+			uint64_t h = 14695981039346656037ULL;
+			int i;
+
+			for( i = 0; i < Key.getItemCount(); i++ )
+			{
+				h = ( h ^ (uint64_t) Key[ i ]) * 1099511628211ULL;
+				h ^= h >> 29;
+			}
+
+			return( h );
+		}
+
+		/**
+		 * @return Index of the first entry with a hash that is not lesser
+		 * than the specified hash.
+		 *
+		 * @param Hash Hash to search for.
+		 */
+
+		int findHash( const uint64_t Hash ) const
+		{
+			int Lo = 0;
+			int Hi = Entries.getItemCount();
+
+			while( Lo < Hi )
+			{
+				const int Mid = ( Lo + Hi ) >> 1;
+
+				if( Entries[ Mid ] -> Hash < Hash )
+				{
+					Lo = Mid + 1;
+				}
+				else
+				{
+					Hi = Mid;
+				}
+			}
+
+			return( Lo );
+		}
+
+		/**
+		 * @return Index of the entry with the specified key, or -1 if there
+		 * is no such entry.
+		 *
+		 * @param Hash Hash of the key.
+		 * @param Key Key to search for.
+		 */
+
+		int findEntry( const uint64_t Hash,
+			const CArray< int64_t >& Key ) const
+		{
+			int i;
+
+			for( i = findHash( Hash ); i < Entries.getItemCount() &&
+				Entries[ i ] -> Hash == Hash; i++ )
+			{
+				const CArray< int64_t >& k = Entries[ i ] -> Key;
+
+				if( k.getItemCount() == Key.getItemCount() &&
+					memcmp( &k[ 0 ], &Key[ 0 ],
+					Key.getItemCount() * sizeof( int64_t )) == 0 )
+				{
+					return( i );
+				}
+			}
+
+			return( -1 );
+		}
+
+		/**
+		 * Function adds an entry to the cache. If an entry with the same key
+		 * exists, the entry with the lower output image cost is kept (the
+		 * existing one if the costs are equal), with the largest
+		 * FitCallsLimit of both.
+		 *
+		 * @param e Entry to add, will be owned by the cache.
+		 */
+
+		void addEntry( CEntry* const e )
+		{
+			const int i = findEntry( e -> Hash, e -> Key );
+
+			if( i == -1 )
+			{
+				Entries.insert( findHash( e -> Hash ), e );
+				return;
+			}
+
+			CEntry* const Old = Entries[ i ];
+
+			if( Old -> FitCallsLimit > e -> FitCallsLimit )
+			{
+				e -> FitCallsLimit = Old -> FitCallsLimit;
+			}
+
+			if( e -> getOutCost() < Old -> getOutCost() )
+			{
+				Entries[ i ] = e;
+				delete Old;
+			}
+			else
+			{
+				Old -> FitCallsLimit = e -> FitCallsLimit;
+				delete e;
+			}
+		}
+
+		template< class T >
+		static bool writeValue( FILE* const f, const T& v )
+		{
+			return( fwrite( &v, sizeof( v ), 1, f ) == 1 );
+		}
+
+		template< class T >
+		static bool readValue( FILE* const f, T& v )
+		{
+			return( fread( &v, sizeof( v ), 1, f ) == 1 );
+		}
+
+		/**
+		 * Function writes an entry to the file, returns "false" on error.
+		 *
+		 * @param f File to write to.
+		 * @param e Entry to write.
+		 */
+
+		static bool writeEntry( FILE* const f, const CEntry& e )
+		{
+			if( !writeValue( f, (int32_t) e.Key.getItemCount() ) ||
+				fwrite( &e.Key[ 0 ], sizeof( int64_t ), e.Key.getItemCount(),
+				f ) != (size_t) e.Key.getItemCount() ||
+				!writeValue( f, (int32_t) e.FitCallsLimit ) ||
+				!writeValue( f, e.FitQuality ) ||
+				!writeValue( f, (int32_t) e.OutImages.getItemCount() ))
+			{
+				return( false );
+			}
+
+			int i;
+
+			for( i = 0; i < e.OutImages.getItemCount(); i++ )
+			{
+				if( !writeValue( f, (int32_t) e.OutImages[ i ].Width ) ||
+					!writeValue( f, (int32_t) e.OutImages[ i ].Height ))
+				{
+					return( false );
+				}
+			}
+
+			for( i = 0; i < e.Areas.getItemCount(); i++ )
+			{
+				const CCachedArea& ca = e.Areas[ i ];
+
+				if( !writeValue( f, (int32_t) ca.OutImage ) ||
+					!writeValue( f, (int32_t) ca.OutX ) ||
+					!writeValue( f, (int32_t) ca.OutY ) ||
+					!writeValue( f, (uint8_t) ca.OutRotated ))
+				{
+					return( false );
+				}
+			}
+
+			return( true );
+		}
 
-						if( true )
-						{
-							CFitArea* ScanArea =
-								UnfittedAreas -> Next -> Next;
+		/**
+		 * @return "True" if the file has at least the specified number of
+		 * bytes left to read.
+		 *
+		 * @param f File being read.
+		 * @param FileSize Size of the file, in bytes.
+		 * @param Count The number of items to read.
+		 * @param ItemSize Size of an item, in bytes.
+		 */
+
+		static bool hasBytesLeft( FILE* const f, const long FileSize,
+			const int64_t Count, const int ItemSize )
+		{
+			const long Pos = ftell( f );
 
-							while( ScanArea != NULL )
-							{
-								if( ScanArea -> Width < s -> MinAreaWidth )
-								{
-									s -> MinAreaWidth = ScanArea -> Width;
-								}
+			return( Pos >= 0 && Pos <= FileSize &&
+				Count <= ( FileSize - Pos ) / ItemSize );
+		}
 
-								if( ScanArea -> Height < s -> MinAreaHeight )
-								{
-									s -> MinAreaHeight = ScanArea -> Height;
-								}
+		/**
+		 * Function reads an entry written by the writeEntry() function,
+		 * returns "false" on error or if the entry is invalid. Item counts
+		 * read from the file are checked against the bytes left in the
+		 * file before anything is allocated, and placements are checked to
+		 * lie within their output images.
+		 *
+		 * @param f File to read from.
+		 * @param FileSize Size of the file, in bytes.
+		 * @param e Receives the entry.
+		 */
+
+		static bool readEntry( FILE* const f, const long FileSize,
+			CEntry& e )
+		{
+			int32_t KeyCount;
+			int32_t FitCallsLimit;
+			int32_t ImageCount;
 
-								ScanArea = ScanArea -> Next;
-							}
-						}
+			if( !readValue( f, KeyCount ) || KeyCount < KeyHeaderSize ||
+				!hasBytesLeft( f, FileSize, KeyCount, sizeof( int64_t )))
+			{
+				return( false );
+			}
 
-						// Remove the output area occupied by the current area
-						// temporarily.
+			e.Key.setItemCount( KeyCount );
+
+			if( fread( &e.Key[ 0 ], sizeof( int64_t ), KeyCount, f ) !=
+				(size_t) KeyCount ||
+				e.Key[ 0 ] != KeyCount - KeyHeaderSize ||
+				!readValue( f, FitCallsLimit ) ||
+				!readValue( f, e.FitQuality ) ||
+				!readValue( f, ImageCount ) || ImageCount < 0 ||
+				!hasBytesLeft( f, FileSize, ImageCount *
+				(int64_t) ( sizeof( int32_t ) * 2 ) + e.Key[ 0 ] *
+				(int64_t) ( sizeof( int32_t ) * 3 + 1 ), 1 ))
+			{
+				return( false );
+			}
 
-						s -> PrevOutArea -> Next = OutArea -> Next;
+			e.Hash = hashKey( e.Key );
+			e.FitCallsLimit = FitCallsLimit;
+			e.OutImages.setItemCount( ImageCount );
+			int i;
 
-						// Try to fit remaining areas with new out areas put
-						// in configuration 1.
+			for( i = 0; i < ImageCount; i++ )
+			{
+				COutImage& OutImage = e.OutImages[ i ];
+				int32_t w;
+				int32_t h;
 
-						if( s -> OutAreaRemainRight >= s -> MinAreaWidth &&
-							OutArea -> Height >= s -> MinAreaHeight )
-						{
-							s -> NewOutAreas[ 0 ].OutImage =
-								OutArea -> OutImage;
+				if( !readValue( f, w ) || !readValue( f, h ) || w < 0 ||
+					h < 0 )
+				{
+					return( false );
+				}
 
-							s -> NewOutAreas[ 0 ].x =
-								OutArea -> x + Area -> Width;
+				OutImage.Width = w;
+				OutImage.Height = h;
+				OutImage.Size = (TSize) w * h;
+			}
 
-							s -> NewOutAreas[ 0 ].y = OutArea -> y;
-							s -> NewOutAreas[ 0 ].Width =
-								s -> OutAreaRemainRight;
+			e.Areas.setItemCount( (int) e.Key[ 0 ]);
 
-							s -> NewOutAreas[ 0 ].Height = OutArea -> Height;
-							s -> PrevNewOutAreas[ 0 ] =
-								insertOutArea( &s -> NewOutAreas[ 0 ]);
+			for( i = 0; i < e.Areas.getItemCount(); i++ )
+			{
+				CCachedArea& ca = e.Areas[ i ];
+				int32_t v[ 3 ];
+				uint8_t r;
 
-							s -> c = 1;
-						}
-						else
-						{
-							s -> c = 0;
-						}
+				if( !readValue( f, v ) || !readValue( f, r ) ||
+					v[ 0 ] < 0 || v[ 0 ] >= ImageCount || v[ 1 ] < 0 ||
+					v[ 2 ] < 0 )
+				{
+					return( false );
+				}
 
-						if( Area -> Width >= s -> MinAreaWidth &&
-							s -> OutAreaRemainBottom >= s -> MinAreaHeight )
-						{
-							s -> NewOutAreas[ 1 ].OutImage =
-								OutArea -> OutImage;
+				// The placement should lie within the output image, with
+				// the area's dimensions stored in the key.
 
-							s -> NewOutAreas[ 1 ].x = OutArea -> x;
-							s -> NewOutAreas[ 1 ].y =
-								OutArea -> y + Area -> Height;
+				const int64_t Value = e.Key[ KeyHeaderSize + i ];
+				const int64_t w = Value >> 32;
+				const int64_t h = ( Value >> 1 ) & 0x7FFFFFFF;
+				const COutImage& OutImage = e.OutImages[ v[ 0 ]];
 
-							s -> NewOutAreas[ 1 ].Height =
-								s -> OutAreaRemainBottom;
+				if(( r != 0 && ( Value & 1 ) == 0 ) ||
+					v[ 1 ] + ( r != 0 ? h : w ) > OutImage.Width ||
+					v[ 2 ] + ( r != 0 ? w : h ) > OutImage.Height )
+				{
+					return( false );
+				}
 
-							s -> NewOutAreas[ 1 ].Width = Area -> Width;
-							s -> PrevNewOutAreas[ s -> c ] =
-								insertOutArea( &s -> NewOutAreas[ 1 ]);
+				ca.OutImage = v[ 0 ];
+				ca.OutX = v[ 1 ];
+				ca.OutY = v[ 2 ];
+				ca.OutRotated = ( r != 0 );
+			}
 
-							s -> c++;
-						}
+			return( true );
+		}
+	};
+};
 
-						s -> c1 = s -> c;
-						s -> CodeLoc = 2;
-						pushStack();
-						goto CodeLoc1;
+/**
+ * Area fitter for small fixed-capacity problems, for use in latency-critical
+ * code. All search state is kept in fixed-size arrays of the object on the
+ * stack, so that a call performs no memory allocations and no copying of
+ * the areas. The search is a depth-first branch-and-bound over the same
+ * guillotine free-area representation as used by the CAreaFitter class:
+ * areas are placed in a fixed order (descending by the longer side, then
+ * by size), each into every free area that can contain it, with both ways
+ * of splitting the remaining space. As with the CAreaFitter class, a fit
+ * with fewer output images is preferred, and then the smallest summary
+ * size of output images.
+ *
+ * MaxAreas template parameter specifies the largest supported number of
+ * areas. The search is exhaustive within the FitCallsLimit, which makes it
+ * practical for up to 16 areas or so.
+ *
+ * The search is a plain recursion bounded by MaxAreas, not an unrolled
+ * engine, and the image limits are run-time arguments. Since only a single
+ * order of the areas is searched, the fit can be worse than that of the
+ * CAreaFitter :: fitAreas() function with the same number of calls. Of the
+ * CAreaFitter :: CFitParams parameters, only AllowRotation is supported:
+ * there is no MaxOutImageSize limit, no AreaAlign, OutImageAlign or
+ * DoPow2Size alignment, no ImageCost or ImageDimCost, no Padding or Border,
+ * no MinOutImageCount, and no threads, deadline, cancel flag, observer,
+ * statistics or cache. Such searches should use the CAreaFitter class.
+ */
 
-					CodeLoc2:
-						while( s -> c > 0 )
-						{
-							s -> c--;
-							s -> PrevNewOutAreas[ s -> c ] -> Next =
-								s -> PrevNewOutAreas[ s -> c ] -> Next ->
-								Next;
-						}
+template< int MaxAreas >
+class CSmallAreaFitter
+{
+public:
+	typedef CAreaFitter :: CFitArea CFitArea; ///< Area type.
+	typedef CAreaFitter :: COutImage COutImage; ///< Output image type.
+	typedef CAreaFitter :: TSize TSize; ///< Image size type.
 
-						// Try to fit remaining areas with new out areas put
-						// in configuration 2.
+	/**
+	 * Function fits the areas into output images. Function returns "true"
+	 * if a fit was found. This function is reentrant.
+	 *
+	 * @param Areas Areas to be fitted, AreaCount items. If this function
+	 * returned "true", these areas receive the OutImage, OutX, OutY and
+	 * OutRotated values. The order of the areas is not changed, and the
+	 * Next member is not used.
+	 * @param AreaCount The number of areas, up to MaxAreas. Function
+	 * returns "false" if this number is larger.
+	 * @param OutImages Receives output images, should have space for
+	 * AreaCount items.
+	 * @param OutImageCount Receives the number of output images.
+	 * @param MaxOutImageWidth Maximal output image's width in pixels. The
+	 * actual maximal output image width can be as large as the widest area.
+	 * @param MaxOutImageHeight Maximal output image's height in pixels. The
+	 * actual maximal output image height can be as large as the tallest
+	 * area.
+	 * @param FitCallsLimit Do not perform more than this number of
+	 * placement steps, apart from the steps of the first fit.
+	 * @param FitQuality Fit's quality in percent. This value is only valid
+	 * if this function returned "true".
+	 * @param AllowRotation "True" if areas with the MayRotate flag set
+	 * should be tried in both orientations.
+	 */
 
-						if( fd -> OutSize < fd -> BestOutSize &&
-							fd -> OutImageCount <= fd -> BestOutImageCount )
-						{
-							if( s -> OutAreaRemainRight >=
-								s -> MinAreaWidth && Area -> Height >=
-								s -> MinAreaHeight )
-							{
-								s -> NewOutAreas[ 0 ].OutImage =
-									OutArea -> OutImage;
+	static bool fitAreas( CFitArea* const Areas, const int AreaCount,
+		COutImage* const OutImages, int& OutImageCount,
+		const int MaxOutImageWidth, const int MaxOutImageHeight,
+		const int FitCallsLimit, double& FitQuality,
+		const bool AllowRotation = false )
+	{
+		if( AreaCount < 0 || AreaCount > MaxAreas )
+		{
+			return( false );
+		}
 
-								s -> NewOutAreas[ 0 ].x =
-									OutArea -> x + Area -> Width;
+		CSmallAreaFitter Fitter;
+		Fitter.init( Areas, AreaCount, MaxOutImageWidth, MaxOutImageHeight,
+			FitCallsLimit, AllowRotation );
 
-								s -> NewOutAreas[ 0 ].y = OutArea -> y;
-								s -> NewOutAreas[ 0 ].Width =
-									s -> OutAreaRemainRight;
+		Fitter.search( 0 );
 
-								s -> NewOutAreas[ 0 ].Height = Area -> Height;
-								s -> PrevNewOutAreas[ 0 ] =
-									insertOutArea( &s -> NewOutAreas[ 0 ]);
+		int i;
 
-								s -> c = 1;
-							}
-							else
-							{
-								s -> c = 0;
-							}
+		for( i = 0; i < AreaCount; i++ )
+		{
+			const CPlacedArea& pa = Fitter.BestPlaced[ i ];
+			CFitArea& fa = Areas[ Fitter.Order[ i ]];
+			fa.OutImage = pa.OutImage;
+			fa.OutX = pa.x;
+			fa.OutY = pa.y;
+			fa.OutRotated = pa.IsRotated;
+		}
 
-							if( OutArea -> Width >= s -> MinAreaWidth &&
-								s -> OutAreaRemainBottom >=
-								s -> MinAreaHeight )
-							{
-								s -> NewOutAreas[ 1 ].OutImage =
-									OutArea -> OutImage;
+		OutImageCount = Fitter.BestImageCount;
 
-								s -> NewOutAreas[ 1 ].x = OutArea -> x;
-								s -> NewOutAreas[ 1 ].y =
-									OutArea -> y + Area -> Height;
+		for( i = 0; i < OutImageCount; i++ )
+		{
+			OutImages[ i ] = Fitter.BestImages[ i ];
+		}
 
-								s -> NewOutAreas[ 1 ].Height =
-									s -> OutAreaRemainBottom;
+		FitQuality = ( Fitter.BestOutSize == 0 ? 100.0 :
+			100.0 * Fitter.AreaSize / Fitter.BestOutSize );
 
-								s -> NewOutAreas[ 1 ].Width =
-									OutArea -> Width;
+		return( true );
+	}
 
-								s -> PrevNewOutAreas[ s -> c ] =
-									insertOutArea( &s -> NewOutAreas[ 1 ]);
+private:
+	static const int MaxFreeAreas = MaxAreas * 2 + 1; ///< The maximal
+		/// number of free areas: each placement adds at most 2 of them.
 
-								s -> c++;
-							}
+	/**
+	 * Structure holds a free output image area.
+	 */
 
-							if( s -> c + s -> c1 > 0 )
-							{
-								s -> CodeLoc = 3;
-								pushStack();
-								goto CodeLoc1;
+	struct CFreeArea
+	{
+		int OutImage; ///< Output image index.
+		int x; ///< X position of the area within the output image.
+		int y; ///< Y position of the area within the output image.
+		int Width; ///< Width of the area.
+		int Height; ///< Height of the area.
+	};
 
-							CodeLoc3:
-								while( s -> c > 0 )
-								{
-									s -> c--;
-									s -> PrevNewOutAreas[ s -> c ] -> Next =
-										s -> PrevNewOutAreas[ s -> c ] ->
-										Next -> Next;
-								}
-							}
-						}
+	/**
+	 * Structure holds a placement of an area.
+	 */
 
-						// Restore output area occupied by the current Area.
+	struct CPlacedArea
+	{
+		int OutImage; ///< Output image index.
+		int x; ///< X offset of the area within the output image.
+		int y; ///< Y offset of the area within the output image.
+		bool IsRotated; ///< "True" if the area was rotated.
+	};
 
-						s -> PrevOutArea -> Next = OutArea;
-					}
+	int AreaCount; ///< The number of areas.
+	int MaxOutImageWidth; ///< Maximal output image's width in pixels.
+	int MaxOutImageHeight; ///< Maximal output image's height in pixels.
+	int CallsLeft; ///< The number of placement steps left.
+	int Width[ MaxAreas ]; ///< Widths of the areas, in the fit order.
+	int Height[ MaxAreas ]; ///< Heights of the areas, in the fit order.
+	bool CanRotate[ MaxAreas ]; ///< "True" if the area can be rotated.
+	int Order[ MaxAreas ]; ///< Indices of the areas, in the fit order.
+	int MinSide[ MaxAreas + 1 ]; ///< The smallest side of the areas
+		/// starting at the specified fit order position.
+	TSize AreaSize; ///< Summary size of all areas.
+	CFreeArea FreeAreas[ MaxFreeAreas ]; ///< Free output image areas.
+	int FreeAreaCount; ///< The number of free areas.
+	COutImage Images[ MaxAreas ]; ///< Current output images.
+	int ImageCount; ///< The number of current output images.
+	TSize OutSize; ///< Summary size of the current output images.
+	CPlacedArea Placed[ MaxAreas ]; ///< Current placements of the areas.
+	COutImage BestImages[ MaxAreas ]; ///< Output images of the best fit.
+	int BestImageCount; ///< The number of output images of the best fit,
+		/// MaxAreas + 1 if no fit was found yet.
+	TSize BestOutSize; ///< Summary output image size of the best fit.
+	CPlacedArea BestPlaced[ MaxAreas ]; ///< Placements of the best fit.
 
-					if( s -> DoOutImageRestore )
-					{
-						fd -> OutImages[ OutArea -> OutImage ] =
-							s -> OutImageSave;
+	/**
+	 * Function prepares the search: the areas are sorted in the fit order.
+	 */
 
-						fd -> OutSize = s -> OutSizeSave;
-					}
-				}
+	void init( const CFitArea* const Areas, const int aAreaCount,
+		const int aMaxOutImageWidth, const int aMaxOutImageHeight,
+		const int FitCallsLimit, const bool AllowRotation )
+	{
+		AreaCount = aAreaCount;
+		MaxOutImageWidth = aMaxOutImageWidth;
+		MaxOutImageHeight = aMaxOutImageHeight;
+		CallsLeft = FitCallsLimit;
+		AreaSize = 0;
+		FreeAreaCount = 0;
+		ImageCount = 0;
+		OutSize = 0;
+		BestImageCount = MaxAreas + 1;
+		BestOutSize = 0;
 
-				if( s -> WasOutImageAdded )
-				{
-					s -> PrevOutArea -> Next = OutArea -> Next;
-					fd -> OutImageCount--;
-					break;
-				}
+		int i;
 
-				if( fd -> OutSize >= fd -> BestOutSize ||
-					fd -> OutImageCount > fd -> BestOutImageCount )
+		for( i = 0; i < AreaCount; i++ )
+		{
+			// Insertion sort.
+
+			const CFitArea& fa = Areas[ i ];
+			const int Long = ( fa.Width > fa.Height ? fa.Width : fa.Height );
+			const TSize Size = (TSize) fa.Width * fa.Height;
+			AreaSize += Size;
+			int j = i;
+
+			while( j > 0 )
+			{
+				const CFitArea& pa = Areas[ Order[ j - 1 ]];
+				const int PrevLong = ( pa.Width > pa.Height ?
+					pa.Width : pa.Height );
+
+				if( PrevLong > Long || ( PrevLong == Long &&
+					(TSize) pa.Width * pa.Height >= Size ))
 				{
 					break;
 				}
 
-				s -> PrevOutArea = OutArea;
-				OutArea = OutArea -> Next;
+				Order[ j ] = Order[ j - 1 ];
+				j--;
 			}
 
-			s -> PrevArea -> Next = Area;
-
-			s -> PrevArea = Area;
-			s -> Area = Area -> Next;
+			Order[ j ] = i;
 		}
 
-		if( Depth > 0 )
-		{
-			Depth--;
-			s = &Stack[ Depth ];
-			Area = s -> Area;
-			OutArea = s -> OutArea;
-
-			if( s -> CodeLoc == 2 )
-			{
-				goto CodeLoc2;
-			}
-			else
-			{
-				goto CodeLoc3;
-			}
-		}
+		MinSide[ AreaCount ] = 0x7FFFFFFF;
 
-		if( FitCallsLeft > 0 )
+		for( i = AreaCount - 1; i >= 0; i-- )
 		{
-			//VOXSYNCSPIN( Globals -> StateSync );
+			const CFitArea& fa = Areas[ Order[ i ]];
+			Width[ i ] = fa.Width;
+			Height[ i ] = fa.Height;
+			CanRotate[ i ] = ( AllowRotation && fa.MayRotate &&
+				fa.Width != fa.Height );
 
-			Globals -> FitCallsLeft += FitCallsLeft;
-			FitCallsLeft = 0;
+			const int Short = ( fa.Width < fa.Height ?
+				fa.Width : fa.Height );
+
+			MinSide[ i ] = ( Short < MinSide[ i + 1 ] ?
+				Short : MinSide[ i + 1 ]);
 		}
 	}
 
 	/**
-	 * Function checks if a newly added area when fitted into the output image
-	 * produces overall output image size lesser than BestOutSize.
-	 *
-	 * @param NewWidth New possible width of the output image when the areas
-	 * is placed.
-	 * @param NewHeight New possible height of the output image when the areas
-	 * is placed.
-	 * @param OutImage Current output image's dimensions.
-	 * @param DoOutImageRestore "True" if output image dimensions should be
-	 * restored. This value is valid only if this function returned "true".
-	 * @param OutImageSave Saved output image dimensions.
-	 * @param OutSizeSave Saved summary size of all output images.
-	 * @param OutAreasTried This variable is incremented if the supplied area
-	 * should be marked as "tried" to be fitted. This variable is not
-	 * incremented if the supplied area increases output image's size beyond
-	 * MaxOutImageSize.
+	 * Function adds a free area unless it is too small for any of the
+	 * areas that remain to be placed. Function returns the number of
+	 * added areas, 0 or 1.
 	 */
 
-	bool checkAreaFitAgainstBest( int NewWidth, int NewHeight,
-		COutImage& OutImage, bool& DoOutImageRestore, COutImage& OutImageSave,
-		int& OutSizeSave, int& OutAreasTried )
+	int addFreeArea( const int Depth, const int OutImage, const int x,
+		const int y, const int w, const int h )
 	{
-		bool DoUpdateSize;
-
-		if( NewWidth > OutImage.Width )
-		{
-			DoUpdateSize = true;
-		}
-		else
+		if( w < MinSide[ Depth ] || h < MinSide[ Depth ])
 		{
-			DoUpdateSize = false;
-			NewWidth = OutImage.Width;
+			return( 0 );
 		}
 
-		if( NewHeight > OutImage.Height )
-		{
-			DoUpdateSize = true;
-		}
-		else
-		{
-			NewHeight = OutImage.Height;
-		}
+		CFreeArea& fa = FreeAreas[ FreeAreaCount ];
+		fa.OutImage = OutImage;
+		fa.x = x;
+		fa.y = y;
+		fa.Width = w;
+		fa.Height = h;
+		FreeAreaCount++;
 
-		if( DoUpdateSize )
-		{
-			const int NewSize = NewWidth * NewHeight;
-			const int NewOutSize = fd -> OutSize + NewSize - OutImage.Size;
+		return( 1 );
+	}
 
-			if( NewSize > MaxOutImageSize )
+	/**
+	 * Function places the area into the free area, with both ways of
+	 * splitting the remaining space, and continues the search with the
+	 * next area.
+	 *
+	 * @param Depth Fit order position of the area.
+	 * @param k Index of the free area.
+	 * @param w Width of the area in its placed orientation.
+	 * @param h Height of the area in its placed orientation.
+	 * @param IsRotated "True" if the area is rotated.
+	 */
+
+	void place( const int Depth, const int k, const int w, const int h,
+		const bool IsRotated )
+	{
+		const CFreeArea fa = FreeAreas[ k ];
+		COutImage& OutImage = Images[ fa.OutImage ];
+		const COutImage OutImageSave = OutImage;
+		const TSize OutSizeSave = OutSize;
+
+		if( fa.x + w > OutImage.Width || fa.y + h > OutImage.Height )
+		{
+			if( fa.x + w > OutImage.Width )
 			{
-				return( false );
+				OutImage.Width = fa.x + w;
 			}
 
-			if( NewOutSize >= fd -> BestOutSize )
+			if( fa.y + h > OutImage.Height )
 			{
-				OutAreasTried++;
-				return( false );
+				OutImage.Height = fa.y + h;
 			}
 
-			OutImageSave = OutImage;
-			OutSizeSave = fd -> OutSize;
-
-			OutImage.Width = NewWidth;
-			OutImage.Height = NewHeight;
+			const TSize NewSize = (TSize) OutImage.Width * OutImage.Height;
+			OutSize += NewSize - OutImage.Size;
 			OutImage.Size = NewSize;
-			fd -> OutSize = NewOutSize;
 
-			DoOutImageRestore = true;
-		}
-		else
-		{
-			DoOutImageRestore = false;
+			if( BestImageCount == ImageCount && OutSize >= BestOutSize )
+			{
+				OutImage = OutImageSave;
+				OutSize = OutSizeSave;
+				return;
+			}
 		}
 
-		OutAreasTried++;
-		return( true );
-	}
+		CPlacedArea& pa = Placed[ Depth ];
+		pa.OutImage = fa.OutImage;
+		pa.x = fa.x;
+		pa.y = fa.y;
+		pa.IsRotated = IsRotated;
 
-	/**
-	 * Function inserts an output image area into the list of areas, at the
-	 * appropriate (sorted) position. Function returns pointer to a preceeding
-	 * output image area, after which the OutArea was placed.
-	 *
-	 * @param OutArea An output image area to insert.
-	 */
+		FreeAreaCount--;
+		FreeAreas[ k ] = FreeAreas[ FreeAreaCount ];
 
-	COutArea* insertOutArea( COutArea* const OutArea )
-	{
-		COutArea* PrevScanOutArea = fd -> OutAreas;
-		COutArea* ScanOutArea = fd -> OutAreas -> Next;
+		const int RemainRight = fa.Width - w;
+		const int RemainBottom = fa.Height - h;
+		const int ConfigCount = ( RemainRight > 0 && RemainBottom > 0 ?
+			2 : 1 );
 
-		while( ScanOutArea != NULL )
+		int Config;
+
+		for( Config = 0; Config < ConfigCount; Config++ )
 		{
-			if( ScanOutArea -> Height > OutArea -> Height )
-			{
-				break;
-			}
+			// In configuration 0 the right area spans the whole height of
+			// the free area, in configuration 1 the bottom area spans the
+			// whole width.
 
-			PrevScanOutArea = ScanOutArea;
-			ScanOutArea = ScanOutArea -> Next;
+			int c = addFreeArea( Depth + 1, fa.OutImage, fa.x + w, fa.y,
+				RemainRight, ( Config == 0 ? fa.Height : h ));
+
+			c += addFreeArea( Depth + 1, fa.OutImage, fa.x, fa.y + h,
+				( Config == 0 ? w : fa.Width ), RemainBottom );
+
+			search( Depth + 1 );
+			FreeAreaCount -= c;
 		}
 
-		OutArea -> Next = PrevScanOutArea -> Next;
-		PrevScanOutArea -> Next = OutArea;
+		FreeAreas[ FreeAreaCount ] = FreeAreas[ k ];
+		FreeAreas[ k ] = fa;
+		FreeAreaCount++;
 
-		return( PrevScanOutArea );
+		OutImage = OutImageSave;
+		OutSize = OutSizeSave;
 	}
 
 	/**
-	 * Fit area initial descending-order sorting callback function for the
-	 * qsort() function.
+	 * Function searches placements of the areas starting at the specified
+	 * fit order position.
 	 *
-	 * @param a Comparison area 1.
-	 * @param b Comparison area 2.
+	 * @param Depth Fit order position of the area to place.
 	 */
 
-	static int FitAreasInSortFn( const void* a, const void* b )
+	void search( const int Depth )
 	{
-		const CFitArea& a1 = *(const CFitArea*) a;
-		const CFitArea& a2 = *(const CFitArea*) b;
+		if( Depth == AreaCount )
+		{
+			if( ImageCount < BestImageCount || OutSize < BestOutSize )
+			{
+				BestImageCount = ImageCount;
+				BestOutSize = OutSize;
+				int i;
 
-		return( a2.Width - a1.Width );
-	}
+				for( i = 0; i < AreaCount; i++ )
+				{
+					BestPlaced[ i ] = Placed[ i ];
+				}
 
-	/**
-	 * Fit area post sorting callback function for the qsort() function.
-	 * Sorts areas so that they "look in order" in the finalized best fitted
-	 * areas list.
-	 *
-	 * @param a Comparison area 1.
-	 * @param b Comparison area 2.
-	 */
+				for( i = 0; i < ImageCount; i++ )
+				{
+					BestImages[ i ] = Images[ i ];
+				}
 
-	static int FitAreasOutSortFn( const void* a, const void* b )
-	{
-		const CFitArea& a1 = *(const CFitArea*) a;
-		const CFitArea& a2 = *(const CFitArea*) b;
+				if( BestOutSize == AreaSize )
+				{
+					CallsLeft = 0; // The fit is optimal.
+				}
+			}
 
-		if( a1.OutImage > a2.OutImage )
-		{
-			return( 1 );
+			return;
 		}
-		else
-		if( a1.OutImage < a2.OutImage )
+
+		if( ImageCount > BestImageCount ||
+			( CallsLeft <= 0 && BestImageCount <= AreaCount ))
 		{
-			return( -1 );
+			return;
 		}
 
-		if( a1.OutX > a2.OutX )
+		CallsLeft--;
+		bool WasPlaced = false;
+		int Pass;
+		int r;
+
+		// Placements that do not enlarge the output image are tried first.
+
+		for( Pass = 0; Pass < 2; Pass++ )
 		{
-			return( 1 );
+			for( r = 0; r < ( CanRotate[ Depth ] ? 2 : 1 ); r++ )
+			{
+				const int w = ( r == 0 ? Width[ Depth ] : Height[ Depth ]);
+				const int h = ( r == 0 ? Height[ Depth ] : Width[ Depth ]);
+				int k;
+
+				for( k = 0; k < FreeAreaCount; k++ )
+				{
+					const CFreeArea& fa = FreeAreas[ k ];
+
+					if( fa.Width < w || fa.Height < h )
+					{
+						continue;
+					}
+
+					const COutImage& OutImage = Images[ fa.OutImage ];
+					const bool IsInside = ( fa.x + w <= OutImage.Width &&
+						fa.y + h <= OutImage.Height );
+
+					if( IsInside == ( Pass == 0 ))
+					{
+						WasPlaced = true;
+						place( Depth, k, w, h, r != 0 );
+					}
+				}
+			}
 		}
-		else
-		if( a1.OutX < a2.OutX )
+
+		if( WasPlaced || ImageCount >= BestImageCount )
 		{
-			return( -1 );
+			return;
 		}
 
-		return( a1.OutY - a2.OutY );
+		// The area does not fit into existing output images, and is placed
+		// into a new output image in each orientation.
+
+		for( r = 0; r < ( CanRotate[ Depth ] ? 2 : 1 ); r++ )
+		{
+			const int w = ( r == 0 ? Width[ Depth ] : Height[ Depth ]);
+			const int h = ( r == 0 ? Height[ Depth ] : Width[ Depth ]);
+
+			COutImage& NewImage = Images[ ImageCount ];
+			NewImage.Width = 0;
+			NewImage.Height = 0;
+			NewImage.Size = 0;
+
+			CFreeArea& NewArea = FreeAreas[ FreeAreaCount ];
+			NewArea.OutImage = ImageCount;
+			NewArea.x = 0;
+			NewArea.y = 0;
+			NewArea.Width = ( w > MaxOutImageWidth ? w : MaxOutImageWidth );
+			NewArea.Height = ( h > MaxOutImageHeight ? h :
+				MaxOutImageHeight );
+
+			FreeAreaCount++;
+			ImageCount++;
+
+			place( Depth, FreeAreaCount - 1, w, h, r != 0 );
+
+			ImageCount--;
+			FreeAreaCount--;
+		}
 	}
 };
 
@@ -0,0 +1,266 @@
+// Benchmark and regression driver for the area fitter.
+//
+// Usage: bench [ThreadCount [MaxFitCallsLimit [AllowRotation]]]
+//
+// Each workload is generated from a fixed seed, so the results printed for
+// a single thread are reproducible and can be compared between builds. The
+// "hash" column is a checksum of the final layout: it should only change if
+// the search itself was changed. Search statistics are obtained via the
+// CAreaFitter :: CFitStats structure.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "areafit.h"
+using namespace afit;
+
+typedef std :: chrono :: steady_clock CClock;
+
+/**
+ * Pseudo-random number generator used to produce reproducible workloads.
+ */
+
+class CRandom
+{
+public:
+	CRandom( const unsigned int aSeed )
+		: Seed( aSeed )
+	{
+	}
+
+	/**
+	 * @return Random value in the range [Min; Max].
+	 */
+
+	int get( const int Min, const int Max )
+	{
+		Seed = Seed * 1103515245 + 12345;
+		return( Min + (int) (( Seed >> 8 ) % (unsigned int) ( Max - Min + 1 )));
+	}
+
+private:
+	unsigned int Seed; ///< Current generator state.
+};
+
+/**
+ * Workload description.
+ */
+
+struct CWorkload
+{
+	const char* Name; ///< Name of the workload.
+	int MaxOutImageWidth; ///< Maximal output image width.
+	int MaxOutImageHeight; ///< Maximal output image height.
+	int ClusterSize; ///< CFitParams :: ClusterSize value.
+	void (*generate)( CArray< CAreaFitter :: CFitArea >& Areas );
+		///< Function that produces the areas of the workload.
+};
+
+static void addArea( CArray< CAreaFitter :: CFitArea >& Areas,
+	const int Width, const int Height )
+{
+	CAreaFitter :: CFitArea& Area = Areas.add();
+	Area.Object = (void*) (intptr_t) Areas.getItemCount();
+	Area.Width = Width;
+	Area.Height = Height;
+	Area.MayRotate = true;
+}
+
+// Font glyph set: a few hundred areas of similar height, varying width.
+
+static void genGlyphs( CArray< CAreaFitter :: CFitArea >& Areas )
+{
+	CRandom Rnd( 1 );
+	int i;
+
+	for( i = 0; i < 250; i++ )
+	{
+		addArea( Areas, Rnd.get( 3, 22 ), Rnd.get( 14, 24 ));
+	}
+}
+
+// UI sprite set: icons of common sizes (with duplicates) and some panels.
+
+static void genSprites( CArray< CAreaFitter :: CFitArea >& Areas )
+{
+	static const int IconSizes[] = { 16, 24, 32, 48, 64 };
+	CRandom Rnd( 2 );
+	int i;
+
+	for( i = 0; i < 80; i++ )
+	{
+		const int s = IconSizes[ Rnd.get( 0, 4 )];
+		addArea( Areas, s, s );
+	}
+
+	for( i = 0; i < 20; i++ )
+	{
+		addArea( Areas, Rnd.get( 40, 200 ), Rnd.get( 20, 120 ));
+	}
+}
+
+// Power-of-two textures.
+
+static void genPow2( CArray< CAreaFitter :: CFitArea >& Areas )
+{
+	CRandom Rnd( 3 );
+	int i;
+
+	for( i = 0; i < 40; i++ )
+	{
+		addArea( Areas, 8 << Rnd.get( 0, 5 ), 8 << Rnd.get( 0, 5 ));
+	}
+}
+
+// Many tiny areas.
+
+static void genTiny( CArray< CAreaFitter :: CFitArea >& Areas )
+{
+	CRandom Rnd( 4 );
+	int i;
+
+	for( i = 0; i < 2000; i++ )
+	{
+		addArea( Areas, Rnd.get( 1, 8 ), Rnd.get( 1, 8 ));
+	}
+}
+
+// Few huge areas.
+
+static void genHuge( CArray< CAreaFitter :: CFitArea >& Areas )
+{
+	CRandom Rnd( 5 );
+	int i;
+
+	for( i = 0; i < 10; i++ )
+	{
+		addArea( Areas, Rnd.get( 100, 500 ), Rnd.get( 100, 500 ));
+	}
+}
+
+// Glyphs of five font sizes: areas of a few distinct heights. The
+// hierarchical search ("fontscl") usually fits them better than a single
+// search.
+
+static void genFonts( CArray< CAreaFitter :: CFitArea >& Areas )
+{
+	static const int FontSizes[] = { 12, 16, 20, 24, 32 };
+	CRandom Rnd( 8 );
+	int i;
+	int j;
+
+	for( i = 0; i < 5; i++ )
+	{
+		const int h = FontSizes[ i ];
+
+		for( j = 0; j < 200; j++ )
+		{
+			addArea( Areas, h / 4 + Rnd.get( 0, h * 3 / 4 ), h );
+		}
+	}
+}
+
+// Mix of many tiny and a few huge areas.
+
+static void genMixed( CArray< CAreaFitter :: CFitArea >& Areas )
+{
+	CRandom Rnd( 6 );
+	int i;
+
+	for( i = 0; i < 6; i++ )
+	{
+		addArea( Areas, Rnd.get( 150, 400 ), Rnd.get( 150, 400 ));
+	}
+
+	for( i = 0; i < 400; i++ )
+	{
+		addArea( Areas, Rnd.get( 2, 12 ), Rnd.get( 2, 12 ));
+	}
+}
+
+static const CWorkload Workloads[] = {
+	{ "glyphs", 256, 256, 0, genGlyphs },
+	{ "sprites", 512, 512, 0, genSprites },
+	{ "pow2", 512, 512, 0, genPow2 },
+	{ "tiny", 128, 128, 0, genTiny },
+	{ "huge", 1024, 1024, 0, genHuge },
+	{ "mixed", 1024, 1024, 0, genMixed },
+	{ "fonts", 512, 512, 0, genFonts },
+	{ "fontscl", 512, 512, 200, genFonts },
+};
+
+/**
+ * @return Checksum of the layout, independent of the order of the areas.
+ */
+
+static unsigned int getLayoutHash(
+	const CArray< CAreaFitter :: CFitArea >& Areas )
+{
+	unsigned int Hash = 0;
+	int i;
+
+	for( i = 0; i < Areas.getItemCount(); i++ )
+	{
+		const CAreaFitter :: CFitArea& a = Areas[ i ];
+		unsigned int h = (unsigned int) (intptr_t) a.Object;
+		h = h * 31 + a.OutImage;
+		h = h * 31 + a.OutX;
+		h = h * 31 + a.OutY;
+		h *= 2654435761U;
+		Hash += h ^ ( h >> 15 );
+	}
+
+	return( Hash );
+}
+
+int main( int argc, char* argv[])
+{
+	const int ThreadCount = ( argc > 1 ? atoi( argv[ 1 ]) : 1 );
+	const int MaxFitCallsLimit = ( argc > 2 ? atoi( argv[ 2 ]) : 1000000 );
+	const bool AllowRotation = ( argc > 3 ? atoi( argv[ 3 ]) != 0 : false );
+	const int WorkloadCount = sizeof( Workloads ) / sizeof( Workloads[ 0 ]);
+	int w;
+
+	printf( "%-8s %5s %8s %8s %10s %9s %9s %9s %7s %4s %8s\n",
+		"workload", "areas", "limit", "calls", "calls/s", "first,s",
+		"best,s", "total,s", "quality", "imgs", "hash" );
+
+	for( w = 0; w < WorkloadCount; w++ )
+	{
+		const CWorkload& wl = Workloads[ w ];
+		int FitCallsLimit;
+
+		for( FitCallsLimit = 1000; FitCallsLimit <= MaxFitCallsLimit;
+			FitCallsLimit *= 10 )
+		{
+			CArray< CAreaFitter :: CFitArea > AreasToFit;
+			CArray< CAreaFitter :: COutImage > BestOutImages;
+			wl.generate( AreasToFit );
+			const int AreaCount = AreasToFit.getItemCount();
+
+			CAreaFitter :: CFitStats Stats;
+			CAreaFitter :: CFitParams Params;
+			Params.ThreadCount = ThreadCount;
+			Params.Stats = &Stats;
+			Params.AllowRotation = AllowRotation;
+			Params.ClusterSize = wl.ClusterSize;
+			double FitQuality = 0.0;
+			const CClock :: time_point StartTime = CClock :: now();
+
+			const bool Success = CAreaFitter :: fitAreas( AreasToFit,
+				BestOutImages, wl.MaxOutImageWidth, wl.MaxOutImageHeight,
+				0x7FFFFFFF, 1, FitCallsLimit, FitQuality, Params );
+
+			const double TotalTime = std :: chrono :: duration< double >(
+				CClock :: now() - StartTime ).count();
+
+			printf( "%-8s %5i %8i %8i %10.0f %9.5f %9.5f %9.5f %7.3f %4i "
+				"%08x\n", wl.Name, AreaCount, FitCallsLimit,
+				Stats.FitCallCount, Stats.FitCallCount / TotalTime,
+				Stats.FirstBestFitTime, Stats.LastBestFitTime, TotalTime,
+				( Success ? FitQuality : 0.0 ), BestOutImages.getItemCount(),
+				( Success ? getLayoutHash( AreasToFit ) : 0 ));
+		}
+	}
+
+	return( 0 );
+}
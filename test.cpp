@@ -0,0 +1,1920 @@
+// Regression tests of the area fitter.
+//
+// Usage: test
+//
+// Each test prints its name and "ok" or "FAILED". The program returns 0 if
+// all tests passed, and 1 otherwise.
+
+#include <stdio.h>
+#include "areafit.h"
+using namespace afit;
+
+// The fitter is included a second time, with the SSE2 scan enabled, to
+// compare its layouts with the scalar build.
+
+#if defined( __SSE2__ )
+	#include <emmintrin.h>
+	#undef AREAFIT_INCLUDED
+	#undef AREAFIT_SSE2
+	#define AREAFIT_SSE2 1
+
+	namespace sse2 {
+	#include "areafit.h"
+	} // namespace sse2
+#endif // defined( __SSE2__ )
+
+typedef CAreaFitter :: CFitArea CFitArea;
+typedef CAreaFitter :: COutImage COutImage;
+typedef CAreaFitter :: CFitParams CFitParams;
+
+static void addArea( CArray< CFitArea >& Areas, const int Width,
+	const int Height )
+{
+	CFitArea& Area = Areas.add();
+	Area.Object = (void*) (intptr_t) Areas.getItemCount();
+	Area.Width = Width;
+	Area.Height = Height;
+	Area.MayRotate = true;
+}
+
+/**
+ * @return Areas of reproducible random dimensions.
+ */
+
+static CArray< CFitArea > makeAreas( const int Count, unsigned int Seed )
+{
+	CArray< CFitArea > Areas;
+	int i;
+
+	for( i = 0; i < Count; i++ )
+	{
+		Seed = Seed * 1103515245 + 12345;
+		const int w = 4 + (int) (( Seed >> 8 ) % 40 );
+		Seed = Seed * 1103515245 + 12345;
+		const int h = 4 + (int) (( Seed >> 8 ) % 40 );
+		addArea( Areas, w, h );
+	}
+
+	return( Areas );
+}
+
+/**
+ * @return Areas of reproducible random dimensions that exactly cover an
+ * area of the specified dimensions: the area is cut into Count parts by
+ * repeatedly splitting the largest part across its longer side.
+ */
+
+static CArray< CFitArea > makeCutAreas( const int Width, const int Height,
+	const int Count, unsigned int Seed )
+{
+	CArray< CFitArea > Areas;
+	addArea( Areas, Width, Height );
+
+	while( Areas.getItemCount() < Count )
+	{
+		int j = 0;
+		int i;
+
+		for( i = 1; i < Areas.getItemCount(); i++ )
+		{
+			if( Areas[ i ].Width * Areas[ i ].Height >
+				Areas[ j ].Width * Areas[ j ].Height )
+			{
+				j = i;
+			}
+		}
+
+		Seed = Seed * 1103515245 + 12345;
+		CFitArea& a = Areas[ j ];
+		const bool IsVertical = ( a.Width >= a.Height );
+		const int Length = ( IsVertical ? a.Width : a.Height );
+		const int Cut = Length / 4 + (int) (( Seed >> 8 ) % ( Length / 2 ));
+
+		if( IsVertical )
+		{
+			a.Width = Cut;
+			addArea( Areas, Length - Cut, Areas[ j ].Height );
+		}
+		else
+		{
+			a.Height = Cut;
+			addArea( Areas, Areas[ j ].Width, Length - Cut );
+		}
+	}
+
+	return( Areas );
+}
+
+/**
+ * @return "True" if the areas lie within their output images and do not
+ * overlap.
+ */
+
+static bool isLayoutValid( const CArray< CFitArea >& Areas,
+	const CArray< COutImage >& OutImages )
+{
+	int i;
+
+	for( i = 0; i < Areas.getItemCount(); i++ )
+	{
+		const CFitArea& a = Areas[ i ];
+		const int aw = ( a.OutRotated ? a.Height : a.Width );
+		const int ah = ( a.OutRotated ? a.Width : a.Height );
+
+		if( a.OutImage < 0 || a.OutImage >= OutImages.getItemCount() ||
+			a.OutX < 0 || a.OutY < 0 ||
+			a.OutX + aw > OutImages[ a.OutImage ].Width ||
+			a.OutY + ah > OutImages[ a.OutImage ].Height )
+		{
+			return( false );
+		}
+
+		int j;
+
+		for( j = i + 1; j < Areas.getItemCount(); j++ )
+		{
+			const CFitArea& b = Areas[ j ];
+			const int bw = ( b.OutRotated ? b.Height : b.Width );
+			const int bh = ( b.OutRotated ? b.Width : b.Height );
+
+			if( a.OutImage == b.OutImage && a.OutX < b.OutX + bw &&
+				b.OutX < a.OutX + aw && a.OutY < b.OutY + bh &&
+				b.OutY < a.OutY + ah )
+			{
+				return( false );
+			}
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * @return "True" if two fits of the same areas place each area (found by
+ * its Object) identically.
+ */
+
+static bool isSameLayout( const CArray< CFitArea >& Areas1,
+	const CArray< COutImage >& OutImages1, const CArray< CFitArea >& Areas2,
+	const CArray< COutImage >& OutImages2 )
+{
+	if( Areas1.getItemCount() != Areas2.getItemCount() ||
+		OutImages1.getItemCount() != OutImages2.getItemCount() )
+	{
+		return( false );
+	}
+
+	int i;
+
+	for( i = 0; i < OutImages1.getItemCount(); i++ )
+	{
+		if( OutImages1[ i ].Width != OutImages2[ i ].Width ||
+			OutImages1[ i ].Height != OutImages2[ i ].Height )
+		{
+			return( false );
+		}
+	}
+
+	for( i = 0; i < Areas1.getItemCount(); i++ )
+	{
+		const CFitArea& a = Areas1[ i ];
+		int j;
+
+		for( j = 0; j < Areas2.getItemCount(); j++ )
+		{
+			if( Areas2[ j ].Object == a.Object )
+			{
+				break;
+			}
+		}
+
+		if( j == Areas2.getItemCount() )
+		{
+			return( false );
+		}
+
+		const CFitArea& b = Areas2[ j ];
+
+		if( a.OutImage != b.OutImage || a.OutX != b.OutX ||
+			a.OutY != b.OutY || a.OutRotated != b.OutRotated )
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * @return Summary size of the output images.
+ */
+
+static CAreaFitter :: TSize getOutSize( const CArray< COutImage >& OutImages )
+{
+	CAreaFitter :: TSize OutSize = 0;
+	int i;
+
+	for( i = 0; i < OutImages.getItemCount(); i++ )
+	{
+		OutSize += OutImages[ i ].Size;
+	}
+
+	return( OutSize );
+}
+
+/**
+ * Function checks that a multi-threaded search that is not limited by
+ * FitCallsLimit finds a fit of the same size as a single-threaded search:
+ * the threads together search all possibilities.
+ */
+
+static bool testThreadsExhaustive()
+{
+	static const int ThreadCounts[] = { 1, 2, 4, 8 };
+	const int ThreadCountCount = sizeof( ThreadCounts ) /
+		sizeof( ThreadCounts[ 0 ]);
+
+	const int FitCallsLimit = 10000000;
+	CAreaFitter :: CFitStats Stats;
+	CFitParams Params;
+	Params.Stats = &Stats;
+	CAreaFitter :: TSize OutSize = 0;
+	double q;
+	int i;
+
+	for( i = 0; i < ThreadCountCount; i++ )
+	{
+		Params.ThreadCount = ThreadCounts[ i ];
+		CArray< CFitArea > Areas = makeAreas( 6, 7 );
+		CArray< COutImage > OutImages;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 128, 128,
+			0x7FFFFFFF, 1, FitCallsLimit, q, Params ) ||
+			!isLayoutValid( Areas, OutImages ) ||
+			Stats.FitCallCount >= FitCallsLimit )
+		{
+			return( false );
+		}
+
+		if( i == 0 )
+		{
+			OutSize = getOutSize( OutImages );
+		}
+		else
+		if( getOutSize( OutImages ) != OutSize )
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that a multi-threaded search which steals work, including
+ * configuration 2 branches, produces a valid layout within FitCallsLimit.
+ */
+
+static bool testStealing()
+{
+	static const int ThreadCounts[] = { 2, 4, 8 };
+	const int ThreadCountCount = sizeof( ThreadCounts ) /
+		sizeof( ThreadCounts[ 0 ]);
+
+	const int FitCallsLimit = 300000;
+	CAreaFitter :: CFitStats Stats;
+	CFitParams Params;
+	Params.Stats = &Stats;
+	double q;
+	int i;
+
+	for( i = 0; i < ThreadCountCount; i++ )
+	{
+		Params.ThreadCount = ThreadCounts[ i ];
+		CArray< CFitArea > Areas = makeAreas( 40, 11 );
+		CArray< COutImage > OutImages;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 256, 256,
+			0x7FFFFFFF, 1, FitCallsLimit, q, Params ) ||
+			!isLayoutValid( Areas, OutImages ) ||
+			Stats.FitCallCount > FitCallsLimit )
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that a result cached with other WorkUnits,
+ * RestartCount or RestartSeed values is not returned: the search is
+ * performed, and its layout equals that of an uncached search with the
+ * same parameters.
+ */
+
+static bool testCacheParams()
+{
+	const CArray< CFitArea > Areas = makeAreas( 40, 1 );
+	CAreaFitter :: CFitCache Cache;
+	CAreaFitter :: CFitStats Stats;
+	CFitParams Params;
+	Params.Cache = &Cache;
+	Params.Stats = &Stats;
+	double q;
+
+	static const int Settings[][ 3 ] = {
+		{ 0, 0, 1 }, // WorkUnits, RestartCount, RestartSeed.
+		{ 4, 0, 1 },
+		{ 0, 3, 1 },
+		{ 0, 3, 2 }
+	};
+
+	const int SettingCount = sizeof( Settings ) / sizeof( Settings[ 0 ]);
+	int i;
+
+	for( i = 0; i < SettingCount; i++ )
+	{
+		Params.WorkUnits = Settings[ i ][ 0 ];
+		Params.RestartCount = Settings[ i ][ 1 ];
+		Params.RestartSeed = Settings[ i ][ 2 ];
+
+		CArray< CFitArea > CachedAreas = Areas;
+		CArray< COutImage > CachedOutImages;
+
+		if( !CAreaFitter :: fitAreas( CachedAreas, CachedOutImages, 128,
+			128, 0x7FFFFFFF, 1, 20000, q, Params ) ||
+			Stats.FitCallCount == 0 )
+		{
+			return( false );
+		}
+
+		CFitParams UncachedParams = Params;
+		UncachedParams.Cache = NULL;
+		UncachedParams.Stats = NULL;
+		CArray< CFitArea > UncachedAreas = Areas;
+		CArray< COutImage > UncachedOutImages;
+
+		if( !CAreaFitter :: fitAreas( UncachedAreas, UncachedOutImages,
+			128, 128, 0x7FFFFFFF, 1, 20000, q, UncachedParams ) ||
+			!isSameLayout( CachedAreas, CachedOutImages, UncachedAreas,
+			UncachedOutImages ))
+		{
+			return( false );
+		}
+	}
+
+	// The same parameters are served from the cache.
+
+	CArray< CFitArea > CachedAreas = Areas;
+	CArray< COutImage > CachedOutImages;
+
+	return( CAreaFitter :: fitAreas( CachedAreas, CachedOutImages, 128, 128,
+		0x7FFFFFFF, 1, 20000, q, Params ) && Stats.FitCallCount == 0 &&
+		isLayoutValid( CachedAreas, CachedOutImages ));
+}
+
+/**
+ * Function checks a hierarchical search whose super-areas are not fewer
+ * than ClusterSize, which used to recurse without an end.
+ */
+
+static bool testClusterTopLevel()
+{
+	CFitParams Params;
+	Params.ClusterSize = 1;
+	double q;
+
+	CArray< CFitArea > Areas = makeAreas( 5, 2 );
+	CArray< COutImage > OutImages;
+
+	if( !CAreaFitter :: fitAreas( Areas, OutImages, 128, 128, 0x7FFFFFFF,
+		1, 10000, q, Params ) || !isLayoutValid( Areas, OutImages ))
+	{
+		return( false );
+	}
+
+	// With this image size limit, each super-area needs its own output
+	// image.
+
+	Params.ClusterSize = 2;
+	Areas.clear();
+	addArea( Areas, 60, 60 );
+	addArea( Areas, 60, 60 );
+	addArea( Areas, 60, 60 );
+
+	return( CAreaFitter :: fitAreas( Areas, OutImages, 128, 128, 3600, 1,
+		10000, q, Params ) && isLayoutValid( Areas, OutImages ) &&
+		OutImages.getItemCount() == 3 );
+}
+
+/**
+ * Function checks that a hierarchical search performs no more calls than
+ * FitCallsLimit, including limits too small to be divided among the
+ * clusters.
+ */
+
+static bool testClusterCallsLimit()
+{
+	static const int Limits[] = { 10, 100, 1000, 100000 };
+	const int LimitCount = sizeof( Limits ) / sizeof( Limits[ 0 ]);
+	CAreaFitter :: CFitStats Stats;
+	CFitParams Params;
+	Params.ClusterSize = 20;
+	Params.Stats = &Stats;
+	double q;
+	int i;
+
+	for( i = 0; i < LimitCount; i++ )
+	{
+		CArray< CFitArea > Areas = makeAreas( 200, 3 );
+		CArray< COutImage > OutImages;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 256, 256,
+			0x7FFFFFFF, 1, Limits[ i ], q, Params ) ||
+			!isLayoutValid( Areas, OutImages ) ||
+			Stats.FitCallCount > Limits[ i ])
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks fits with rotation allowed: the layout is valid with
+ * the rotated dimensions, areas without the MayRotate flag are not
+ * rotated, and an area wider than the output image is rotated.
+ */
+
+static bool testRotation()
+{
+	CFitParams Params;
+	Params.AllowRotation = true;
+	double q;
+
+	CArray< CFitArea > Areas = makeAreas( 60, 4 );
+	CArray< COutImage > OutImages;
+	int i;
+
+	for( i = 0; i < Areas.getItemCount(); i += 2 )
+	{
+		Areas[ i ].MayRotate = false;
+	}
+
+	if( !CAreaFitter :: fitAreas( Areas, OutImages, 256, 256, 0x7FFFFFFF,
+		1, 20000, q, Params ) || !isLayoutValid( Areas, OutImages ))
+	{
+		return( false );
+	}
+
+	for( i = 0; i < Areas.getItemCount(); i++ )
+	{
+		if( Areas[ i ].OutRotated && !Areas[ i ].MayRotate )
+		{
+			return( false );
+		}
+	}
+
+	Areas.clear();
+	addArea( Areas, 40, 10 );
+	addArea( Areas, 12, 30 );
+
+	return( CAreaFitter :: fitAreas( Areas, OutImages, 16, 128, 0x7FFFFFFF,
+		1, 1000, q, Params ) && isLayoutValid( Areas, OutImages ) &&
+		OutImages[ 0 ].Width <= 16 );
+}
+
+/**
+ * Function checks that the refitAreas() function places the new areas
+ * without overlapping the fixed areas, in output images that still
+ * contain the fixed areas.
+ */
+
+static bool testRefit()
+{
+	CFitParams Params;
+	double q;
+
+	CArray< CFitArea > FixedAreas = makeAreas( 30, 5 );
+	CArray< COutImage > OutImages;
+
+	if( !CAreaFitter :: fitAreas( FixedAreas, OutImages, 128, 128,
+		0x7FFFFFFF, 1, 10000, q, Params ))
+	{
+		return( false );
+	}
+
+	// Areas are removed by omitting them from the fixed areas.
+
+	FixedAreas.erase( 3 );
+	FixedAreas.erase( 10 );
+
+	CArray< CFitArea > NewAreas = makeAreas( 8, 6 );
+	int i;
+
+	for( i = 0; i < NewAreas.getItemCount(); i++ )
+	{
+		NewAreas[ i ].Object = (void*) (intptr_t) ( 100 + i );
+	}
+
+	if( !CAreaFitter :: refitAreas( FixedAreas, NewAreas, OutImages,
+		128, 128, 0x7FFFFFFF, 10000, q, Params ) ||
+		NewAreas.getItemCount() != 8 )
+	{
+		return( false );
+	}
+
+	CArray< CFitArea > AllAreas = FixedAreas;
+	AllAreas += NewAreas;
+
+	return( isLayoutValid( AllAreas, OutImages ));
+}
+
+/**
+ * Function checks that a search stopped by the cancel flag or by a passed
+ * deadline returns the best fit found so far (the greedy seed fit): a valid
+ * layout, found with fewer calls than FitCallsLimit.
+ */
+
+static bool testCancel()
+{
+	const int FitCallsLimit = 10000000;
+	std :: atomic< bool > CancelFlag( true );
+	double q;
+	int i;
+
+	for( i = 0; i < 2; i++ )
+	{
+		CAreaFitter :: CFitStats Stats;
+		CFitParams Params;
+		Params.Stats = &Stats;
+
+		if( i == 0 )
+		{
+			Params.CancelFlag = &CancelFlag;
+		}
+		else
+		{
+			Params.setTimeLimit( -1.0 );
+		}
+
+		CArray< CFitArea > Areas = makeAreas( 40, 3 );
+		CArray< COutImage > OutImages;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 256, 256,
+			0x7FFFFFFF, 1, FitCallsLimit, q, Params ) ||
+			!isLayoutValid( Areas, OutImages ) || q <= 0.0 ||
+			Stats.FitCallCount >= FitCallsLimit )
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Observer that checks the fits it receives, and stops the search after
+ * the specified number of fits.
+ */
+
+class CTestObserver : public CAreaFitter :: CFitObserver
+{
+public:
+	int FitCount; ///< The number of fits received.
+	int StopCount; ///< The number of fits after which the search is
+		/// stopped, 0 if the search is not stopped.
+	double LastQuality; ///< Quality of the last fit received.
+	bool IsOk; ///< "True" if all fits were valid, and their quality
+		/// increased.
+
+	CTestObserver( const int aStopCount )
+		: FitCount( 0 )
+		, StopCount( aStopCount )
+		, LastQuality( 0.0 )
+		, IsOk( true )
+	{
+	}
+
+	virtual bool onBestFit( const CArray< CFitArea >& FittedAreas,
+		const CArray< COutImage >& OutImages, double FitQuality )
+	{
+		if( !isLayoutValid( FittedAreas, OutImages ) ||
+			FitQuality <= LastQuality )
+		{
+			IsOk = false;
+		}
+
+		FitCount++;
+		LastQuality = FitQuality;
+
+		return( FitCount != StopCount );
+	}
+};
+
+/**
+ * Function checks that the observer receives valid fits of increasing
+ * quality, the last of which is returned, and that the observer can stop
+ * the search.
+ */
+
+static bool testObserver()
+{
+	const int FitCallsLimit = 200000;
+	int StopCount;
+
+	for( StopCount = 0; StopCount < 2; StopCount++ )
+	{
+		CTestObserver Observer( StopCount );
+		CAreaFitter :: CFitStats Stats;
+		CFitParams Params;
+		Params.Observer = &Observer;
+		Params.Stats = &Stats;
+		Params.DoGreedySeed = false;
+		CArray< CFitArea > Areas = makeAreas( 20, 4 );
+		CArray< COutImage > OutImages;
+		double q;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 256, 256,
+			0x7FFFFFFF, 1, FitCallsLimit, q, Params ) ||
+			!isLayoutValid( Areas, OutImages ) || !Observer.IsOk ||
+			Observer.FitCount == 0 || q != Observer.LastQuality )
+		{
+			return( false );
+		}
+
+		if( StopCount > 0 && ( Observer.FitCount != StopCount ||
+			Stats.FitCallCount >= FitCallsLimit ))
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that areas of equal dimensions are tried once per
+ * level: a search of 5 equal areas and an odd one, which takes about
+ * 250000 calls if equal areas are tried separately, is completed within a
+ * lower FitCallsLimit, and finds a fit of the same size as a search with a
+ * higher limit.
+ */
+
+static bool testEqualAreas()
+{
+	static const int FitCallsLimits[] = { 150000, 10000000 };
+	CAreaFitter :: TSize OutSizes[ 2 ];
+	int k;
+
+	for( k = 0; k < 2; k++ )
+	{
+		CArray< CFitArea > Areas;
+		int i;
+
+		for( i = 0; i < 5; i++ )
+		{
+			addArea( Areas, 10, 10 );
+		}
+
+		addArea( Areas, 7, 13 );
+
+		CAreaFitter :: CFitStats Stats;
+		CFitParams Params;
+		Params.Stats = &Stats;
+		Params.DoGreedySeed = false;
+		CArray< COutImage > OutImages;
+		double q;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 64, 64,
+			0x7FFFFFFF, 1, FitCallsLimits[ k ], q, Params ) ||
+			!isLayoutValid( Areas, OutImages ) ||
+			Stats.FitCallCount >= FitCallsLimits[ 0 ])
+		{
+			return( false );
+		}
+
+		OutSizes[ k ] = getOutSize( OutImages );
+	}
+
+	return( OutSizes[ 0 ] == OutSizes[ 1 ]);
+}
+
+/**
+ * Function checks that the greedy seed provides a valid fit when the search
+ * cannot complete any placement, and that the search started from it does
+ * not return a worse fit.
+ */
+
+static bool testGreedySeed()
+{
+	CFitParams Params;
+	CArray< CFitArea > Areas = makeAreas( 40, 5 );
+	CArray< COutImage > OutImages;
+	double q;
+
+	Params.DoGreedySeed = false;
+
+	if( CAreaFitter :: fitAreas( Areas, OutImages, 256, 256, 0x7FFFFFFF, 1,
+		1, q, Params ))
+	{
+		return( false );
+	}
+
+	Params.DoGreedySeed = true;
+	Areas = makeAreas( 40, 5 );
+	OutImages.clear();
+
+	if( !CAreaFitter :: fitAreas( Areas, OutImages, 256, 256, 0x7FFFFFFF, 1,
+		1, q, Params ) || !isLayoutValid( Areas, OutImages ))
+	{
+		return( false );
+	}
+
+	const double SeedQuality = q;
+	Areas = makeAreas( 40, 5 );
+	OutImages.clear();
+
+	return( CAreaFitter :: fitAreas( Areas, OutImages, 256, 256,
+		0x7FFFFFFF, 1, 100000, q, Params ) &&
+		isLayoutValid( Areas, OutImages ) && q >= SeedQuality );
+}
+
+/**
+ * Function checks that the lower bound pruning does not cut optimal fits:
+ * areas cut from an output image of the maximal dimensions are fitted with
+ * 100% quality, while the lower bound prunes placements.
+ */
+
+static bool testLowerBound()
+{
+	int64_t PruneCount = 0;
+	unsigned int Seed;
+
+	for( Seed = 1; Seed <= 6; Seed++ )
+	{
+		CAreaFitter :: CFitStats Stats;
+		CFitParams Params;
+		Params.Stats = &Stats;
+		CArray< CFitArea > Areas = makeCutAreas( 48, 40, 7, Seed );
+		CArray< COutImage > OutImages;
+		double q;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 48, 40,
+			0x7FFFFFFF, 1, 1000000, q, Params ) ||
+			!isLayoutValid( Areas, OutImages ) || q != 100.0 )
+		{
+			return( false );
+		}
+
+		PruneCount += Stats.LowerBoundPruneCount;
+	}
+
+	return( PruneCount > 0 );
+}
+
+/**
+ * Function checks that batches performed by the pool of threads kept in a
+ * context produce the layouts of individual searches, when the context is
+ * used by several calls.
+ */
+
+static bool testAreaSets()
+{
+	CAreaFitter :: CFitContext Context;
+	CFitParams Params;
+	Params.ThreadCount = 3;
+	Params.Context = &Context;
+	int Round;
+
+	for( Round = 0; Round < 2; Round++ )
+	{
+		CAreaFitter :: CFitJobs Jobs;
+		int i;
+
+		for( i = 0; i < 6; i++ )
+		{
+			CAreaFitter :: CFitJob* const Job = new CAreaFitter :: CFitJob;
+			Jobs.add() = Job;
+			Job -> AreasToFit = makeAreas( 10 + i, Round * 10 + i );
+			Job -> MaxOutImageWidth = 128;
+			Job -> MaxOutImageHeight = 128;
+			Job -> FitCallsLimit = 20000;
+		}
+
+		CAreaFitter :: fitAreaSets( Jobs, Params );
+
+		for( i = 0; i < Jobs.getItemCount(); i++ )
+		{
+			const CAreaFitter :: CFitJob& Job = *Jobs[ i ];
+			CArray< CFitArea > Areas = makeAreas( 10 + i, Round * 10 + i );
+			CArray< COutImage > OutImages;
+			CFitParams SingleParams;
+			double q;
+
+			if( !Job.Success ||
+				!isLayoutValid( Job.AreasToFit, Job.OutImages ) ||
+				!CAreaFitter :: fitAreas( Areas, OutImages, 128, 128,
+				Job.MaxOutImageSize, 1, 20000, q, SingleParams ) ||
+				!isSameLayout( Job.AreasToFit, Job.OutImages, Areas,
+				OutImages ))
+			{
+				return( false );
+			}
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that the search with MinOutImageCountLimit returns valid
+ * fits within MaxOutImageSize that are not larger than those of the search
+ * with a single starting number of output images, and are smaller for some
+ * area sets.
+ */
+
+static bool testImageCountLimit()
+{
+	const CAreaFitter :: TSize MaxOutImageSize = 96 * 96;
+	bool IsImproved = false;
+	unsigned int Seed;
+
+	for( Seed = 1; Seed <= 8; Seed++ )
+	{
+		CAreaFitter :: TSize OutSizes[ 2 ];
+		int k;
+
+		for( k = 0; k < 2; k++ )
+		{
+			CFitParams Params;
+			Params.MinOutImageCountLimit = ( k == 0 ? 0 : 3 );
+			CArray< CFitArea > Areas = makeAreas( 30, Seed );
+			CArray< COutImage > OutImages;
+			double q;
+
+			if( !CAreaFitter :: fitAreas( Areas, OutImages, 128, 128,
+				MaxOutImageSize, 1, 20000, q, Params ) ||
+				!isLayoutValid( Areas, OutImages ))
+			{
+				return( false );
+			}
+
+			int i;
+
+			for( i = 0; i < OutImages.getItemCount(); i++ )
+			{
+				if( OutImages[ i ].Size > MaxOutImageSize )
+				{
+					return( false );
+				}
+			}
+
+			OutSizes[ k ] = getOutSize( OutImages );
+		}
+
+		if( OutSizes[ 1 ] > OutSizes[ 0 ])
+		{
+			return( false );
+		}
+
+		IsImproved |= ( OutSizes[ 1 ] < OutSizes[ 0 ]);
+	}
+
+	return( IsImproved );
+}
+
+/**
+ * Function checks that areas with sizes beyond the "int" range are sorted
+ * by area correctly: the largest area is placed first, at the origin of
+ * the first output image.
+ */
+
+static bool testSortByLargeArea()
+{
+	CArray< CFitArea > Areas;
+	addArea( Areas, 40000, 40000 );
+	addArea( Areas, 70000, 70000 );
+	addArea( Areas, 60000, 60000 );
+
+	CFitParams Params;
+	Params.SortOrders = CAreaFitter :: SortByArea;
+	CArray< COutImage > OutImages;
+	double q;
+
+	if( !CAreaFitter :: fitAreas( Areas, OutImages, 200000, 200000,
+		std :: numeric_limits< CAreaFitter :: TSize > :: max(), 1, 1, q,
+		Params ) || !isLayoutValid( Areas, OutImages ))
+	{
+		return( false );
+	}
+
+	int i;
+
+	for( i = 0; i < Areas.getItemCount(); i++ )
+	{
+		if( Areas[ i ].Width == 70000 )
+		{
+			return( Areas[ i ].OutImage == 0 && Areas[ i ].OutX == 0 &&
+				Areas[ i ].OutY == 0 );
+		}
+	}
+
+	return( false );
+}
+
+/**
+ * Function checks that the search with all sort orders returns a valid fit
+ * of the size of the smallest fit among single sort orders.
+ */
+
+static bool testSortOrders()
+{
+	CAreaFitter :: TSize MinOutSize = 0;
+	int Order;
+
+	for( Order = CAreaFitter :: SortByWidth;
+		Order <= CAreaFitter :: SortByPerimeter; Order <<= 1 )
+	{
+		CFitParams Params;
+		Params.SortOrders = Order;
+		CArray< CFitArea > Areas = makeAreas( 30, 9 );
+		CArray< COutImage > OutImages;
+		double q;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 256, 256,
+			0x7FFFFFFF, 1, 20000, q, Params ) ||
+			!isLayoutValid( Areas, OutImages ))
+		{
+			return( false );
+		}
+
+		if( MinOutSize == 0 || getOutSize( OutImages ) < MinOutSize )
+		{
+			MinOutSize = getOutSize( OutImages );
+		}
+	}
+
+	CFitParams Params;
+	Params.SortOrders = CAreaFitter :: SortByAll;
+	Params.ThreadCount = 2;
+	CArray< CFitArea > Areas = makeAreas( 30, 9 );
+	CArray< COutImage > OutImages;
+	double q;
+
+	return( CAreaFitter :: fitAreas( Areas, OutImages, 256, 256,
+		0x7FFFFFFF, 1, 20000, q, Params ) &&
+		isLayoutValid( Areas, OutImages ) &&
+		getOutSize( OutImages ) == MinOutSize );
+}
+
+/**
+ * Function checks that output images have power-of-two or aligned
+ * dimensions, and that area offsets are aligned, as requested.
+ */
+
+static bool testAlignment()
+{
+	int k;
+
+	for( k = 0; k < 2; k++ )
+	{
+		CFitParams Params;
+
+		if( k == 0 )
+		{
+			Params.DoPow2Size = true;
+		}
+		else
+		{
+			Params.AreaAlign = 4;
+			Params.OutImageAlign = 8;
+		}
+
+		CArray< CFitArea > Areas = makeAreas( 25, 12 );
+		CArray< COutImage > OutImages;
+		double q;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 256, 256,
+			0x7FFFFFFF, 1, 20000, q, Params ) ||
+			!isLayoutValid( Areas, OutImages ))
+		{
+			return( false );
+		}
+
+		int i;
+
+		for( i = 0; i < OutImages.getItemCount(); i++ )
+		{
+			const COutImage& oi = OutImages[ i ];
+
+			if( oi.Size != (CAreaFitter :: TSize) oi.Width * oi.Height )
+			{
+				return( false );
+			}
+
+			if( k == 0 ? (( oi.Width & ( oi.Width - 1 )) != 0 ||
+				( oi.Height & ( oi.Height - 1 )) != 0 ) :
+				( oi.Width % 8 != 0 || oi.Height % 8 != 0 ))
+			{
+				return( false );
+			}
+		}
+
+		for( i = 0; i < Areas.getItemCount(); i++ )
+		{
+			if( Areas[ i ].OutX % Params.AreaAlign != 0 ||
+				Areas[ i ].OutY % Params.AreaAlign != 0 )
+			{
+				return( false );
+			}
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that the online packer never produces overlapping areas,
+ * and that a layout fitted from a snapshot of its areas is taken by the
+ * setLayout() function with the areas added after the snapshot.
+ */
+
+static bool testOnlinePacker()
+{
+	CFitParams Params;
+	Params.AllowRotation = true;
+	CAreaFitter :: COnlinePacker Packer( 128, 128, Params );
+	CArray< CFitArea > Areas = makeAreas( 60, 13 );
+	CArray< CFitArea > Snapshot;
+	int i;
+
+	for( i = 0; i < Areas.getItemCount(); i++ )
+	{
+		if( i == 40 )
+		{
+			Snapshot = Packer.getAreas();
+		}
+
+		Packer.addArea( Areas[ i ]);
+		const CFitArea& a = Packer.getAreas()[ i ];
+
+		if( a.Object != Areas[ i ].Object ||
+			a.OutImage != Areas[ i ].OutImage ||
+			a.OutX != Areas[ i ].OutX || a.OutY != Areas[ i ].OutY ||
+			!isLayoutValid( Packer.getAreas(), Packer.getOutImages() ) ||
+			Packer.getOutSize() != getOutSize( Packer.getOutImages() ))
+		{
+			return( false );
+		}
+	}
+
+	CArray< COutImage > OutImages;
+	double q;
+
+	if( !CAreaFitter :: fitAreas( Snapshot, OutImages, 128, 128,
+		0x7FFFFFFF, 1, 20000, q, Params ))
+	{
+		return( false );
+	}
+
+	Packer.setLayout( Snapshot, OutImages );
+
+	if( Packer.getAreas().getItemCount() != Areas.getItemCount() ||
+		!isLayoutValid( Packer.getAreas(), Packer.getOutImages() ) ||
+		Packer.getOutSize() != getOutSize( Packer.getOutImages() ))
+	{
+		return( false );
+	}
+
+	for( i = 0; i < Snapshot.getItemCount(); i++ )
+	{
+		const CFitArea& a = Snapshot[ i ];
+		const CFitArea& b = Packer.getAreas()[ i ];
+
+		if( b.Object != a.Object || b.OutImage != a.OutImage ||
+			b.OutX != a.OutX || b.OutY != a.OutY ||
+			b.OutRotated != a.OutRotated )
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that a saved cache is loaded by another cache, and that
+ * its results are then served without a search. When a loaded result has
+ * the same key as a cached one, the result of a lower output image cost is
+ * kept.
+ */
+
+static bool testCacheFile()
+{
+	const char* const FileName = "test_cache.tmp";
+	const CArray< CFitArea > Areas = makeAreas( 30, 17 );
+	CAreaFitter :: CFitCache Caches[ 2 ];
+	CArray< CFitArea > BestAreas;
+	CArray< COutImage > BestOutImages;
+	CAreaFitter :: CFitStats Stats;
+	CFitParams Params;
+	Params.Stats = &Stats;
+	Params.ImageCost = 1000;
+	Params.DoGreedySeed = false;
+	CAreaFitter :: TSize OutSize = 0;
+	double q;
+	int i;
+
+	// The second cache receives a better fit, found with a higher
+	// FitCallsLimit.
+
+	for( i = 0; i < 2; i++ )
+	{
+		Params.Cache = &Caches[ i ];
+		BestAreas = Areas;
+		BestOutImages.clear();
+
+		if( !CAreaFitter :: fitAreas( BestAreas, BestOutImages, 128, 128,
+			0x7FFFFFFF, 1, ( i == 0 ? 30 : 20000 ), q, Params ) ||
+			( i == 1 && getOutSize( BestOutImages ) >= OutSize ))
+		{
+			return( false );
+		}
+
+		OutSize = getOutSize( BestOutImages );
+	}
+
+	if( !Caches[ 1 ].save( FileName ) || !Caches[ 0 ].load( FileName ) ||
+		Caches[ 0 ].getEntryCount() != 1 )
+	{
+		remove( FileName );
+		return( false );
+	}
+
+	remove( FileName );
+
+	for( i = 0; i < 2; i++ )
+	{
+		Params.Cache = &Caches[ i ];
+		CArray< CFitArea > CachedAreas = Areas;
+		CArray< COutImage > CachedOutImages;
+
+		if( !CAreaFitter :: fitAreas( CachedAreas, CachedOutImages, 128,
+			128, 0x7FFFFFFF, 1, 20000, q, Params ) ||
+			Stats.FitCallCount != 0 ||
+			!isSameLayout( CachedAreas, CachedOutImages, BestAreas,
+			BestOutImages ))
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that truncated cache files, files with invalid item
+ * counts, and files with placements outside of their output images are
+ * rejected by the load() function without adding results.
+ */
+
+static bool testCacheFileInvalid()
+{
+	const char* const FileName = "test_cache.tmp";
+	CAreaFitter :: CFitCache Cache;
+	CFitParams Params;
+	Params.Cache = &Cache;
+	CArray< CFitArea > Areas = makeAreas( 20, 15 );
+	CArray< COutImage > OutImages;
+	double q;
+
+	if( !CAreaFitter :: fitAreas( Areas, OutImages, 128, 128, 0x7FFFFFFF,
+		1, 1000, q, Params ) || !Cache.save( FileName ))
+	{
+		remove( FileName );
+		return( false );
+	}
+
+	// Read the saved file, and write its truncated versions.
+
+	FILE* f = fopen( FileName, "rb" );
+	char Data[ 4096 ];
+	const int DataSize = ( f == NULL ? 0 :
+		(int) fread( Data, 1, sizeof( Data ), f ));
+
+	if( f != NULL )
+	{
+		fclose( f );
+	}
+
+	if( DataSize < 16 || DataSize == (int) sizeof( Data ))
+	{
+		remove( FileName );
+		return( false );
+	}
+
+	CAreaFitter :: CFitCache LoadCache;
+	int Size;
+
+	for( Size = 0; Size < DataSize; Size += 7 )
+	{
+		f = fopen( FileName, "wb" );
+
+		if( f == NULL || fwrite( Data, 1, Size, f ) != (size_t) Size ||
+			fclose( f ) != 0 || LoadCache.load( FileName ) ||
+			LoadCache.getEntryCount() != 0 )
+		{
+			remove( FileName );
+			return( false );
+		}
+	}
+
+	// Corrupt placements of the last area: offsets of its values from the
+	// end of the file, and the values to write.
+
+	static const int Corruptions[][ 2 ] = {
+		{ 9, -1 }, { 5, -1 }, { 9, 128 }, { 5, 128 }, { 5, 0x7FFFFFF0 },
+		{ 1, 1 }
+	};
+
+	const int CorruptionCount = sizeof( Corruptions ) /
+		sizeof( Corruptions[ 0 ]);
+
+	int i;
+
+	for( i = 0; i < CorruptionCount; i++ )
+	{
+		char CorruptData[ sizeof( Data )];
+		memcpy( CorruptData, Data, DataSize );
+		const int Offset = DataSize - Corruptions[ i ][ 0 ];
+
+		if( Corruptions[ i ][ 0 ] == 1 )
+		{
+			CorruptData[ Offset ] = (char) Corruptions[ i ][ 1 ];
+		}
+		else
+		{
+			const int32_t v = Corruptions[ i ][ 1 ];
+			memcpy( CorruptData + Offset, &v, sizeof( v ));
+		}
+
+		f = fopen( FileName, "wb" );
+
+		if( f == NULL || fwrite( CorruptData, 1, DataSize, f ) !=
+			(size_t) DataSize || fclose( f ) != 0 ||
+			LoadCache.load( FileName ) || LoadCache.getEntryCount() != 0 )
+		{
+			remove( FileName );
+			return( false );
+		}
+	}
+
+	// An entry with a huge KeyCount.
+
+	const int32_t Header[ 3 ] = { 1, 0x7FFFFFF0, 0 };
+	f = fopen( FileName, "wb" );
+
+	const bool IsOk = ( f != NULL && fwrite( Data, 1, 4, f ) == 4 &&
+		fwrite( Header, sizeof( Header ), 1, f ) == 1 &&
+		fclose( f ) == 0 && !LoadCache.load( FileName ) &&
+		LoadCache.getEntryCount() == 0 );
+
+	remove( FileName );
+
+	return( IsOk );
+}
+
+/**
+ * Function checks that the small area fitter produces valid fits of small
+ * area sets, not better than the exhaustive search of all area orders by
+ * the CAreaFitter class, with the same number of output images, and of a
+ * close quality on average.
+ */
+
+static bool testSmallAreaFitter()
+{
+	double QualityDiff = 0.0;
+	unsigned int Seed;
+
+	for( Seed = 1; Seed <= 12; Seed++ )
+	{
+		const int AreaCount = 2 + Seed % 5;
+		CArray< CFitArea > Areas = makeAreas( AreaCount, Seed );
+		CArray< COutImage > OutImages;
+		CFitParams Params;
+		double q;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 64, 64, 0x7FFFFFFF,
+			1, 10000000, q, Params ) || !isLayoutValid( Areas, OutImages ))
+		{
+			return( false );
+		}
+
+		CArray< CFitArea > SmallAreas = makeAreas( AreaCount, Seed );
+		CArray< COutImage > SmallOutImages;
+		SmallOutImages.setItemCount( AreaCount );
+		int SmallOutImageCount;
+		double SmallQuality;
+
+		if( !CSmallAreaFitter< 8 > :: fitAreas( &SmallAreas[ 0 ], AreaCount,
+			&SmallOutImages[ 0 ], SmallOutImageCount, 64, 64, 10000000,
+			SmallQuality ))
+		{
+			return( false );
+		}
+
+		SmallOutImages.setItemCount( SmallOutImageCount );
+
+		if( !isLayoutValid( SmallAreas, SmallOutImages ) ||
+			SmallOutImageCount != OutImages.getItemCount() ||
+			SmallQuality > q + 1e-9 )
+		{
+			return( false );
+		}
+
+		QualityDiff += q - SmallQuality;
+	}
+
+	return( QualityDiff / 12 < 1.0 );
+}
+
+/**
+ * Observer that keeps the last fit it receives.
+ */
+
+class CLastFitObserver : public CAreaFitter :: CFitObserver
+{
+public:
+	CArray< CFitArea > Areas; ///< Areas of the last fit.
+	CArray< COutImage > OutImages; ///< Output images of the last fit.
+	double FitQuality; ///< Quality of the last fit.
+
+	CLastFitObserver()
+		: FitQuality( 0.0 )
+	{
+	}
+
+	virtual bool onBestFit( const CArray< CFitArea >& FittedAreas,
+		const CArray< COutImage >& aOutImages, double aFitQuality )
+	{
+		Areas = FittedAreas;
+		OutImages = aOutImages;
+		FitQuality = aFitQuality;
+
+		return( true );
+	}
+};
+
+/**
+ * @return "True" if areas of the same output image are at least Padding
+ * pixels apart, and areas are at least Border pixels away from output image
+ * edges.
+ */
+
+static bool isSpacingValid( const CArray< CFitArea >& Areas,
+	const CArray< COutImage >& OutImages, const int Padding,
+	const int Border )
+{
+	int i;
+
+	for( i = 0; i < Areas.getItemCount(); i++ )
+	{
+		const CFitArea& a = Areas[ i ];
+		const int aw = ( a.OutRotated ? a.Height : a.Width );
+		const int ah = ( a.OutRotated ? a.Width : a.Height );
+		const COutImage& oi = OutImages[ a.OutImage ];
+
+		if( a.OutX < Border || a.OutY < Border ||
+			a.OutX + aw + Border > oi.Width ||
+			a.OutY + ah + Border > oi.Height )
+		{
+			return( false );
+		}
+
+		int j;
+
+		for( j = i + 1; j < Areas.getItemCount(); j++ )
+		{
+			const CFitArea& b = Areas[ j ];
+			const int bw = ( b.OutRotated ? b.Height : b.Width );
+			const int bh = ( b.OutRotated ? b.Width : b.Height );
+
+			if( a.OutImage == b.OutImage &&
+				a.OutX + aw + Padding > b.OutX &&
+				b.OutX + bw + Padding > a.OutX &&
+				a.OutY + ah + Padding > b.OutY &&
+				b.OutY + bh + Padding > a.OutY )
+			{
+				return( false );
+			}
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that the search with spacing keeps Padding between areas
+ * and Border at output image edges, and that the observer receives fits
+ * with the same spacing, the last of which is returned.
+ */
+
+static bool testSpacing()
+{
+	static const int Settings[][ 2 ] = {
+		{ 3, 2 }, // Padding, Border.
+		{ 4, 2 },
+		{ 2, 0 }
+	};
+
+	const int SettingCount = sizeof( Settings ) / sizeof( Settings[ 0 ]);
+	int i;
+
+	for( i = 0; i < SettingCount; i++ )
+	{
+		CLastFitObserver Observer;
+		CFitParams Params;
+		Params.AllowRotation = true;
+		Params.Observer = &Observer;
+		Params.Padding = Settings[ i ][ 0 ];
+		Params.Border = Settings[ i ][ 1 ];
+		CArray< CFitArea > Areas = makeAreas( 25, 16 );
+		CArray< COutImage > OutImages;
+		double q;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 256, 256,
+			0x7FFFFFFF, 1, 20000, q, Params ) ||
+			!isSpacingValid( Areas, OutImages, Params.Padding,
+			Params.Border ) ||
+			!isSpacingValid( Observer.Areas, Observer.OutImages,
+			Params.Padding, Params.Border ) ||
+			!isSameLayout( Areas, OutImages, Observer.Areas,
+			Observer.OutImages ) || q != Observer.FitQuality )
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that the search with the specified parameters produces
+ * identical layouts with 1, 2, 3 and 8 threads. The area set is chosen so
+ * that the search without WorkUnits or RestartCount produces different
+ * layouts with 1 and 2 threads.
+ *
+ * @param Params Search parameters, ThreadCount is changed.
+ */
+
+static bool isThreadCountIndependent( CFitParams& Params )
+{
+	static const int ThreadCounts[] = { 1, 2, 3, 8 };
+	const int ThreadCountCount = sizeof( ThreadCounts ) /
+		sizeof( ThreadCounts[ 0 ]);
+
+	CArray< CFitArea > FirstAreas;
+	CArray< COutImage > FirstOutImages;
+	int i;
+
+	for( i = 0; i < ThreadCountCount; i++ )
+	{
+		Params.ThreadCount = ThreadCounts[ i ];
+		Params.AllowRotation = true;
+		CArray< CFitArea > Areas = makeAreas( 30, 19 );
+		CArray< COutImage > OutImages;
+		double q;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 128, 128,
+			0x7FFFFFFF, 1, 40000, q, Params ) ||
+			!isLayoutValid( Areas, OutImages ))
+		{
+			return( false );
+		}
+
+		if( i == 0 )
+		{
+			FirstAreas = Areas;
+			FirstOutImages = OutImages;
+		}
+		else
+		if( !isSameLayout( Areas, OutImages, FirstAreas, FirstOutImages ))
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that the search divided into work units does not depend
+ * on the number of threads.
+ */
+
+static bool testWorkUnits()
+{
+	CFitParams Params;
+	Params.WorkUnits = 5;
+
+	return( isThreadCountIndependent( Params ));
+}
+
+/**
+ * Function checks that the search with restarts does not depend on the
+ * number of threads.
+ */
+
+static bool testRestarts()
+{
+	CFitParams Params;
+	Params.RestartCount = 4;
+
+	return( isThreadCountIndependent( Params ));
+}
+
+/**
+ * Function checks that a fit without unused space ends the search with a
+ * non-zero image cost: the search with MinOutImageCountLimit is not
+ * repeated with more output images, and performs as many fitArea() calls
+ * as the search with a single starting number of output images.
+ */
+
+static bool testImageCostPerfectFit()
+{
+	unsigned int Seed;
+
+	for( Seed = 1; Seed <= 4; Seed++ )
+	{
+		int FitCallCounts[ 2 ];
+		int k;
+
+		for( k = 0; k < 2; k++ )
+		{
+			CAreaFitter :: CFitStats Stats;
+			CFitParams Params;
+			Params.Stats = &Stats;
+			Params.ImageCost = 1000;
+			Params.ImageDimCost = 10;
+			Params.MinOutImageCountLimit = ( k == 0 ? 0 : 3 );
+			CArray< CFitArea > Areas = makeCutAreas( 48, 40, 6, Seed );
+			CArray< COutImage > OutImages;
+			double q;
+
+			if( !CAreaFitter :: fitAreas( Areas, OutImages, 48, 40,
+				0x7FFFFFFF, 1, 20000, q, Params ) ||
+				!isLayoutValid( Areas, OutImages ) || q != 100.0 )
+			{
+				return( false );
+			}
+
+			FitCallCounts[ k ] = Stats.FitCallCount;
+		}
+
+		if( FitCallCounts[ 1 ] != FitCallCounts[ 0 ])
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that the fitter built with AREAFIT_SSE2 returns the same
+ * layouts as the scalar build. Areas sorted by height or by area are used:
+ * unlike areas sorted by width, they are often placed after wider areas,
+ * and the scan then skips many narrow output areas at once.
+ */
+
+static bool testSSE2Scan()
+{
+#if defined( __SSE2__ )
+	typedef sse2 :: afit :: CAreaFitter CSSE2Fitter;
+	unsigned int Seed;
+
+	for( Seed = 1; Seed <= 6; Seed++ )
+	{
+		const int MaxDim = ( Seed % 3 == 0 ? 128 : 64 );
+		CFitParams Params;
+		Params.SortOrders = ( Seed % 2 == 0 ? CAreaFitter :: SortByHeight :
+			CAreaFitter :: SortByArea );
+
+		Params.AllowRotation = ( Seed > 3 );
+		CArray< CFitArea > Areas = makeAreas( 40, Seed );
+		CArray< COutImage > OutImages;
+		double q;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, MaxDim, MaxDim,
+			0x7FFFFFFF, 1, 20000, q, Params ))
+		{
+			return( false );
+		}
+
+		CSSE2Fitter :: CFitParams SSE2Params;
+		SSE2Params.SortOrders = Params.SortOrders;
+		SSE2Params.AllowRotation = Params.AllowRotation;
+		sse2 :: afit :: CArray< CSSE2Fitter :: CFitArea > SSE2Areas;
+		sse2 :: afit :: CArray< CSSE2Fitter :: COutImage > SSE2OutImages;
+		const CArray< CFitArea > SourceAreas = makeAreas( 40, Seed );
+		int i;
+
+		for( i = 0; i < SourceAreas.getItemCount(); i++ )
+		{
+			CSSE2Fitter :: CFitArea& a = SSE2Areas.add();
+			a.Object = SourceAreas[ i ].Object;
+			a.Width = SourceAreas[ i ].Width;
+			a.Height = SourceAreas[ i ].Height;
+			a.MayRotate = SourceAreas[ i ].MayRotate;
+		}
+
+		if( !CSSE2Fitter :: fitAreas( SSE2Areas, SSE2OutImages, MaxDim,
+			MaxDim, 0x7FFFFFFF, 1, 20000, q, SSE2Params ))
+		{
+			return( false );
+		}
+
+		// The SSE2 results are converted to the scalar build's types.
+
+		CArray< CFitArea > CheckAreas = SourceAreas;
+		CArray< COutImage > CheckOutImages;
+
+		for( i = 0; i < SSE2Areas.getItemCount(); i++ )
+		{
+			CFitArea& a = CheckAreas[ i ];
+			a.Object = SSE2Areas[ i ].Object;
+			a.Width = SSE2Areas[ i ].Width;
+			a.Height = SSE2Areas[ i ].Height;
+			a.OutImage = SSE2Areas[ i ].OutImage;
+			a.OutX = SSE2Areas[ i ].OutX;
+			a.OutY = SSE2Areas[ i ].OutY;
+			a.OutRotated = SSE2Areas[ i ].OutRotated;
+		}
+
+		for( i = 0; i < SSE2OutImages.getItemCount(); i++ )
+		{
+			COutImage& o = CheckOutImages.add();
+			o.Width = SSE2OutImages[ i ].Width;
+			o.Height = SSE2OutImages[ i ].Height;
+			o.Size = SSE2OutImages[ i ].Size;
+		}
+
+		if( !isLayoutValid( CheckAreas, CheckOutImages ) ||
+			!isSameLayout( Areas, OutImages, CheckAreas, CheckOutImages ))
+		{
+			return( false );
+		}
+	}
+#endif // defined( __SSE2__ )
+
+	return( true );
+}
+
+/**
+ * Function checks that the minimal area dimensions used to discard output
+ * areas stay exact while the search backtracks, including when many areas
+ * share them: areas that exactly cover an output image are fitted with 100%
+ * quality. The tiled sets are mostly equal tiles and a few unique smaller
+ * areas; the cut sets are only fitted exactly after much backtracking.
+ */
+
+static bool testMinAreaSize()
+{
+	static const int CutSets[][ 2 ] = {{ 8, 20 }, { 8, 34 }, { 10, 15 }};
+	const int CutSetCount = sizeof( CutSets ) / sizeof( CutSets[ 0 ]);
+	int k;
+
+	for( k = 0; k < 3 + CutSetCount; k++ )
+	{
+		CArray< CFitArea > Areas;
+		int i;
+
+		if( k < 3 )
+		{
+			for( i = 0; i < 14; i++ )
+			{
+				addArea( Areas, 8, 8 );
+			}
+		}
+
+		// The last tile of the 40x24 image is cut into unique areas.
+
+		if( k == 0 )
+		{
+			addArea( Areas, 8, 5 );
+			addArea( Areas, 8, 3 );
+		}
+		else
+		if( k == 1 )
+		{
+			addArea( Areas, 3, 8 );
+			addArea( Areas, 5, 6 );
+			addArea( Areas, 5, 2 );
+		}
+		else
+		if( k == 2 )
+		{
+			addArea( Areas, 8, 4 );
+			addArea( Areas, 8, 4 );
+		}
+		else
+		{
+			Areas = makeCutAreas( 48, 40, CutSets[ k - 3 ][ 0 ],
+				CutSets[ k - 3 ][ 1 ]);
+		}
+
+		const int Width = ( k < 3 ? 40 : 48 );
+		const int Height = ( k < 3 ? 24 : 40 );
+		CFitParams Params;
+		Params.AllowRotation = ( k == 0 || k == 2 );
+		Params.DoGreedySeed = false;
+		CArray< COutImage > OutImages;
+		double q;
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, Width, Height,
+			0x7FFFFFFF, 1, 200000, q, Params ) ||
+			!isLayoutValid( Areas, OutImages ) || q != 100.0 )
+		{
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+/**
+ * Function checks that a hierarchical search stores only its own result in
+ * the cache, and not the results of the cluster searches.
+ */
+
+static bool testClusterCache()
+{
+	CAreaFitter :: CFitCache Cache;
+	CFitParams Params;
+	Params.ClusterSize = 20;
+	Params.Cache = &Cache;
+	CArray< CFitArea > Areas = makeAreas( 100, 6 );
+	CArray< COutImage > OutImages;
+	double q;
+
+	return( CAreaFitter :: fitAreas( Areas, OutImages, 256, 256,
+		0x7FFFFFFF, 1, 100000, q, Params ) &&
+		isLayoutValid( Areas, OutImages ) && Cache.getEntryCount() == 1 );
+}
+
+/**
+ * Function checks that a hierarchical search returns a fit not worse than
+ * that of a single search with the same share of calls, and a better fit
+ * than a single search for glyphs of a few font sizes.
+ */
+
+static bool testClusterQuality()
+{
+	static const int FontSizes[] = { 12, 16, 20, 24, 32 };
+	CFitParams Params;
+	Params.ClusterSize = 50;
+	CFitParams FlatParams;
+	double q;
+	double FlatQuality;
+	int i;
+	int j;
+
+	for( i = 1; i <= 4; i++ )
+	{
+		CArray< CFitArea > Areas = makeAreas( 200, i );
+		CArray< CFitArea > FlatAreas = Areas;
+		CArray< COutImage > OutImages;
+		CArray< COutImage > FlatOutImages;
+
+		// 4 clusters, each search receives 1/6 of the calls.
+
+		if( !CAreaFitter :: fitAreas( Areas, OutImages, 256, 256,
+			0x7FFFFFFF, 1, 60000, q, Params ) ||
+			!isLayoutValid( Areas, OutImages ) ||
+			!CAreaFitter :: fitAreas( FlatAreas, FlatOutImages, 256, 256,
+			0x7FFFFFFF, 1, 10000, FlatQuality, FlatParams ) ||
+			q < FlatQuality )
+		{
+			return( false );
+		}
+	}
+
+	CArray< CFitArea > Areas;
+	unsigned int Seed = 8;
+
+	for( i = 0; i < 5; i++ )
+	{
+		for( j = 0; j < 200; j++ )
+		{
+			Seed = Seed * 1103515245 + 12345;
+			addArea( Areas, FontSizes[ i ] / 4 + (int) (( Seed >> 8 ) %
+				( FontSizes[ i ] * 3 / 4 + 1 )), FontSizes[ i ]);
+		}
+	}
+
+	CArray< CFitArea > FlatAreas = Areas;
+	CArray< COutImage > OutImages;
+	CArray< COutImage > FlatOutImages;
+	Params.ClusterSize = 200;
+
+	return( CAreaFitter :: fitAreas( Areas, OutImages, 512, 512,
+		0x7FFFFFFF, 1, 1000000, q, Params ) &&
+		isLayoutValid( Areas, OutImages ) &&
+		CAreaFitter :: fitAreas( FlatAreas, FlatOutImages, 512, 512,
+		0x7FFFFFFF, 1, 1000000, FlatQuality, FlatParams ) &&
+		q > FlatQuality );
+}
+
+/**
+ * Function checks that the small area fitter rotates an area wider than
+ * the output image when it opens a new output image for it.
+ */
+
+static bool testSmallAreaFitterRotation()
+{
+	CArray< CFitArea > Areas;
+	addArea( Areas, 40, 10 );
+	addArea( Areas, 12, 30 );
+
+	COutImage OutImages[ 2 ];
+	int OutImageCount;
+	double q;
+
+	if( !CSmallAreaFitter< 8 > :: fitAreas( &Areas[ 0 ], 2, OutImages,
+		OutImageCount, 16, 128, 1000, q, true ))
+	{
+		return( false );
+	}
+
+	CArray< COutImage > Images;
+	Images.add( OutImages[ 0 ]);
+
+	return( OutImageCount == 1 && isLayoutValid( Areas, Images ) &&
+		Images[ 0 ].Width <= 16 && Areas[ 0 ].OutRotated );
+}
+
+/**
+ * Test description.
+ */
+
+struct CTest
+{
+	const char* Name; ///< Name of the test.
+	bool (*run)(); ///< Function that returns "true" if the test passed.
+};
+
+static const CTest Tests[] = {
+	{ "threads_exhaustive", testThreadsExhaustive },
+	{ "stealing", testStealing },
+	{ "cache_params", testCacheParams },
+	{ "cluster_top_level", testClusterTopLevel },
+	{ "cluster_calls_limit", testClusterCallsLimit },
+	{ "rotation", testRotation },
+	{ "refit", testRefit },
+	{ "cancel", testCancel },
+	{ "observer", testObserver },
+	{ "equal_areas", testEqualAreas },
+	{ "greedy_seed", testGreedySeed },
+	{ "lower_bound", testLowerBound },
+	{ "area_sets", testAreaSets },
+	{ "image_count_limit", testImageCountLimit },
+	{ "sort_large_area", testSortByLargeArea },
+	{ "sort_orders", testSortOrders },
+	{ "alignment", testAlignment },
+	{ "online_packer", testOnlinePacker },
+	{ "cache_file", testCacheFile },
+	{ "cache_file_invalid", testCacheFileInvalid },
+	{ "small_area_fitter", testSmallAreaFitter },
+	{ "spacing", testSpacing },
+	{ "work_units", testWorkUnits },
+	{ "restarts", testRestarts },
+	{ "image_cost_perfect_fit", testImageCostPerfectFit },
+	{ "sse2_scan", testSSE2Scan },
+	{ "min_area_size", testMinAreaSize },
+	{ "cluster_cache", testClusterCache },
+	{ "cluster_quality", testClusterQuality },
+	{ "small_area_fitter_rotation", testSmallAreaFitterRotation },
+};
+
+int main()
+{
+	const int TestCount = sizeof( Tests ) / sizeof( Tests[ 0 ]);
+	int FailCount = 0;
+	int i;
+
+	for( i = 0; i < TestCount; i++ )
+	{
+		const bool IsOk = Tests[ i ].run();
+		printf( "%-20s %s\n", Tests[ i ].Name, ( IsOk ? "ok" : "FAILED" ));
+
+		if( !IsOk )
+		{
+			FailCount++;
+		}
+	}
+
+	return( FailCount == 0 ? 0 : 1 );
+}